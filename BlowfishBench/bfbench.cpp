@@ -0,0 +1,596 @@
+//-----------------------------------------------------------------------------
+/*
+	bfbench - Blowfish known-answer tests and throughput benchmark
+
+	Checks every kernel (single block, four-way scalar, AVX2 and the
+	dispatching EncodeBlocks/DecodeBlocks) against published vectors and the
+	PK2 header verify bytes, then times them on the buffer sizes the PK2 code
+	actually uses: 8 bytes, one PK2Entry (128) and one PK2EntryBlock (2560).
+	Key schedule setup is timed both uncached and through the schedule cache.
+
+	Usage:
+		bfbench [--kat] [--ms=250]
+
+		--kat	only run the known-answer tests
+		--ms	minimum time spent on each measurement
+
+	The exit code is 1 when any known-answer test fails, so the tool can gate
+	changes to the cipher code.
+
+	Building (gcc/clang):
+		g++ -O2 -I../DivisionInfo bfbench.cpp ../DivisionInfo/PK2/blowfish.cpp
+			../DivisionInfo/PK2/blowfish_avx2.cpp ../DivisionInfo/PK2/blowfish_version.cpp
+			-lboost_thread -lboost_system -o bfbench
+*/
+//-----------------------------------------------------------------------------
+
+#include "PK2/blowfish.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <boost/date_time/posix_time/posix_time_types.hpp>
+
+#if defined(_MSC_VER) && (defined(_M_IX86) || defined(_M_X64))
+	#include <intrin.h>
+	#define BFBENCH_RDTSC 1
+#elif (defined(__GNUC__) || defined(__clang__)) && (defined(__i386__) || defined(__x86_64__))
+	#include <x86intrin.h>
+	#define BFBENCH_RDTSC 1
+#endif
+
+//-----------------------------------------------------------------------------
+
+// Eric Young's Blowfish vectors. Schneier's reference code reads each half of a
+// block as a big-endian word and this implementation reads native words, so the
+// vectors are given as word pairs; that keeps them valid on either byte order.
+struct BlowfishVector
+{
+	uint8_t key[8];
+	uint32_t plain[2];
+	uint32_t cipher[2];
+};
+
+const BlowfishVector bf_vectors[] =
+{
+	{ { 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00 }, { 0x00000000, 0x00000000 }, { 0x4EF99745, 0x6198DD78 } },
+	{ { 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF }, { 0xFFFFFFFF, 0xFFFFFFFF }, { 0x51866FD5, 0xB85ECB8A } },
+	{ { 0x30, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00 }, { 0x10000000, 0x00000001 }, { 0x7D856F9A, 0x613063F2 } },
+	{ { 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11 }, { 0x11111111, 0x11111111 }, { 0x2466DD87, 0x8B963C9D } },
+	{ { 0x01, 0x23, 0x45, 0x67, 0x89, 0xAB, 0xCD, 0xEF }, { 0x11111111, 0x11111111 }, { 0x61F9C380, 0x2281B096 } },
+	{ { 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11 }, { 0x01234567, 0x89ABCDEF }, { 0x7D0CC630, 0xAFDA1EC7 } },
+	{ { 0xFE, 0xDC, 0xBA, 0x98, 0x76, 0x54, 0x32, 0x10 }, { 0x01234567, 0x89ABCDEF }, { 0x0ACEAB0F, 0xC6A0A28D } },
+};
+
+const size_t bf_vector_count = sizeof(bf_vectors) / sizeof(bf_vectors[0]);
+
+// Key every PK2 tool uses when nothing else is given, and the base key it is mixed with.
+const char * const pk2_ascii_key = "169841";
+const uint8_t pk2_base_key[10] = { 0x03, 0xF8, 0xE4, 0x44, 0x88, 0x99, 0x3F, 0x64, 0xFE, 0x35 };
+
+// Blowfish("Joymax Pak File") under the default key. PK2 headers keep the first 3 bytes.
+const uint8_t pk2_verify[16] = { 0xD8, 0xDA, 0x30, 0xCF, 0x32, 0xE6, 0x71, 0xFC, 0xF8, 0x58, 0x15, 0x38, 0x9C, 0x47, 0x3A, 0xF7 };
+
+// SV.T stores the client version ("1234" here) encoded with "SILKROADVERSION", 8.
+const uint8_t svt_version[8] = { 0x13, 0x6E, 0x52, 0x03, 0x26, 0x9A, 0x11, 0x6D };
+
+//-----------------------------------------------------------------------------
+
+// Sets up a cipher during static initialization, like pk2mount's global
+// PK2Reader does. The schedule cache must already work before main runs.
+struct StaticInitCheck
+{
+	bool passed;
+
+	StaticInitCheck()
+	{
+		uint8_t key[6];
+		for(int x = 0; x < 6; ++x)
+		{
+			key[x] = (uint8_t)pk2_ascii_key[x] ^ pk2_base_key[x];
+		}
+		Blowfish pk2;
+		uint8_t verify[16] = { 0 };
+		passed = pk2.Initialize(key, 6) && pk2.Encode("Joymax Pak File", 16, verify, 16) && memcmp(verify, pk2_verify, 16) == 0;
+	}
+};
+
+StaticInitCheck static_init_check;
+
+//-----------------------------------------------------------------------------
+
+// A multi block kernel: ECB over 'count' blocks from 'input' to 'output'.
+typedef void (*BlowfishKernel)(const BlowfishPIMPL & bf, const uint8_t * input, uint8_t * output, uint64_t count);
+
+void kernel_encode1(const BlowfishPIMPL & bf, const uint8_t * input, uint8_t * output, uint64_t count)
+{
+	uint32_t block[2];
+	for(uint64_t x = 0; x < count; ++x)
+	{
+		memcpy(block, input + x * 8, 8);
+		bf.Blowfish_encipher(&block[0], &block[1]);
+		memcpy(output + x * 8, block, 8);
+	}
+}
+
+void kernel_decode1(const BlowfishPIMPL & bf, const uint8_t * input, uint8_t * output, uint64_t count)
+{
+	uint32_t block[2];
+	for(uint64_t x = 0; x < count; ++x)
+	{
+		memcpy(block, input + x * 8, 8);
+		bf.Blowfish_decipher(&block[0], &block[1]);
+		memcpy(output + x * 8, block, 8);
+	}
+}
+
+// Four-way kernels; 'count' is a multiple of 4 wherever these are used.
+void kernel_encode4(const BlowfishPIMPL & bf, const uint8_t * input, uint8_t * output, uint64_t count)
+{
+	uint32_t blocks[8];
+	for(uint64_t x = 0; x < count; x += 4)
+	{
+		memcpy(blocks, input + x * 8, 32);
+		bf.Blowfish_encipher4(blocks);
+		memcpy(output + x * 8, blocks, 32);
+	}
+}
+
+void kernel_decode4(const BlowfishPIMPL & bf, const uint8_t * input, uint8_t * output, uint64_t count)
+{
+	uint32_t blocks[8];
+	for(uint64_t x = 0; x < count; x += 4)
+	{
+		memcpy(blocks, input + x * 8, 32);
+		bf.Blowfish_decipher4(blocks);
+		memcpy(output + x * 8, blocks, 32);
+	}
+}
+
+void kernel_encode_dispatch(const BlowfishPIMPL & bf, const uint8_t * input, uint8_t * output, uint64_t count)
+{
+	bf.EncodeBlocks(input, output, count);
+}
+
+void kernel_decode_dispatch(const BlowfishPIMPL & bf, const uint8_t * input, uint8_t * output, uint64_t count)
+{
+	bf.DecodeBlocks(input, output, count);
+}
+
+struct KernelInfo
+{
+	const char * name;
+	BlowfishKernel encode;
+	BlowfishKernel decode;
+	uint32_t width; // blocks per step; buffers must be a multiple of this
+	bool available;
+};
+
+//-----------------------------------------------------------------------------
+
+// Fills 'kernels' with every kernel this build and CPU can run.
+void GetKernels(std::vector<KernelInfo> & kernels)
+{
+	KernelInfo scalar1 = { "scalar x1", kernel_encode1, kernel_decode1, 1, true };
+	KernelInfo scalar4 = { "scalar x4", kernel_encode4, kernel_decode4, 4, true };
+	KernelInfo avx2 = { "avx2 x8", blowfish_avx2_encode, blowfish_avx2_decode, 8, blowfish_avx2_supported() };
+	KernelInfo dispatch = { "dispatch", kernel_encode_dispatch, kernel_decode_dispatch, 1, true };
+	kernels.push_back(scalar1);
+	kernels.push_back(scalar4);
+	kernels.push_back(avx2);
+	kernels.push_back(dispatch);
+}
+
+//-----------------------------------------------------------------------------
+
+int kat_failures = 0;
+
+void Report(const char * name, bool passed)
+{
+	printf("  %-48s %s\n", name, passed ? "ok" : "FAILED");
+	if(!passed)
+	{
+		++kat_failures;
+	}
+}
+
+//-----------------------------------------------------------------------------
+
+void RunKnownAnswerTests(const std::vector<KernelInfo> & kernels)
+{
+	printf("Known-answer tests\n");
+
+	// Blowfish::Encode/Decode, one block per vector
+	bool passed = true;
+	for(size_t x = 0; x < bf_vector_count; ++x)
+	{
+		const BlowfishVector & v = bf_vectors[x];
+		Blowfish bf;
+		uint32_t cipher[2] = { 0 };
+		uint32_t plain[2] = { 0 };
+		if(!bf.Initialize(v.key, 8) || !bf.Encode(v.plain, 8, cipher, 8) || !bf.Decode(cipher, 8, plain, 8))
+		{
+			passed = false;
+			continue;
+		}
+		if(memcmp(cipher, v.cipher, 8) != 0 || memcmp(plain, v.plain, 8) != 0)
+		{
+			passed = false;
+		}
+	}
+	Report("vectors: Blowfish::Encode/Decode", passed);
+
+	// Every kernel, with each vector repeated over 16 blocks so the wide paths are used
+	for(size_t k = 0; k < kernels.size(); ++k)
+	{
+		const KernelInfo & kernel = kernels[k];
+		if(!kernel.available)
+		{
+			printf("  vectors: %-39s skipped (not supported)\n", kernel.name);
+			continue;
+		}
+
+		passed = true;
+		for(size_t x = 0; x < bf_vector_count; ++x)
+		{
+			const BlowfishVector & v = bf_vectors[x];
+			BlowfishPIMPL bf;
+			bf.Initialize(const_cast<uint8_t *>(v.key), 8);
+
+			uint8_t plain[128], expected[128], output[128];
+			for(int b = 0; b < 16; ++b)
+			{
+				memcpy(plain + b * 8, v.plain, 8);
+				memcpy(expected + b * 8, v.cipher, 8);
+			}
+
+			kernel.encode(bf, plain, output, 16);
+			if(memcmp(output, expected, sizeof(output)) != 0)
+			{
+				passed = false;
+			}
+			kernel.decode(bf, expected, output, 16);
+			if(memcmp(output, plain, sizeof(output)) != 0)
+			{
+				passed = false;
+			}
+		}
+
+		std::string name = std::string("vectors: ") + kernel.name;
+		Report(name.c_str(), passed);
+	}
+
+	// PK2 header verify, the check every archive open depends on
+	uint8_t key[6];
+	for(int x = 0; x < 6; ++x)
+	{
+		key[x] = (uint8_t)pk2_ascii_key[x] ^ pk2_base_key[x];
+	}
+	Blowfish pk2;
+	uint8_t verify[16] = { 0 };
+	passed = pk2.Initialize(key, 6) && pk2.Encode("Joymax Pak File", 16, verify, 16) && memcmp(verify, pk2_verify, 16) == 0;
+	Report("pk2: \"Joymax Pak File\" verify (169841)", passed);
+	Report("pk2: verify from a global object before main", static_init_check.passed);
+
+	// SV.T: the precomputed schedule must equal a computed one, and encode the same
+	BlowfishPIMPL computed;
+	computed.Initialize(const_cast<char *>("SILKROADVERSION"), 8);
+	BlowfishSchedule table = Blowfish::GetSchedule("SILKROADVERSION", 8);
+	passed = table && memcmp(table.get(), &computed, sizeof(BlowfishPIMPL)) == 0;
+	Report("svt: precomputed schedule matches", passed);
+
+	Blowfish svt;
+	uint8_t version[8] = { 0 };
+	passed = svt.Initialize(table) && svt.Encode("1234", 4, version, 8) && memcmp(version, svt_version, 8) == 0;
+	Report("svt: version encode", passed);
+
+	// Kernels against each other on a buffer with a partial tail for the wide paths
+	BlowfishPIMPL bf;
+	bf.Initialize(key, 6);
+	std::vector<uint8_t> input(8 * 1027), reference(input.size()), output(input.size());
+	uint32_t seed = 0x12345678;
+	for(size_t x = 0; x < input.size(); ++x)
+	{
+		seed = seed * 1103515245 + 12345;
+		input[x] = (uint8_t)(seed >> 16);
+	}
+	kernel_encode1(bf, &input[0], &reference[0], 1027);
+	for(size_t k = 0; k < kernels.size(); ++k)
+	{
+		const KernelInfo & kernel = kernels[k];
+		if(!kernel.available)
+		{
+			continue;
+		}
+
+		uint64_t count = 1027 - 1027 % kernel.width;
+		std::fill(output.begin(), output.end(), 0);
+		kernel.encode(bf, &input[0], &output[0], count);
+		passed = memcmp(&output[0], &reference[0], (size_t)count * 8) == 0;
+		kernel.decode(bf, &reference[0], &output[0], count);
+		passed = passed && memcmp(&output[0], &input[0], (size_t)count * 8) == 0;
+
+		std::string name = std::string("random buffer: ") + kernel.name;
+		Report(name.c_str(), passed);
+	}
+
+	printf("\n");
+}
+
+//-----------------------------------------------------------------------------
+
+uint64_t ReadCycles()
+{
+#ifdef BFBENCH_RDTSC
+	return __rdtsc();
+#else
+	return 0;
+#endif
+}
+
+// Result of one timed loop.
+struct Measurement
+{
+	uint64_t iterations;
+	double seconds;
+	uint64_t cycles;
+};
+
+// Calls 'op' in growing batches until at least 'min_ms' has passed.
+template <typename Operation>
+Measurement Measure(Operation & op, uint32_t min_ms)
+{
+	Measurement m = { 0, 0, 0 };
+	uint64_t batch = 1;
+
+	op(); // warm up tables and caches
+
+	for(;;)
+	{
+		boost::posix_time::ptime start = boost::posix_time::microsec_clock::universal_time();
+		uint64_t cycles = ReadCycles();
+		for(uint64_t x = 0; x < batch; ++x)
+		{
+			op();
+		}
+		m.cycles += ReadCycles() - cycles;
+		m.seconds += (boost::posix_time::microsec_clock::universal_time() - start).total_microseconds() / 1000000.0;
+		m.iterations += batch;
+
+		if(m.seconds * 1000.0 >= min_ms)
+		{
+			break;
+		}
+		if(m.seconds < 0.01)
+		{
+			batch *= 2;
+		}
+	}
+	return m;
+}
+
+//-----------------------------------------------------------------------------
+
+struct EncodeOp
+{
+	const Blowfish & bf;
+	const uint8_t * input;
+	uint8_t * output;
+	uint64_t size;
+
+	EncodeOp(const Blowfish & bf_, const uint8_t * input_, uint8_t * output_, uint64_t size_) : bf(bf_), input(input_), output(output_), size(size_)
+	{
+	}
+
+	void operator()()
+	{
+		bf.Encode(input, size, output, size);
+	}
+
+private:
+	EncodeOp & operator = (const EncodeOp & rhs);
+};
+
+struct DecodeOp
+{
+	const Blowfish & bf;
+	const uint8_t * input;
+	uint8_t * output;
+	uint64_t size;
+
+	DecodeOp(const Blowfish & bf_, const uint8_t * input_, uint8_t * output_, uint64_t size_) : bf(bf_), input(input_), output(output_), size(size_)
+	{
+	}
+
+	void operator()()
+	{
+		bf.Decode(input, size, output, size);
+	}
+
+private:
+	DecodeOp & operator = (const DecodeOp & rhs);
+};
+
+struct KernelOp
+{
+	BlowfishKernel kernel;
+	const BlowfishPIMPL & bf;
+	const uint8_t * input;
+	uint8_t * output;
+	uint64_t count;
+
+	KernelOp(BlowfishKernel kernel_, const BlowfishPIMPL & bf_, const uint8_t * input_, uint8_t * output_, uint64_t count_) : kernel(kernel_), bf(bf_), input(input_), output(output_), count(count_)
+	{
+	}
+
+	void operator()()
+	{
+		kernel(bf, input, output, count);
+	}
+
+private:
+	KernelOp & operator = (const KernelOp & rhs);
+};
+
+// Full key schedule: 521 block encryptions over the P-array and S-boxes.
+struct ScheduleOp
+{
+	BlowfishPIMPL bf;
+	uint8_t key[6];
+
+	void operator()()
+	{
+		bf.Initialize(key, 6);
+	}
+};
+
+// What opening a reader or writer costs once the schedule is cached.
+struct CachedScheduleOp
+{
+	Blowfish bf;
+	uint8_t key[6];
+
+	void operator()()
+	{
+		bf.Initialize(key, 6);
+	}
+};
+
+//-----------------------------------------------------------------------------
+
+void PrintThroughput(const char * name, uint64_t size, const Measurement & m)
+{
+	double bytes = (double)size * m.iterations;
+	double blocks = bytes / 8.0;
+	printf("  %-20s %6u B  %9.1f MB/s", name, (uint32_t)size, bytes / m.seconds / (1024.0 * 1024.0));
+	if(m.cycles)
+	{
+		printf("  %8.1f cycles/block", m.cycles / blocks);
+	}
+	printf("\n");
+}
+
+void PrintSetup(const char * name, const Measurement & m)
+{
+	printf("  %-30s %10.2f us/key", name, m.seconds * 1000000.0 / m.iterations);
+	if(m.cycles)
+	{
+		printf("  %12.0f cycles/key", (double)m.cycles / m.iterations);
+	}
+	printf("\n");
+}
+
+//-----------------------------------------------------------------------------
+
+void RunBenchmarks(const std::vector<KernelInfo> & kernels, uint32_t min_ms)
+{
+	// 8 bytes, one PK2Entry and one PK2EntryBlock
+	const uint64_t sizes[] = { 8, 128, 2560 };
+	const size_t size_count = sizeof(sizes) / sizeof(sizes[0]);
+
+	uint8_t key[6];
+	for(int x = 0; x < 6; ++x)
+	{
+		key[x] = (uint8_t)pk2_ascii_key[x] ^ pk2_base_key[x];
+	}
+
+	Blowfish blowfish;
+	blowfish.Initialize(key, 6);
+	BlowfishSchedule schedule = blowfish.GetSchedule();
+
+	std::vector<uint8_t> input(2560), output(2560);
+	for(size_t x = 0; x < input.size(); ++x)
+	{
+		input[x] = (uint8_t)(x * 7 + 1);
+	}
+
+	printf("Blowfish::Encode / Decode%s\n", ReadCycles() ? "" : " (no cycle counter on this platform)");
+	for(size_t s = 0; s < size_count; ++s)
+	{
+		EncodeOp encode(blowfish, &input[0], &output[0], sizes[s]);
+		PrintThroughput("Encode", sizes[s], Measure(encode, min_ms));
+	}
+	for(size_t s = 0; s < size_count; ++s)
+	{
+		DecodeOp decode(blowfish, &input[0], &output[0], sizes[s]);
+		PrintThroughput("Decode", sizes[s], Measure(decode, min_ms));
+	}
+	printf("\n");
+
+	printf("Decode kernels (dispatch uses %s)\n", (blowfish_avx2_supported() && blowfish_avx2_faster(*schedule)) ? "avx2 x8" : "scalar x4");
+	for(size_t k = 0; k < kernels.size(); ++k)
+	{
+		const KernelInfo & kernel = kernels[k];
+		if(!kernel.available)
+		{
+			printf("  %-20s skipped (not supported)\n", kernel.name);
+			continue;
+		}
+		for(size_t s = 0; s < size_count; ++s)
+		{
+			uint64_t count = sizes[s] / 8;
+			if(count % kernel.width)
+			{
+				continue;
+			}
+			KernelOp op(kernel.decode, *schedule, &input[0], &output[0], count);
+			PrintThroughput(kernel.name, sizes[s], Measure(op, min_ms));
+		}
+	}
+	printf("\n");
+
+	printf("Key setup\n");
+	ScheduleOp full;
+	memcpy(full.key, key, 6);
+	PrintSetup("BlowfishPIMPL::Initialize", Measure(full, min_ms));
+
+	CachedScheduleOp cached;
+	memcpy(cached.key, key, 6);
+	PrintSetup("Blowfish::Initialize (cached)", Measure(cached, min_ms));
+}
+
+//-----------------------------------------------------------------------------
+
+int main(int argc, char * argv[])
+{
+	bool kat_only = false;
+	uint32_t min_ms = 250;
+
+	for(int x = 1; x < argc; ++x)
+	{
+		if(strcmp(argv[x], "--kat") == 0)
+		{
+			kat_only = true;
+		}
+		else if(strncmp(argv[x], "--ms=", 5) == 0)
+		{
+			min_ms = (uint32_t)atoi(argv[x] + 5);
+		}
+		else
+		{
+			printf("Usage: %s [--kat] [--ms=250]\n", argv[0]);
+			return 2;
+		}
+	}
+
+	std::vector<KernelInfo> kernels;
+	GetKernels(kernels);
+
+	RunKnownAnswerTests(kernels);
+	if(kat_failures)
+	{
+		printf("%d known-answer test(s) failed\n", kat_failures);
+		return 1;
+	}
+
+	if(!kat_only)
+	{
+		RunBenchmarks(kernels, min_ms);
+	}
+
+	return 0;
+}
+
+//-----------------------------------------------------------------------------
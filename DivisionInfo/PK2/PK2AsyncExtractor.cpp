@@ -0,0 +1,707 @@
+#include "PK2AsyncExtractor.h"
+#include "PK2Reader.h"
+#include <string.h>
+#include <algorithm>
+#include <deque>
+#include <vector>
+#include <sstream>
+
+#include <boost/bind.hpp>
+#include <boost/thread/thread.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/condition_variable.hpp>
+
+#if defined(__linux__) && !defined(PK2_NO_IO_URING)
+	#define PK2_IO_URING 1
+	#include <linux/io_uring.h>
+	#include <sys/syscall.h>
+	#include <sys/mman.h>
+	#include <sys/uio.h>
+	#include <fcntl.h>
+	#include <unistd.h>
+	#include <errno.h>
+#endif
+
+//-----------------------------------------------------------------------------
+
+#if PK2_IO_URING
+
+// Minimal io_uring wrapper built directly on the system calls so there is no
+// dependency on liburing.
+struct IoUring
+{
+	int ring_fd;
+	uint32_t entries;
+
+	void * sq_ptr;
+	size_t sq_size;
+	void * cq_ptr;
+	size_t cq_size;
+	io_uring_sqe * sqes;
+	size_t sqes_size;
+
+	unsigned * sq_head;
+	unsigned * sq_tail;
+	unsigned * sq_mask;
+	unsigned * sq_array;
+	unsigned * cq_head;
+	unsigned * cq_tail;
+	unsigned * cq_mask;
+	io_uring_cqe * cqes;
+
+	IoUring()
+	{
+		ring_fd = -1;
+		entries = 0;
+		sq_ptr = MAP_FAILED;
+		cq_ptr = MAP_FAILED;
+		sqes = (io_uring_sqe *)MAP_FAILED;
+		sq_size = cq_size = sqes_size = 0;
+	}
+
+	~IoUring()
+	{
+		Destroy();
+	}
+
+	bool Setup(uint32_t depth)
+	{
+		io_uring_params p;
+		memset(&p, 0, sizeof(p));
+
+		ring_fd = (int)syscall(__NR_io_uring_setup, depth, &p);
+		if(ring_fd < 0)
+		{
+			return false;
+		}
+
+		entries = p.sq_entries;
+		sq_size = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+		cq_size = p.cq_off.cqes + p.cq_entries * sizeof(io_uring_cqe);
+
+		bool single_mmap = (p.features & IORING_FEAT_SINGLE_MMAP) != 0;
+		if(single_mmap)
+		{
+			sq_size = cq_size = (sq_size > cq_size ? sq_size : cq_size);
+		}
+
+		sq_ptr = mmap(0, sq_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring_fd, IORING_OFF_SQ_RING);
+		if(sq_ptr == MAP_FAILED)
+		{
+			Destroy();
+			return false;
+		}
+
+		if(single_mmap)
+		{
+			cq_ptr = sq_ptr;
+		}
+		else
+		{
+			cq_ptr = mmap(0, cq_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring_fd, IORING_OFF_CQ_RING);
+			if(cq_ptr == MAP_FAILED)
+			{
+				Destroy();
+				return false;
+			}
+		}
+
+		sqes_size = p.sq_entries * sizeof(io_uring_sqe);
+		sqes = (io_uring_sqe *)mmap(0, sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring_fd, IORING_OFF_SQES);
+		if(sqes == MAP_FAILED)
+		{
+			Destroy();
+			return false;
+		}
+
+		char * sq = (char *)sq_ptr;
+		sq_head = (unsigned *)(sq + p.sq_off.head);
+		sq_tail = (unsigned *)(sq + p.sq_off.tail);
+		sq_mask = (unsigned *)(sq + p.sq_off.ring_mask);
+		sq_array = (unsigned *)(sq + p.sq_off.array);
+
+		char * cq = (char *)cq_ptr;
+		cq_head = (unsigned *)(cq + p.cq_off.head);
+		cq_tail = (unsigned *)(cq + p.cq_off.tail);
+		cq_mask = (unsigned *)(cq + p.cq_off.ring_mask);
+		cqes = (io_uring_cqe *)(cq + p.cq_off.cqes);
+
+		return true;
+	}
+
+	void Destroy()
+	{
+		if(sqes != MAP_FAILED)
+		{
+			munmap(sqes, sqes_size);
+			sqes = (io_uring_sqe *)MAP_FAILED;
+		}
+		if(cq_ptr != MAP_FAILED && cq_ptr != sq_ptr)
+		{
+			munmap(cq_ptr, cq_size);
+		}
+		cq_ptr = MAP_FAILED;
+		if(sq_ptr != MAP_FAILED)
+		{
+			munmap(sq_ptr, sq_size);
+			sq_ptr = MAP_FAILED;
+		}
+		if(ring_fd >= 0)
+		{
+			close(ring_fd);
+			ring_fd = -1;
+		}
+	}
+
+	// Queues a vectored read. The caller guarantees there is room in the ring.
+	void QueueRead(int fd, iovec * iov, uint64_t offset, uint64_t user_data)
+	{
+		unsigned tail = *sq_tail;
+		unsigned index = tail & *sq_mask;
+
+		io_uring_sqe * sqe = &sqes[index];
+		memset(sqe, 0, sizeof(io_uring_sqe));
+		sqe->opcode = IORING_OP_READV;
+		sqe->fd = fd;
+		sqe->off = offset;
+		sqe->addr = (uint64_t)(uintptr_t)iov;
+		sqe->len = 1;
+		sqe->user_data = user_data;
+
+		sq_array[index] = index;
+		__atomic_store_n(sq_tail, tail + 1, __ATOMIC_RELEASE);
+	}
+
+	// Returns how many entries were submitted or -errno. EINTR is retried here;
+	// EAGAIN and EBUSY mean the kernel is short on resources or completions have
+	// to be reaped first, so the caller should try again later.
+	int Enter(unsigned to_submit, unsigned min_complete)
+	{
+		int result = 0;
+		do
+		{
+			result = (int)syscall(__NR_io_uring_enter, ring_fd, to_submit, min_complete, IORING_ENTER_GETEVENTS, 0, 0);
+		} while(result < 0 && errno == EINTR);
+		return result < 0 ? -errno : result;
+	}
+
+	bool PeekCompletion(uint64_t & user_data, int32_t & res)
+	{
+		unsigned head = *cq_head;
+		if(head == __atomic_load_n(cq_tail, __ATOMIC_ACQUIRE))
+		{
+			return false;
+		}
+
+		io_uring_cqe * cqe = &cqes[head & *cq_mask];
+		user_data = cqe->user_data;
+		res = cqe->res;
+
+		__atomic_store_n(cq_head, head + 1, __ATOMIC_RELEASE);
+		return true;
+	}
+};
+
+#endif
+
+//-----------------------------------------------------------------------------
+
+struct PK2AsyncExtractorPIMPL
+{
+	PK2Reader * reader;
+	bool bRunning;
+	bool bUring;
+
+	std::deque<PK2AsyncRequest> pending;
+	size_t outstanding;
+
+	boost::mutex m;
+	boost::condition_variable work_cond;
+	boost::condition_variable done_cond;
+	boost::thread_group workers;
+
+	uint32_t queue_depth;
+
+#if PK2_IO_URING
+	struct Slot
+	{
+		PK2AsyncRequest request;
+		iovec iov;
+		uint32_t done;
+	};
+
+	IoUring ring;
+	int fd;
+#endif
+
+	std::stringstream err;
+	std::string error;
+
+	PK2AsyncExtractorPIMPL()
+	{
+		reader = 0;
+		bRunning = false;
+		bUring = false;
+		outstanding = 0;
+		queue_depth = 0;
+#if PK2_IO_URING
+		fd = -1;
+#endif
+	}
+
+	// Reports a finished request and wakes up anyone in Wait
+	void Complete(PK2AsyncRequest & request, bool success)
+	{
+		if(request.callback)
+		{
+			(*request.callback)(&request, success, request.userdata);
+		}
+
+		boost::mutex::scoped_lock lock(m);
+		if(--outstanding == 0)
+		{
+			done_cond.notify_all();
+		}
+	}
+
+	// Copies one request out of the reader's mapping and completes it
+	void CopyFromMapping(PK2AsyncRequest & request)
+	{
+		const char * data = reader->Extract(request.entry);
+		if(data && request.entry.size)
+		{
+			memcpy(request.buffer, data, request.entry.size);
+		}
+		Complete(request, data != 0);
+	}
+
+	// Thread pool fallback. Each worker copies entries straight out of the
+	// reader's mapping, so page faults for different entries overlap.
+	void PoolWorker()
+	{
+		while(true)
+		{
+			PK2AsyncRequest request;
+
+			{
+				boost::mutex::scoped_lock lock(m);
+				while(pending.empty() && bRunning)
+				{
+					work_cond.wait(lock);
+				}
+				if(pending.empty())
+				{
+					return;
+				}
+				request = pending.front();
+				pending.pop_front();
+			}
+
+			CopyFromMapping(request);
+		}
+	}
+
+#if PK2_IO_URING
+	// Keeps up to queue_depth reads in flight against the archive file
+	void RingWorker()
+	{
+		std::vector<Slot> slots(ring.entries);
+		std::vector<uint32_t> free_slots;
+		for(uint32_t x = 0; x < ring.entries; ++x)
+		{
+			free_slots.push_back(ring.entries - x - 1);
+		}
+
+		uint32_t inflight = 0;
+		unsigned to_submit = 0;
+		std::vector<uint32_t> resubmit;
+
+		while(true)
+		{
+			// Partial reads continue where they left off
+			for(size_t x = 0; x < resubmit.size(); ++x)
+			{
+				Slot & slot = slots[resubmit[x]];
+				slot.iov.iov_base = (uint8_t *)slot.request.buffer + slot.done;
+				slot.iov.iov_len = slot.request.entry.size - slot.done;
+				ring.QueueRead(fd, &slot.iov, slot.request.entry.position + slot.done, resubmit[x]);
+				++to_submit;
+			}
+			resubmit.clear();
+
+			{
+				boost::mutex::scoped_lock lock(m);
+				while(pending.empty() && inflight == 0 && to_submit == 0 && bRunning)
+				{
+					work_cond.wait(lock);
+				}
+				if(pending.empty() && inflight == 0 && to_submit == 0)
+				{
+					return;
+				}
+
+				while(!pending.empty() && !free_slots.empty())
+				{
+					uint32_t index = free_slots.back();
+					free_slots.pop_back();
+
+					Slot & slot = slots[index];
+					slot.request = pending.front();
+					slot.done = 0;
+					slot.iov.iov_base = slot.request.buffer;
+					slot.iov.iov_len = slot.request.entry.size;
+					pending.pop_front();
+
+					ring.QueueRead(fd, &slot.iov, slot.request.entry.position, index);
+					++inflight;
+					++to_submit;
+				}
+			}
+
+			int submitted = ring.Enter(to_submit, inflight ? 1 : 0);
+			if(submitted == -EAGAIN || submitted == -EBUSY)
+			{
+				// Reap what has completed and try again
+				boost::this_thread::yield();
+				submitted = 0;
+			}
+			else if(submitted < 0)
+			{
+				AbandonRing(slots, free_slots, inflight, to_submit);
+				return;
+			}
+
+			// Anything the kernel did not consume yet stays in the ring for next time
+			to_submit -= submitted;
+
+			uint64_t user_data = 0;
+			int32_t res = 0;
+			while(ring.PeekCompletion(user_data, res))
+			{
+				uint32_t index = (uint32_t)user_data;
+				Slot & slot = slots[index];
+
+				if(res > 0 && slot.done + res < slot.request.entry.size)
+				{
+					slot.done += res;
+					resubmit.push_back(index);
+					continue;
+				}
+
+				--inflight;
+				free_slots.push_back(index);
+				Complete(slot.request, res > 0 && slot.done + res == slot.request.entry.size);
+			}
+		}
+	}
+
+	// Called when io_uring_enter fails for good. Entries the kernel already
+	// consumed may still write into their slot buffers, so every one of them is
+	// waited for before the ring is torn down; entries still queued are never
+	// submitted. Whatever did not finish, and everything submitted later, is
+	// then copied out of the reader's mapping.
+	void AbandonRing(std::vector<Slot> & slots, std::vector<uint32_t> & free_slots, uint32_t inflight, unsigned to_submit)
+	{
+		std::vector<bool> busy(slots.size(), true);
+		for(size_t x = 0; x < free_slots.size(); ++x)
+		{
+			busy[free_slots[x]] = false;
+		}
+
+		uint32_t in_kernel = inflight - to_submit;
+		while(in_kernel)
+		{
+			// Reads are completed by the kernel whether or not anyone waits for
+			// them, so keep polling even if entering the ring fails too
+			if(ring.Enter(0, 1) < 0)
+			{
+				boost::this_thread::sleep(boost::posix_time::milliseconds(1));
+			}
+
+			uint64_t user_data = 0;
+			int32_t res = 0;
+			while(ring.PeekCompletion(user_data, res))
+			{
+				uint32_t index = (uint32_t)user_data;
+				Slot & slot = slots[index];
+				--in_kernel;
+
+				if(res > 0 && slot.done + res == slot.request.entry.size)
+				{
+					busy[index] = false;
+					Complete(slot.request, true);
+				}
+			}
+		}
+
+		ring.Destroy();
+		close(fd);
+		fd = -1;
+
+		{
+			boost::mutex::scoped_lock lock(m);
+			bUring = false;
+		}
+
+		for(uint32_t x = 0; x < slots.size(); ++x)
+		{
+			if(busy[x])
+			{
+				CopyFromMapping(slots[x].request);
+			}
+		}
+
+		PoolWorker();
+	}
+#endif
+
+	bool Open(PK2Reader & reader_, uint32_t queue_depth_, uint32_t threads)
+	{
+		if(bRunning)
+		{
+			err.str(""); err << "The extractor is already open.";
+			return false;
+		}
+
+		if(queue_depth_ == 0)
+		{
+			err.str(""); err << "The queue depth must be at least 1.";
+			return false;
+		}
+
+		std::string filename = reader_.GetFilename();
+		if(filename.empty())
+		{
+			err.str(""); err << "There is no PK2 loaded yet.";
+			return false;
+		}
+
+		reader = &reader_;
+		queue_depth = queue_depth_;
+		outstanding = 0;
+		bRunning = true;
+		bUring = false;
+
+#if PK2_IO_URING
+		fd = open(filename.c_str(), O_RDONLY | O_CLOEXEC);
+		if(fd >= 0 && ring.Setup(queue_depth))
+		{
+			bUring = true;
+			workers.create_thread(boost::bind(&PK2AsyncExtractorPIMPL::RingWorker, this));
+			return true;
+		}
+
+		// io_uring is not available (old kernel, seccomp, ...)
+		ring.Destroy();
+		if(fd >= 0)
+		{
+			close(fd);
+			fd = -1;
+		}
+#endif
+
+		if(threads == 0)
+		{
+			threads = boost::thread::hardware_concurrency();
+			if(threads == 0)
+			{
+				threads = 1;
+			}
+		}
+
+		for(uint32_t x = 0; x < threads; ++x)
+		{
+			workers.create_thread(boost::bind(&PK2AsyncExtractorPIMPL::PoolWorker, this));
+		}
+
+		return true;
+	}
+
+	void Close()
+	{
+		{
+			boost::mutex::scoped_lock lock(m);
+			if(!bRunning)
+			{
+				return;
+			}
+			bRunning = false;
+			work_cond.notify_all();
+		}
+
+		// Workers drain the queue before exiting
+		workers.join_all();
+
+#if PK2_IO_URING
+		ring.Destroy();
+		if(fd >= 0)
+		{
+			close(fd);
+			fd = -1;
+		}
+#endif
+
+		reader = 0;
+		bUring = false;
+	}
+
+	bool Submit(PK2AsyncRequest * requests, size_t count)
+	{
+		if(!bRunning)
+		{
+			err.str(""); err << "Open has not yet been called.";
+			return false;
+		}
+
+		// Validate the whole batch first so nothing is queued on an error
+		for(size_t x = 0; x < count; ++x)
+		{
+			PK2AsyncRequest & request = requests[x];
+
+			if(request.entry.type != 2)
+			{
+				err.str(""); err << "The entry is not a file.";
+				return false;
+			}
+
+			if(request.buffer_size < request.entry.size || (request.entry.size && !request.buffer))
+			{
+				err.str(""); err << "The buffer is too small for entry \"" << request.entry.name << "\".";
+				return false;
+			}
+		}
+
+		std::vector<PK2AsyncRequest> empty;
+
+		{
+			boost::mutex::scoped_lock lock(m);
+			for(size_t x = 0; x < count; ++x)
+			{
+				++outstanding;
+				if(requests[x].entry.size == 0)
+				{
+					empty.push_back(requests[x]);
+				}
+				else
+				{
+					pending.push_back(requests[x]);
+				}
+			}
+			work_cond.notify_all();
+		}
+
+		// Nothing to read for empty files
+		for(size_t x = 0; x < empty.size(); ++x)
+		{
+			Complete(empty[x], true);
+		}
+
+		return true;
+	}
+
+	static void PromiseCallback(PK2AsyncRequest *, bool success, void * userdata)
+	{
+		boost::promise<bool> * promise = reinterpret_cast<boost::promise<bool> *>(userdata);
+		promise->set_value(success);
+		delete promise;
+	}
+
+	void Wait()
+	{
+		boost::mutex::scoped_lock lock(m);
+		while(outstanding)
+		{
+			done_cond.wait(lock);
+		}
+	}
+
+	std::string GetError()
+	{
+		error = err.str();
+		err.str("");
+		return error;
+	}
+};
+
+//-----------------------------------------------------------------------------
+
+PK2AsyncExtractor::PK2AsyncExtractor()
+{
+	m_PK2AsyncExtractorPIMPL = new PK2AsyncExtractorPIMPL;
+}
+
+//-----------------------------------------------------------------------------
+
+PK2AsyncExtractor::~PK2AsyncExtractor()
+{
+	m_PK2AsyncExtractorPIMPL->Close();
+	delete m_PK2AsyncExtractorPIMPL;
+}
+
+//-----------------------------------------------------------------------------
+
+bool PK2AsyncExtractor::Open(PK2Reader & reader, uint32_t queue_depth, uint32_t threads)
+{
+	return m_PK2AsyncExtractorPIMPL->Open(reader, queue_depth, threads);
+}
+
+//-----------------------------------------------------------------------------
+
+void PK2AsyncExtractor::Close()
+{
+	m_PK2AsyncExtractorPIMPL->Close();
+}
+
+//-----------------------------------------------------------------------------
+
+bool PK2AsyncExtractor::IsUsingIoUring()
+{
+	return m_PK2AsyncExtractorPIMPL->bUring;
+}
+
+//-----------------------------------------------------------------------------
+
+bool PK2AsyncExtractor::Submit(PK2AsyncRequest * requests, size_t count)
+{
+	return m_PK2AsyncExtractorPIMPL->Submit(requests, count);
+}
+
+//-----------------------------------------------------------------------------
+
+boost::shared_future<bool> PK2AsyncExtractor::Submit(const PK2Entry & entry, void * buffer, uint32_t buffer_size)
+{
+	boost::promise<bool> * promise = new boost::promise<bool>;
+	// A shared_future can be returned by copy, which VS2010 and C++03 need
+	boost::shared_future<bool> result(promise->get_future());
+
+	PK2AsyncRequest request;
+	request.entry = entry;
+	request.buffer = buffer;
+	request.buffer_size = buffer_size;
+	request.callback = &PK2AsyncExtractorPIMPL::PromiseCallback;
+	request.userdata = promise;
+
+	if(!m_PK2AsyncExtractorPIMPL->Submit(&request, 1))
+	{
+		promise->set_value(false);
+		delete promise;
+	}
+
+	return result;
+}
+
+//-----------------------------------------------------------------------------
+
+void PK2AsyncExtractor::Wait()
+{
+	m_PK2AsyncExtractorPIMPL->Wait();
+}
+
+//-----------------------------------------------------------------------------
+
+std::string PK2AsyncExtractor::GetError()
+{
+	return m_PK2AsyncExtractorPIMPL->GetError();
+}
+
+//-----------------------------------------------------------------------------
@@ -0,0 +1,79 @@
+#pragma once
+
+#ifndef PK2ASYNCEXTRACTOR_H_
+#define PK2ASYNCEXTRACTOR_H_
+
+//-----------------------------------------------------------------------------
+
+#include <stdint.h>
+#include <string>
+#include "PK2.h"
+
+#include <boost/thread/future.hpp>
+
+//-----------------------------------------------------------------------------
+
+class PK2Reader;
+struct PK2AsyncExtractorPIMPL;
+
+// A single read. The entry and buffer must remain valid until the completion
+// for this request has been reported.
+struct PK2AsyncRequest
+{
+	PK2Entry entry; // file entry to read
+	void * buffer; // caller provided output buffer
+	uint32_t buffer_size; // must be at least entry.size bytes
+
+	// Called from an extractor thread when the read finishes. 'success' is false
+	// if the entry could not be read. The request passed in is the extractor's
+	// copy of this structure. May be null.
+	void (* callback)(PK2AsyncRequest *, bool success, void * userdata);
+	void * userdata;
+};
+
+//-----------------------------------------------------------------------------
+
+class PK2AsyncExtractor
+{
+	friend struct PK2AsyncExtractorPIMPL;
+	PK2AsyncExtractorPIMPL * m_PK2AsyncExtractorPIMPL;
+
+private:
+	PK2AsyncExtractor & operator = (const PK2AsyncExtractor & rhs);
+	PK2AsyncExtractor(const PK2AsyncExtractor & rhs);
+
+public:
+	PK2AsyncExtractor();
+	~PK2AsyncExtractor();
+
+	// Attaches the extractor to an opened PK2Reader. On Linux the archive file is
+	// read through io_uring with up to 'queue_depth' reads in flight. Everywhere
+	// else (or if io_uring is unavailable) 'threads' workers copy entries out of
+	// the reader's mapping instead. Passing 0 threads uses one per core. The reader
+	// must stay open until Close is called.
+	bool Open(PK2Reader & reader, uint32_t queue_depth = 64, uint32_t threads = 0);
+
+	// Waits for all outstanding reads and releases the extractor's resources.
+	void Close();
+
+	// Returns true if reads are being serviced by io_uring.
+	bool IsUsingIoUring();
+
+	// Queues a batch of reads. The requests array itself may be reused as soon as
+	// this returns, but each buffer must stay valid until its callback runs.
+	bool Submit(PK2AsyncRequest * requests, size_t count);
+
+	// Queues a single read and returns a future that becomes ready with the result.
+	// The future is shared so it can be copied on compilers without move support.
+	boost::shared_future<bool> Submit(const PK2Entry & entry, void * buffer, uint32_t buffer_size);
+
+	// Blocks until every submitted read has completed.
+	void Wait();
+
+	// Returns the error if a function returns false.
+	std::string GetError();
+};
+
+//-----------------------------------------------------------------------------
+
+#endif
@@ -0,0 +1,829 @@
+#include "PK2Builder.h"
+#include "PK2Reader.h"
+#include "shared_io.h"
+#include "parallel_for.h"
+#include <string.h>
+#include <algorithm>
+#include <set>
+#include <map>
+
+#include <boost/date_time/posix_time/posix_time_types.hpp>
+
+//-----------------------------------------------------------------------------
+
+// File data is streamed through a buffer this large. It starts on a 4KB
+// boundary, so every write but the last is a whole number of pages.
+const size_t builder_buffer_size = 4 * 1024 * 1024;
+const int64_t builder_data_alignment = 4096;
+
+//-----------------------------------------------------------------------------
+
+static std::string LowerName(const std::string & name)
+{
+	std::string lower = name;
+	std::transform(lower.begin(), lower.end(), lower.begin(), tolower);
+	return lower;
+}
+
+static bool DirEntryNameLess(const dir_entry & a, const dir_entry & b)
+{
+	return LowerName(a.name) < LowerName(b.name);
+}
+
+//-----------------------------------------------------------------------------
+
+// Lists one level of folders in parallel. The results are merged afterwards on
+// the calling thread so the tree is built in a fixed order.
+struct PK2Builder::ScanFolder
+{
+	const std::vector<size_t> & level;
+	const std::vector<PK2Builder::Node> & nodes;
+	std::vector< std::vector<dir_entry> > & listings;
+	std::vector<uint8_t> & failed;
+
+	ScanFolder(const std::vector<size_t> & level_, const std::vector<PK2Builder::Node> & nodes_, std::vector< std::vector<dir_entry> > & listings_, std::vector<uint8_t> & failed_) : level(level_), nodes(nodes_), listings(listings_), failed(failed_)
+	{
+	}
+
+	void operator()(size_t x)
+	{
+		failed[x] = dir_list(nodes[level[x]].source.c_str(), listings[x]) ? 0 : 1;
+	}
+
+private:
+	ScanFolder & operator = (const ScanFolder & rhs);
+};
+
+//-----------------------------------------------------------------------------
+
+struct PK2Builder::EncodeBlocks
+{
+	const Blowfish & blowfish;
+	std::vector<PK2EntryBlock> & blocks;
+
+	EncodeBlocks(const Blowfish & blowfish_, std::vector<PK2EntryBlock> & blocks_) : blowfish(blowfish_), blocks(blocks_)
+	{
+	}
+
+	void operator()(size_t x)
+	{
+		blowfish.EncodeBlocks(&blocks[x], &blocks[x], sizeof(PK2EntryBlock) / 8);
+	}
+
+private:
+	EncodeBlocks & operator = (const EncodeBlocks & rhs);
+};
+
+//-----------------------------------------------------------------------------
+
+PK2Builder::PK2Builder()
+{
+	m_encrypt = false;
+	memset(&m_stats, 0, sizeof(PK2BuildStats));
+}
+
+//-----------------------------------------------------------------------------
+
+PK2Builder::~PK2Builder()
+{
+}
+
+//-----------------------------------------------------------------------------
+
+std::string PK2Builder::GetError()
+{
+	std::string e = m_error.str();
+	m_error.str("");
+	return e;
+}
+
+//-----------------------------------------------------------------------------
+
+void PK2Builder::SetEncryptionKey(char * ascii_key, uint8_t ascii_key_length, char * base_key, uint8_t base_key_length)
+{
+	uint8_t bf_key[56] = { 0x00 };
+	ascii_key_length = DeriveBlowfishKey(ascii_key, ascii_key_length, base_key, base_key_length, bf_key);
+
+	m_encrypt = m_blowfish.Initialize(bf_key, ascii_key_length);
+}
+
+//-----------------------------------------------------------------------------
+
+void PK2Builder::SetEncryption(const Blowfish & blowfish)
+{
+	m_blowfish = blowfish;
+	m_encrypt = true;
+}
+
+//-----------------------------------------------------------------------------
+
+void PK2Builder::Clear()
+{
+	m_nodes.clear();
+	memset(&m_stats, 0, sizeof(PK2BuildStats));
+}
+
+//-----------------------------------------------------------------------------
+
+PK2BuildStats PK2Builder::GetStats()
+{
+	return m_stats;
+}
+
+//-----------------------------------------------------------------------------
+
+void PK2Builder::AddRoot(uint64_t create_time, uint64_t modify_time, uint64_t access_time)
+{
+	if(!m_nodes.empty())
+	{
+		return;
+	}
+
+	Node node;
+	node.type = 1;
+	node.create_time = create_time;
+	node.modify_time = modify_time;
+	node.access_time = access_time;
+	node.size = 0;
+	node.reader = 0;
+	node.source_position = 0;
+	node.shared = false;
+	node.parent = 0;
+	node.position = 0;
+	node.blocks = 0;
+	m_nodes.push_back(node);
+}
+
+//-----------------------------------------------------------------------------
+
+void PK2Builder::Count()
+{
+	m_stats.folders = 0;
+	m_stats.files = 0;
+	m_stats.data_bytes = 0;
+	for(size_t x = 1; x < m_nodes.size(); ++x)
+	{
+		if(m_nodes[x].type == 1)
+		{
+			++m_stats.folders;
+		}
+		else
+		{
+			++m_stats.files;
+			m_stats.data_bytes += m_nodes[x].size;
+		}
+	}
+}
+
+//-----------------------------------------------------------------------------
+
+bool PK2Builder::AddChildren(size_t parent, const std::string & base, std::vector<dir_entry> & listing)
+{
+	std::sort(listing.begin(), listing.end(), DirEntryNameLess);
+
+	// Names are compared without case in a PK2, which a case sensitive file
+	// system does not guarantee
+	std::set<std::string> names;
+	for(size_t x = 0; x < m_nodes[parent].children.size(); ++x)
+	{
+		names.insert(LowerName(m_nodes[m_nodes[parent].children[x]].name));
+	}
+
+	for(size_t x = 0; x < listing.size(); ++x)
+	{
+		const dir_entry & item = listing[x];
+		std::string path = base + "/" + item.name;
+
+		if(item.name.size() >= sizeof(((PK2Entry *)0)->name))
+		{
+			m_error.str(""); m_error << "The name of \"" << path << "\" is too long for a PK2 entry.";
+			return false;
+		}
+		if(!item.folder && item.size > 0xFFFFFFFF)
+		{
+			m_error.str(""); m_error << "The file \"" << path << "\" is too large for a PK2 entry.";
+			return false;
+		}
+		if(!names.insert(LowerName(item.name)).second)
+		{
+			m_error.str(""); m_error << "\"" << path << "\" differs from another entry only in case.";
+			return false;
+		}
+
+		Node node;
+		node.name = item.name;
+		node.type = item.folder ? 1 : 2;
+		node.create_time = item.create_time;
+		node.modify_time = item.modify_time;
+		node.access_time = item.access_time;
+		node.size = (uint32_t)item.size;
+		node.source = path;
+		node.reader = 0;
+		node.source_position = 0;
+		node.shared = false;
+		node.parent = parent;
+		node.position = 0;
+		node.blocks = 0;
+
+		m_nodes[parent].children.push_back(m_nodes.size());
+		m_nodes.push_back(node);
+	}
+
+	return true;
+}
+
+//-----------------------------------------------------------------------------
+
+bool PK2Builder::AddDirectory(const std::string & input_dir, uint32_t threads)
+{
+	boost::posix_time::ptime start = boost::posix_time::microsec_clock::universal_time();
+
+	std::string base = input_dir;
+	while(base.size() > 1 && (base[base.size() - 1] == '/' || base[base.size() - 1] == '\\'))
+	{
+		base.erase(base.size() - 1);
+	}
+
+	dir_entry root;
+	if(!dir_stat(base.c_str(), root) || !root.folder)
+	{
+		m_error.str(""); m_error << "\"" << input_dir << "\" is not a folder.";
+		return false;
+	}
+
+	AddRoot(root.create_time, root.modify_time, root.access_time);
+
+	// The listing of 'input_dir' goes into the root; everything below is added
+	// one level at a time with each level listed in parallel
+	std::vector<dir_entry> listing;
+	if(!dir_list(base.c_str(), listing))
+	{
+		m_error.str(""); m_error << "Could not list \"" << base << "\".";
+		return false;
+	}
+
+	size_t first = m_nodes.size();
+	if(!AddChildren(0, base, listing))
+	{
+		return false;
+	}
+
+	std::vector<size_t> level;
+	for(size_t x = first; x < m_nodes.size(); ++x)
+	{
+		if(m_nodes[x].type == 1)
+		{
+			level.push_back(x);
+		}
+	}
+
+	while(!level.empty())
+	{
+		std::vector< std::vector<dir_entry> > listings(level.size());
+		std::vector<uint8_t> failed(level.size(), 0);
+
+		ScanFolder scan(level, m_nodes, listings, failed);
+		parallel_for(level.size(), scan, threads);
+
+		std::vector<size_t> next;
+		for(size_t x = 0; x < level.size(); ++x)
+		{
+			if(failed[x])
+			{
+				m_error.str(""); m_error << "Could not list \"" << m_nodes[level[x]].source << "\".";
+				return false;
+			}
+
+			// AddChildren grows m_nodes, so the path must not refer into it
+			std::string source = m_nodes[level[x]].source;
+			first = m_nodes.size();
+			if(!AddChildren(level[x], source, listings[x]))
+			{
+				return false;
+			}
+
+			for(size_t y = first; y < m_nodes.size(); ++y)
+			{
+				if(m_nodes[y].type == 1)
+				{
+					next.push_back(y);
+				}
+			}
+		}
+		level.swap(next);
+	}
+
+	Count();
+	m_stats.scan_ms = (boost::posix_time::microsec_clock::universal_time() - start).total_microseconds() / 1000.0;
+
+	return true;
+}
+
+//-----------------------------------------------------------------------------
+
+// State of AddArchive while PK2Reader::ForEachEntryDo walks the source. Blocks
+// come parent first, so every folder is known before its own blocks arrive.
+struct PK2Builder::ArchiveScan
+{
+	PK2Builder & builder;
+	uint64_t archive_size;
+	std::map<std::string, size_t> folders; // lower case path -> node
+	std::map<size_t, std::set<std::string> > names; // lower case names taken in a folder
+	bool root_times;
+	bool failed;
+
+	ArchiveScan(PK2Builder & builder_, uint64_t archive_size_) : builder(builder_), archive_size(archive_size_), root_times(false), failed(false)
+	{
+	}
+
+	std::set<std::string> & Names(size_t folder)
+	{
+		std::map<size_t, std::set<std::string> >::iterator itr = names.find(folder);
+		if(itr == names.end())
+		{
+			itr = names.insert(std::make_pair(folder, std::set<std::string>())).first;
+			const std::vector<size_t> & children = builder.m_nodes[folder].children;
+			for(size_t x = 0; x < children.size(); ++x)
+			{
+				itr->second.insert(LowerName(builder.m_nodes[children[x]].name));
+			}
+		}
+		return itr->second;
+	}
+
+	bool Add(PK2Reader * reader, const std::string & path, PK2EntryBlock & block)
+	{
+		++builder.m_stats.source_blocks;
+
+		std::string lower_path = LowerName(path);
+		std::map<std::string, size_t>::iterator folder = folders.find(lower_path);
+		if(folder == folders.end())
+		{
+			// A folder that was skipped because its name was taken
+			return true;
+		}
+		size_t parent = folder->second;
+
+		for(int x = 0; x < 20; ++x)
+		{
+			PK2Entry & e = block.entries[x];
+			if(e.type != 1 && e.type != 2)
+			{
+				continue;
+			}
+
+			std::string name(e.name, strnlen(e.name, sizeof(e.name)));
+			if(name == "." || name == "..")
+			{
+				if(parent == 0 && name == "." && root_times)
+				{
+					builder.m_nodes[0].create_time = e.createTime;
+					builder.m_nodes[0].modify_time = e.modifyTime;
+					builder.m_nodes[0].access_time = e.accessTime;
+					root_times = false;
+				}
+				continue;
+			}
+
+			std::string source = path.empty() ? name : path + "\\" + name;
+			if(name.empty() || !Names(parent).insert(LowerName(name)).second)
+			{
+				continue;
+			}
+
+			if(e.type == 2 && (e.position < 0 || (uint64_t)e.position + e.size > archive_size))
+			{
+				builder.m_error.str(""); builder.m_error << "The data of \"" << source << "\" is outside the archive.";
+				failed = true;
+				return false;
+			}
+
+			Node node;
+			node.name = name;
+			node.type = e.type;
+			node.create_time = e.createTime;
+			node.modify_time = e.modifyTime;
+			node.access_time = e.accessTime;
+			node.size = e.type == 2 ? e.size : 0;
+			node.source = source;
+			node.reader = e.type == 2 ? reader : 0;
+			node.source_position = e.type == 2 ? e.position : 0;
+			node.shared = false;
+			node.parent = parent;
+			node.position = 0;
+			node.blocks = 0;
+
+			if(e.type == 1)
+			{
+				folders[LowerName(source)] = builder.m_nodes.size();
+			}
+			builder.m_nodes[parent].children.push_back(builder.m_nodes.size());
+			builder.m_nodes.push_back(node);
+		}
+
+		return true;
+	}
+
+private:
+	ArchiveScan & operator = (const ArchiveScan & rhs);
+};
+
+bool PK2Builder::ArchiveScanFunc(PK2Reader * reader, const std::string & path, PK2EntryBlock & block, void * userdata)
+{
+	return ((ArchiveScan *)userdata)->Add(reader, path, block);
+}
+
+//-----------------------------------------------------------------------------
+
+bool PK2Builder::AddArchive(PK2Reader & reader)
+{
+	boost::posix_time::ptime start = boost::posix_time::microsec_clock::universal_time();
+
+	dir_entry archive;
+	if(reader.GetFilename().empty() || !dir_stat(reader.GetFilename().c_str(), archive))
+	{
+		m_error.str(""); m_error << "There is no PK2 loaded yet.";
+		return false;
+	}
+
+	ArchiveScan scan(*this, archive.size);
+	scan.root_times = m_nodes.empty();
+	AddRoot(0, 0, 0);
+	scan.folders[""] = 0;
+	m_stats.source_blocks = 0;
+
+	if(!reader.ForEachEntryDo(ArchiveScanFunc, &scan) || scan.failed)
+	{
+		if(!scan.failed)
+		{
+			m_error.str(""); m_error << reader.GetError();
+		}
+		return false;
+	}
+
+	Count();
+	m_stats.scan_ms = (boost::posix_time::microsec_clock::universal_time() - start).total_microseconds() / 1000.0;
+
+	return true;
+}
+
+//-----------------------------------------------------------------------------
+
+void PK2Builder::Plan(std::vector<size_t> & folders, int64_t & data_offset)
+{
+	// Folders in breadth first order, so the root comes first and each level's
+	// chains sit next to each other
+	folders.clear();
+	folders.push_back(0);
+	for(size_t x = 0; x < folders.size(); ++x)
+	{
+		const Node & folder = m_nodes[folders[x]];
+		for(size_t y = 0; y < folder.children.size(); ++y)
+		{
+			if(m_nodes[folder.children[y]].type == 1)
+			{
+				folders.push_back(folder.children[y]);
+			}
+		}
+	}
+
+	int64_t offset = sizeof(PK2Header);
+	for(size_t x = 0; x < folders.size(); ++x)
+	{
+		Node & folder = m_nodes[folders[x]];
+
+		// The root only has "." while every other folder has "." and ".."
+		size_t count = folder.children.size() + (folders[x] == 0 ? 1 : 2);
+		folder.blocks = (uint32_t)((count + 19) / 20);
+		folder.position = offset;
+		offset += (int64_t)folder.blocks * sizeof(PK2EntryBlock);
+	}
+
+	data_offset = (offset + builder_data_alignment - 1) / builder_data_alignment * builder_data_alignment;
+
+	// Files from an archive that pointed at the same data still do
+	typedef std::pair<PK2Reader *, std::pair<int64_t, uint32_t> > SourceRange;
+	std::map<SourceRange, int64_t> copied;
+
+	int64_t position = data_offset;
+	for(size_t x = 0; x < folders.size(); ++x)
+	{
+		const Node & folder = m_nodes[folders[x]];
+		for(size_t y = 0; y < folder.children.size(); ++y)
+		{
+			Node & child = m_nodes[folder.children[y]];
+			if(child.type != 2)
+			{
+				continue;
+			}
+
+			child.shared = false;
+			if(child.reader && child.size)
+			{
+				SourceRange range(child.reader, std::make_pair(child.source_position, child.size));
+				std::map<SourceRange, int64_t>::iterator itr = copied.find(range);
+				if(itr != copied.end())
+				{
+					child.position = itr->second;
+					child.shared = true;
+					continue;
+				}
+				copied[range] = position;
+			}
+
+			child.position = position;
+			position += child.size;
+		}
+	}
+
+	m_stats.data_bytes = position - data_offset;
+}
+
+//-----------------------------------------------------------------------------
+
+void PK2Builder::FillBlocks(const std::vector<size_t> & folders, std::vector<PK2EntryBlock> & blocks)
+{
+	size_t total = 0;
+	for(size_t x = 0; x < folders.size(); ++x)
+	{
+		total += m_nodes[folders[x]].blocks;
+	}
+
+	blocks.resize(total);
+	if(total)
+	{
+		memset(&blocks[0], 0, total * sizeof(PK2EntryBlock));
+	}
+
+	for(size_t x = 0; x < folders.size(); ++x)
+	{
+		const Node & folder = m_nodes[folders[x]];
+		size_t first = (size_t)((folder.position - (int64_t)sizeof(PK2Header)) / sizeof(PK2EntryBlock));
+
+		std::vector<PK2Entry> entries;
+		entries.reserve(folder.children.size() + 2);
+
+		PK2Entry e;
+		memset(&e, 0, sizeof(PK2Entry));
+		e.type = 1;
+		e.createTime = folder.create_time;
+		e.modifyTime = folder.modify_time;
+		e.accessTime = folder.access_time;
+
+		e.name[0] = '.';
+		e.position = folder.position;
+		entries.push_back(e);
+
+		if(folders[x] != 0)
+		{
+			e.name[1] = '.';
+			e.position = m_nodes[folder.parent].position;
+			entries.push_back(e);
+		}
+
+		for(size_t y = 0; y < folder.children.size(); ++y)
+		{
+			const Node & child = m_nodes[folder.children[y]];
+			memset(&e, 0, sizeof(PK2Entry));
+			e.type = child.type;
+			memcpy(e.name, child.name.c_str(), child.name.size());
+			e.createTime = child.create_time;
+			e.modifyTime = child.modify_time;
+			e.accessTime = child.access_time;
+			e.position = child.position;
+			e.size = child.type == 2 ? child.size : 0;
+			entries.push_back(e);
+		}
+
+		for(size_t y = 0; y < entries.size(); ++y)
+		{
+			blocks[first + y / 20].entries[y % 20] = entries[y];
+		}
+
+		// Link the chain
+		for(uint32_t y = 0; y + 1 < folder.blocks; ++y)
+		{
+			blocks[first + y].entries[19].nextChain = folder.position + (int64_t)(y + 1) * sizeof(PK2EntryBlock);
+		}
+	}
+}
+
+//-----------------------------------------------------------------------------
+
+bool PK2Builder::FlushBuffer(FILE * outfile, std::vector<uint8_t> & buffer, size_t & used, int64_t & written)
+{
+	if(used && fwrite(&buffer[0], 1, used, outfile) != used)
+	{
+		m_error.str(""); m_error << "Could not write " << used << " bytes of data at " << written << ".";
+		return false;
+	}
+	written += used;
+	used = 0;
+	return true;
+}
+
+//-----------------------------------------------------------------------------
+
+bool PK2Builder::CopyArchiveData(const Node & file, FILE * outfile, std::vector<uint8_t> & buffer, size_t & used, int64_t & written)
+{
+	PK2Entry entry;
+	memset(&entry, 0, sizeof(PK2Entry));
+	entry.type = 2;
+	entry.position = file.source_position;
+	entry.size = file.size;
+
+	const uint8_t * data = (const uint8_t *)file.reader->Extract(entry);
+	if(data == 0)
+	{
+		m_error.str(""); m_error << "The data of \"" << file.source << "\" is not inside its PK2.";
+		return false;
+	}
+
+	uint64_t left = file.size;
+	while(left)
+	{
+		size_t count = (size_t)std::min<uint64_t>(left, buffer.size() - used);
+		memcpy(&buffer[used], data, count);
+		data += count;
+		used += count;
+		left -= count;
+
+		if(used == buffer.size() && !FlushBuffer(outfile, buffer, used, written))
+		{
+			return false;
+		}
+	}
+
+	// Each range is read once, so keep the source from crowding out the cache
+	if(file.size)
+	{
+		file.reader->Release(entry);
+	}
+
+	return true;
+}
+
+//-----------------------------------------------------------------------------
+
+bool PK2Builder::WriteFileData(FILE * outfile, const std::vector<size_t> & folders, int64_t data_offset)
+{
+	std::vector<uint8_t> buffer(builder_buffer_size);
+	size_t used = 0;
+	int64_t written = data_offset;
+
+	for(size_t x = 0; x < folders.size(); ++x)
+	{
+		const Node & folder = m_nodes[folders[x]];
+		for(size_t y = 0; y < folder.children.size(); ++y)
+		{
+			const Node & file = m_nodes[folder.children[y]];
+			if(file.type != 2 || file.shared)
+			{
+				continue;
+			}
+
+			if(file.reader)
+			{
+				if(!CopyArchiveData(file, outfile, buffer, used, written))
+				{
+					return false;
+				}
+				continue;
+			}
+
+			FILE * infile = file_open(file.source.c_str(), "rb");
+			if(infile == 0)
+			{
+				m_error.str(""); m_error << "Could not open the input file: \"" << file.source << "\".";
+				return false;
+			}
+
+			uint64_t left = file.size;
+			while(left)
+			{
+				size_t count = (size_t)std::min<uint64_t>(left, buffer.size() - used);
+				if(fread(&buffer[used], 1, count, infile) != count)
+				{
+					fclose(infile);
+					m_error.str(""); m_error << "The input file \"" << file.source << "\" changed size while the PK2 was built.";
+					return false;
+				}
+				used += count;
+				left -= count;
+
+				if(used == buffer.size() && !FlushBuffer(outfile, buffer, used, written))
+				{
+					fclose(infile);
+					return false;
+				}
+			}
+
+			// Anything past the size seen by the scan would be silently dropped
+			bool grew = fgetc(infile) != EOF;
+			fclose(infile);
+			if(grew)
+			{
+				m_error.str(""); m_error << "The input file \"" << file.source << "\" changed size while the PK2 was built.";
+				return false;
+			}
+		}
+	}
+
+	return FlushBuffer(outfile, buffer, used, written);
+}
+
+//-----------------------------------------------------------------------------
+
+bool PK2Builder::Write(const std::string & output_file, uint32_t threads)
+{
+	boost::posix_time::ptime start = boost::posix_time::microsec_clock::universal_time();
+
+	if(m_nodes.empty())
+	{
+		m_error.str(""); m_error << "Nothing has been added to the PK2.";
+		return false;
+	}
+
+	std::vector<size_t> folders;
+	int64_t data_offset = 0;
+	Plan(folders, data_offset);
+
+	std::vector<PK2EntryBlock> blocks;
+	FillBlocks(folders, blocks);
+
+	PK2Header header;
+	memset(&header, 0, sizeof(PK2Header));
+	memcpy(header.name, "JoyMax File Manager!\n", 21);
+	header.version = 0x01000002;
+
+	if(m_encrypt)
+	{
+		header.encryption = 1;
+
+		uint8_t verify[16] = {0};
+		m_blowfish.Encode("Joymax Pak File", 16, verify, 16);
+		memcpy(header.verify, verify, 3); // PK2s only store 1st 3 bytes
+
+		EncodeBlocks encode(m_blowfish, blocks);
+		parallel_for(blocks.size(), encode, threads, 16);
+	}
+
+	std::string filename = output_file;
+#if _WIN32
+	while(filename.find("/") != std::string::npos)
+		filename.replace(filename.find("/"), 1, "\\");
+#endif
+
+	// The archive only replaces 'output_file' once it is complete, so a failed
+	// Write never destroys an existing file, not even a source being read from
+	std::string temp_filename = filename + ".tmp";
+	FILE * outfile = file_open(temp_filename.c_str(), "wb");
+	if(outfile == 0)
+	{
+		m_error.str(""); m_error << "Could not create the file \"" << temp_filename << "\".";
+		return false;
+	}
+
+	int64_t directory_end = sizeof(PK2Header) + (int64_t)blocks.size() * sizeof(PK2EntryBlock);
+	std::vector<uint8_t> padding((size_t)(data_offset - directory_end), 0);
+
+	bool written = fwrite(&header, 1, sizeof(PK2Header), outfile) == sizeof(PK2Header);
+	written = written && fwrite(&blocks[0], sizeof(PK2EntryBlock), blocks.size(), outfile) == blocks.size();
+	written = written && (padding.empty() || fwrite(&padding[0], 1, padding.size(), outfile) == padding.size());
+	if(!written)
+	{
+		m_error.str(""); m_error << "Could not write the directory of \"" << filename << "\".";
+	}
+
+	written = written && WriteFileData(outfile, folders, data_offset);
+
+	if(written && file_sync(outfile) != 0)
+	{
+		m_error.str(""); m_error << "Could not flush \"" << filename << "\" to disk.";
+		written = false;
+	}
+
+	fclose(outfile);
+
+	if(written && file_rename(temp_filename.c_str(), filename.c_str()) != 0)
+	{
+		m_error.str(""); m_error << "Could not replace \"" << filename << "\".";
+		written = false;
+	}
+
+	if(!written)
+	{
+		file_remove(temp_filename.c_str());
+		return false;
+	}
+
+	file_sync_dir(filename.c_str());
+
+	m_stats.directory_blocks = (uint32_t)blocks.size();
+	m_stats.archive_size = data_offset + m_stats.data_bytes;
+	m_stats.write_ms = (boost::posix_time::microsec_clock::universal_time() - start).total_microseconds() / 1000.0;
+
+	return true;
+}
+
+//-----------------------------------------------------------------------------
@@ -0,0 +1,131 @@
+#pragma once
+
+#ifndef PK2BUILDER_H_
+#define PK2BUILDER_H_
+
+//-----------------------------------------------------------------------------
+
+#include <stdint.h>
+#include <stdio.h>
+#include "blowfish.h"
+#include <vector>
+#include <sstream>
+#include <string>
+#include "PK2.h"
+
+//-----------------------------------------------------------------------------
+
+struct dir_entry;
+class PK2Reader;
+
+// Counts and timings from the last Scan/Write.
+struct PK2BuildStats
+{
+	uint32_t folders; // not counting the root
+	uint32_t files;
+	uint32_t directory_blocks;
+	uint32_t source_blocks; // directory blocks read by AddArchive
+	uint64_t data_bytes; // written once per data range
+	uint64_t archive_size;
+	double scan_ms;
+	double write_ms;
+};
+
+//-----------------------------------------------------------------------------
+
+// Creates a new PK2 archive. The folder tree is collected first, then the whole
+// layout is planned before anything is written: every folder's directory chain
+// is contiguous, all chains sit together right after the header, and the file
+// data follows in directory order. Directory blocks are encrypted on all cores
+// and file data is streamed through one large buffer, so memory use does not
+// depend on the size of the files.
+class PK2Builder
+{
+private:
+	struct Node
+	{
+		std::string name;
+		uint8_t type; // 1 folder, 2 file, as in PK2Entry
+		uint64_t create_time;
+		uint64_t modify_time;
+		uint64_t access_time;
+		uint32_t size;
+		std::string source; // file or folder on disk, or the path inside 'reader'
+		PK2Reader * reader; // set when the data comes from an archive
+		int64_t source_position; // data of the file inside 'reader'
+		bool shared; // the data range was already written for another entry
+		size_t parent;
+		std::vector<size_t> children;
+		int64_t position; // first directory block for folders, data for files
+		uint32_t blocks; // length of a folder's chain
+	};
+
+	struct ScanFolder;
+	friend struct ScanFolder;
+	struct EncodeBlocks;
+	struct ArchiveScan;
+	friend struct ArchiveScan;
+
+	std::vector<Node> m_nodes; // m_nodes[0] is the root
+	bool m_encrypt;
+	Blowfish m_blowfish;
+	PK2BuildStats m_stats;
+	std::stringstream m_error;
+
+private:
+	PK2Builder & operator = (const PK2Builder & rhs);
+	PK2Builder(const PK2Builder & rhs);
+	bool AddChildren(size_t parent, const std::string & base, std::vector<dir_entry> & listing);
+	static bool ArchiveScanFunc(PK2Reader * reader, const std::string & path, PK2EntryBlock & block, void * userdata);
+	void AddRoot(uint64_t create_time, uint64_t modify_time, uint64_t access_time);
+	void Count();
+	void Plan(std::vector<size_t> & folders, int64_t & data_offset);
+	void FillBlocks(const std::vector<size_t> & folders, std::vector<PK2EntryBlock> & blocks);
+	bool FlushBuffer(FILE * outfile, std::vector<uint8_t> & buffer, size_t & used, int64_t & written);
+	bool CopyArchiveData(const Node & file, FILE * outfile, std::vector<uint8_t> & buffer, size_t & used, int64_t & written);
+	bool WriteFileData(FILE * outfile, const std::vector<size_t> & folders, int64_t data_offset);
+
+public:
+	PK2Builder();
+	~PK2Builder();
+
+	// Returns the error if a function returns false.
+	std::string GetError();
+
+	// Sets the key the archive is encrypted with, the same key a PK2Reader would
+	// be given to open it. If this is never called the archive is not encrypted.
+	void SetEncryptionKey(char * ascii_key = "169841", uint8_t ascii_key_length = 6, char * base_key = "\x03\xF8\xE4\x44\x88\x99\x3F\x64\xFE\x35", uint8_t base_key_length = 10);
+
+	// Encrypts the archive with the key of an existing Blowfish object, such as
+	// the one PK2Reader::GetBlowfish returns.
+	void SetEncryption(const Blowfish & blowfish);
+
+	// Drops everything added so far.
+	void Clear();
+
+	// Adds everything inside 'input_dir' to the root of the archive. Folders are
+	// listed in parallel one level at a time; children are sorted by name so the
+	// same tree always gives the same archive. Linked folders are skipped, since
+	// one pointing at an ancestor would never end. 'threads' of 0 uses one per core.
+	bool AddDirectory(const std::string & input_dir, uint32_t threads = 0);
+
+	// Adds every entry of an opened PK2 to the archive, keeping each folder's
+	// order. An entry whose name is already taken in its folder is skipped, which
+	// also drops entries a reader could never find. Entries that share a data
+	// range keep sharing one copy. The reader must stay open until Write is done.
+	bool AddArchive(PK2Reader & reader);
+
+	// Writes the archive. Files are read from disk while it is written, so they
+	// must not change size after AddDirectory. Data from an archive is copied
+	// straight out of its mapping and released from memory once written. The
+	// archive is written to "<output_file>.tmp" and renamed over 'output_file'
+	// once it is on disk, so a failed Write leaves an existing file untouched.
+	bool Write(const std::string & output_file, uint32_t threads = 0);
+
+	// Returns the counts and timings of the last AddDirectory/AddArchive/Write.
+	PK2BuildStats GetStats();
+};
+
+//-----------------------------------------------------------------------------
+
+#endif
@@ -0,0 +1,153 @@
+#include "PK2Compactor.h"
+#include "PK2Builder.h"
+#include "PK2Reader.h"
+#include "shared_io.h"
+#include <string.h>
+#include <map>
+
+#include <boost/date_time/posix_time/posix_time_types.hpp>
+
+//-----------------------------------------------------------------------------
+
+// Times what a compacted layout is meant to speed up: walking the whole
+// directory, and resolving each path from the root.
+static bool MeasureDirectory(PK2Reader & reader, double & index_ms, double & lookup_ms)
+{
+	boost::posix_time::ptime start = boost::posix_time::microsec_clock::universal_time();
+
+	std::map<std::string, PK2Entry> index;
+	if(!reader.BuildIndex(index))
+	{
+		return false;
+	}
+
+	boost::posix_time::ptime indexed = boost::posix_time::microsec_clock::universal_time();
+	index_ms = (indexed - start).total_microseconds() / 1000.0;
+
+	reader.ClearCache();
+	for(std::map<std::string, PK2Entry>::iterator itr = index.begin(); itr != index.end(); ++itr)
+	{
+		PK2Entry entry;
+		memset(&entry, 0, sizeof(PK2Entry));
+		if(!reader.GetEntry(itr->first.c_str(), entry))
+		{
+			return false;
+		}
+	}
+	reader.ClearCache();
+
+	lookup_ms = (boost::posix_time::microsec_clock::universal_time() - indexed).total_microseconds() / 1000.0;
+	return true;
+}
+
+//-----------------------------------------------------------------------------
+
+PK2Compactor::PK2Compactor()
+{
+	memset(&m_stats, 0, sizeof(PK2CompactStats));
+}
+
+//-----------------------------------------------------------------------------
+
+PK2Compactor::~PK2Compactor()
+{
+}
+
+//-----------------------------------------------------------------------------
+
+std::string PK2Compactor::GetError()
+{
+	std::string e = m_error.str();
+	m_error.str("");
+	return e;
+}
+
+//-----------------------------------------------------------------------------
+
+PK2CompactStats PK2Compactor::GetStats()
+{
+	return m_stats;
+}
+
+//-----------------------------------------------------------------------------
+
+bool PK2Compactor::Compact(PK2Reader & reader, const std::string & output_file, uint32_t threads)
+{
+	memset(&m_stats, 0, sizeof(PK2CompactStats));
+
+	std::string input_file = reader.GetFilename();
+	if(input_file.empty())
+	{
+		m_error.str(""); m_error << "There is no PK2 loaded yet.";
+		return false;
+	}
+
+	// Replacing the file being read from would lose the source. Names can differ
+	// for the same file ("./t.pk2", links, case), so compare the files themselves.
+	if(file_same(input_file.c_str(), output_file.c_str()))
+	{
+		m_error.str(""); m_error << "The output file must not be the PK2 being compacted.";
+		return false;
+	}
+
+	dir_entry input;
+	if(!dir_stat(input_file.c_str(), input))
+	{
+		m_error.str(""); m_error << "Could not read the size of \"" << input_file << "\".";
+		return false;
+	}
+
+	if(!MeasureDirectory(reader, m_stats.input_index_ms, m_stats.input_lookup_ms))
+	{
+		m_error.str(""); m_error << reader.GetError();
+		return false;
+	}
+
+	PK2Builder builder;
+
+	Blowfish blowfish;
+	bool encrypted = reader.GetBlowfish(blowfish);
+	if(encrypted)
+	{
+		builder.SetEncryption(blowfish);
+	}
+
+	if(!builder.AddArchive(reader))
+	{
+		m_error.str(""); m_error << builder.GetError();
+		return false;
+	}
+
+	if(!builder.Write(output_file, threads))
+	{
+		m_error.str(""); m_error << builder.GetError();
+		return false;
+	}
+
+	PK2BuildStats stats = builder.GetStats();
+	m_stats.input_size = input.size;
+	m_stats.output_size = stats.archive_size;
+	m_stats.reclaimed = (int64_t)input.size - (int64_t)stats.archive_size;
+	m_stats.live_bytes = stats.data_bytes;
+	m_stats.input_blocks = stats.source_blocks;
+	m_stats.output_blocks = stats.directory_blocks;
+	m_stats.folders = stats.folders;
+	m_stats.files = stats.files;
+	m_stats.scan_ms = stats.scan_ms;
+	m_stats.write_ms = stats.write_ms;
+
+	PK2Reader output;
+	if(encrypted)
+	{
+		output.SetDecryption(blowfish);
+	}
+	if(!output.Open(output_file) || !MeasureDirectory(output, m_stats.output_index_ms, m_stats.output_lookup_ms))
+	{
+		m_error.str(""); m_error << "The compacted PK2 could not be read back: " << output.GetError();
+		return false;
+	}
+
+	return true;
+}
+
+//-----------------------------------------------------------------------------
@@ -0,0 +1,74 @@
+#pragma once
+
+#ifndef PK2COMPACTOR_H_
+#define PK2COMPACTOR_H_
+
+//-----------------------------------------------------------------------------
+
+#include <stdint.h>
+#include <sstream>
+#include <string>
+
+//-----------------------------------------------------------------------------
+
+class PK2Reader;
+
+// Sizes from the last Compact.
+struct PK2CompactStats
+{
+	uint64_t input_size;
+	uint64_t output_size;
+	int64_t reclaimed; // input_size - output_size
+	uint64_t live_bytes; // file data kept
+	uint32_t input_blocks; // directory blocks reachable in the input
+	uint32_t output_blocks;
+	uint32_t folders;
+	uint32_t files;
+	double scan_ms;
+	double write_ms;
+
+	// Directory speed before and after: one BuildIndex, and a GetEntry of every
+	// path with the entry cache empty
+	double input_index_ms;
+	double output_index_ms;
+	double input_lookup_ms;
+	double output_lookup_ms;
+};
+
+//-----------------------------------------------------------------------------
+
+// Rewrites a PK2 without the data and directory blocks patching left behind.
+// Live entries are streamed into a new file in directory order through
+// PK2Builder, so every folder's chain becomes contiguous, all chains sit right
+// after the header and each folder's files follow one another. Memory use is
+// bounded by the directory, not the data: file data goes through one buffer and
+// is released from the source mapping once written.
+class PK2Compactor
+{
+private:
+	PK2CompactStats m_stats;
+	std::stringstream m_error;
+
+private:
+	PK2Compactor & operator = (const PK2Compactor & rhs);
+	PK2Compactor(const PK2Compactor & rhs);
+
+public:
+	PK2Compactor();
+	~PK2Compactor();
+
+	// Returns the error if a function returns false.
+	std::string GetError();
+
+	// Writes the live contents of an opened PK2 to 'output_file', encrypted with
+	// the same key. The output must not be the input; replace the input with it
+	// once the reader is closed. 'threads' of 0 uses one thread per core.
+	bool Compact(PK2Reader & reader, const std::string & output_file, uint32_t threads = 0);
+
+	// Returns the sizes and timings of the last Compact.
+	PK2CompactStats GetStats();
+};
+
+//-----------------------------------------------------------------------------
+
+#endif
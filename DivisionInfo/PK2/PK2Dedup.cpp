@@ -0,0 +1,268 @@
+#include "PK2Dedup.h"
+#include "PK2Reader.h"
+#include "parallel_for.h"
+#include <string.h>
+#include <algorithm>
+#include <map>
+#include <set>
+
+#define XXH_INLINE_ALL
+#include <xxhash.h>
+
+//-----------------------------------------------------------------------------
+
+// Bytes hashed by the cheap second stage. Files this small are fully hashed there.
+const uint32_t dedup_prefix_size = 4096;
+
+struct DedupCandidate
+{
+	std::string path;
+	PK2Entry entry;
+	uint64_t prefix;
+	uint64_t full_low;
+	uint64_t full_high;
+};
+
+//-----------------------------------------------------------------------------
+
+// Orders candidate indices by everything known about them so far, then by path.
+struct DedupLess
+{
+	std::vector<DedupCandidate> & candidates;
+
+	DedupLess(std::vector<DedupCandidate> & candidates_) : candidates(candidates_)
+	{
+	}
+
+	// std::sort takes the comparison by value
+	DedupLess(const DedupLess & rhs) : candidates(rhs.candidates)
+	{
+	}
+
+	bool Same(size_t a, size_t b) const
+	{
+		const DedupCandidate & x = candidates[a];
+		const DedupCandidate & y = candidates[b];
+		return x.entry.size == y.entry.size && x.prefix == y.prefix && x.full_low == y.full_low && x.full_high == y.full_high;
+	}
+
+	bool operator()(size_t a, size_t b) const
+	{
+		const DedupCandidate & x = candidates[a];
+		const DedupCandidate & y = candidates[b];
+		if(x.entry.size != y.entry.size) return x.entry.size < y.entry.size;
+		if(x.prefix != y.prefix) return x.prefix < y.prefix;
+		if(x.full_low != y.full_low) return x.full_low < y.full_low;
+		if(x.full_high != y.full_high) return x.full_high < y.full_high;
+		return x.path < y.path;
+	}
+
+private:
+	DedupLess & operator = (const DedupLess & rhs);
+};
+
+//-----------------------------------------------------------------------------
+
+struct DedupHasher
+{
+	PK2Reader & reader;
+	std::vector<DedupCandidate> & candidates;
+	std::vector<size_t> & work;
+	bool full;
+
+	DedupHasher(PK2Reader & reader_, std::vector<DedupCandidate> & candidates_, std::vector<size_t> & work_, bool full_) : reader(reader_), candidates(candidates_), work(work_), full(full_)
+	{
+	}
+
+	void operator()(size_t x)
+	{
+		DedupCandidate & c = candidates[work[x]];
+		const char * data = reader.Extract(c.entry);
+
+		if(full)
+		{
+			XXH128_hash_t h = XXH3_128bits(data, c.entry.size);
+			c.full_low = h.low64;
+			c.full_high = h.high64;
+		}
+		else
+		{
+			c.prefix = XXH3_64bits(data, std::min(c.entry.size, dedup_prefix_size));
+		}
+	}
+
+private:
+	DedupHasher & operator = (const DedupHasher & rhs);
+};
+
+//-----------------------------------------------------------------------------
+
+// Sorts 'work' and keeps only the indices that share their key with a neighbour.
+void KeepDuplicates(std::vector<size_t> & work, DedupLess & less)
+{
+	std::sort(work.begin(), work.end(), less);
+
+	std::vector<size_t> kept;
+	for(size_t x = 0; x < work.size(); ++x)
+	{
+		bool prev = x > 0 && less.Same(work[x - 1], work[x]);
+		bool next = x + 1 < work.size() && less.Same(work[x], work[x + 1]);
+		if(prev || next)
+		{
+			kept.push_back(work[x]);
+		}
+	}
+	work.swap(kept);
+}
+
+//-----------------------------------------------------------------------------
+
+bool GroupSavingsGreater(const PK2DuplicateGroup & a, const PK2DuplicateGroup & b)
+{
+	uint64_t x = (uint64_t)a.size * (a.copies - 1);
+	uint64_t y = (uint64_t)b.size * (b.copies - 1);
+	if(x != y)
+	{
+		return x > y;
+	}
+	return a.paths[0] < b.paths[0];
+}
+
+//-----------------------------------------------------------------------------
+
+PK2Dedup::PK2Dedup()
+{
+	m_reclaimable = 0;
+}
+
+//-----------------------------------------------------------------------------
+
+PK2Dedup::~PK2Dedup()
+{
+}
+
+//-----------------------------------------------------------------------------
+
+std::string PK2Dedup::GetError()
+{
+	std::string e = m_error.str();
+	m_error.str("");
+	return e;
+}
+
+//-----------------------------------------------------------------------------
+
+bool PK2Dedup::Analyze(PK2Reader & reader, uint32_t threads)
+{
+	m_groups.clear();
+	m_reclaimable = 0;
+
+	std::map<std::string, PK2Entry> index;
+	if(!reader.BuildIndex(index))
+	{
+		m_error.str(""); m_error << reader.GetError();
+		return false;
+	}
+
+	std::vector<DedupCandidate> candidates;
+	for(std::map<std::string, PK2Entry>::iterator itr = index.begin(); itr != index.end(); ++itr)
+	{
+		// Empty files have nothing to reclaim, and damaged entries pointing past
+		// the end of the file cannot be hashed
+		if(itr->second.type != 2 || itr->second.size == 0 || reader.Extract(itr->second) == 0)
+		{
+			continue;
+		}
+
+		DedupCandidate c;
+		c.path = itr->first;
+		c.entry = itr->second;
+		c.prefix = 0;
+		c.full_low = 0;
+		c.full_high = 0;
+		candidates.push_back(c);
+	}
+
+	DedupLess less(candidates);
+	std::vector<size_t> work(candidates.size());
+	for(size_t x = 0; x < work.size(); ++x)
+	{
+		work[x] = x;
+	}
+
+	// Stage 1: only files sharing a size can be duplicates
+	KeepDuplicates(work, less);
+
+	PK2AccessMode access_mode = reader.GetAccessMode();
+	reader.SetAccessMode(Access_Random);
+
+	// Stage 2: hash the first 4KB of each remaining file
+	DedupHasher prefix_hasher(reader, candidates, work, false);
+	parallel_for(work.size(), prefix_hasher, threads);
+	KeepDuplicates(work, less);
+
+	// Stage 3: hash the rest. Small files were already hashed whole by stage 2.
+	std::vector<size_t> full_work;
+	for(size_t x = 0; x < work.size(); ++x)
+	{
+		if(candidates[work[x]].entry.size > dedup_prefix_size)
+		{
+			full_work.push_back(work[x]);
+		}
+	}
+	DedupHasher full_hasher(reader, candidates, full_work, true);
+	parallel_for(full_work.size(), full_hasher, threads);
+	KeepDuplicates(work, less);
+
+	reader.SetAccessMode(access_mode);
+
+	for(size_t x = 0; x < work.size(); )
+	{
+		size_t end = x + 1;
+		while(end < work.size() && less.Same(work[x], work[end]))
+		{
+			++end;
+		}
+
+		PK2DuplicateGroup group;
+		group.size = candidates[work[x]].entry.size;
+
+		std::set<int64_t> positions;
+		for(size_t y = x; y < end; ++y)
+		{
+			group.paths.push_back(candidates[work[y]].path);
+			group.entries.push_back(candidates[work[y]].entry);
+			positions.insert(candidates[work[y]].entry.position);
+		}
+		group.copies = (uint32_t)positions.size();
+
+		// Paths already sharing one data range are not wasting space
+		if(group.copies > 1)
+		{
+			m_reclaimable += (uint64_t)group.size * (group.copies - 1);
+			m_groups.push_back(group);
+		}
+
+		x = end;
+	}
+
+	std::sort(m_groups.begin(), m_groups.end(), GroupSavingsGreater);
+
+	return true;
+}
+
+//-----------------------------------------------------------------------------
+
+const std::vector<PK2DuplicateGroup> & PK2Dedup::GetGroups()
+{
+	return m_groups;
+}
+
+//-----------------------------------------------------------------------------
+
+uint64_t PK2Dedup::GetReclaimableBytes()
+{
+	return m_reclaimable;
+}
+
+//-----------------------------------------------------------------------------
@@ -0,0 +1,61 @@
+#pragma once
+
+#ifndef PK2DEDUP_H_
+#define PK2DEDUP_H_
+
+//-----------------------------------------------------------------------------
+
+#include "PK2.h"
+#include <vector>
+#include <sstream>
+#include <string>
+
+//-----------------------------------------------------------------------------
+
+class PK2Reader;
+
+struct PK2DuplicateGroup
+{
+	uint32_t size; // size of each file
+	uint32_t copies; // number of distinct data ranges holding this content
+	std::vector<std::string> paths; // lower case, backslash separated, sorted
+	std::vector<PK2Entry> entries; // same order as paths
+};
+
+//-----------------------------------------------------------------------------
+
+// Finds files with byte-identical content. Files are bucketed by size, then by
+// a hash of the first 4KB and finally by a hash of the whole file, each stage in
+// parallel over the mapping, so only likely duplicates are ever read in full.
+class PK2Dedup
+{
+private:
+	std::vector<PK2DuplicateGroup> m_groups;
+	uint64_t m_reclaimable;
+	std::stringstream m_error;
+
+private:
+	PK2Dedup & operator = (const PK2Dedup & rhs);
+	PK2Dedup(const PK2Dedup & rhs);
+
+public:
+	PK2Dedup();
+	~PK2Dedup();
+
+	// Returns the error if a function returns false.
+	std::string GetError();
+
+	// Scans an opened PK2. 'threads' of 0 uses one thread per core.
+	bool Analyze(PK2Reader & reader, uint32_t threads = 0);
+
+	// Returns the duplicate groups of the last Analyze, largest savings first.
+	const std::vector<PK2DuplicateGroup> & GetGroups();
+
+	// Returns the bytes saved if every group kept a single copy of its data.
+	// Entries that already share a data range are not counted again.
+	uint64_t GetReclaimableBytes();
+};
+
+//-----------------------------------------------------------------------------
+
+#endif
@@ -0,0 +1,196 @@
+#include "PK2Diff.h"
+#include "PK2Reader.h"
+#include "parallel_for.h"
+#include <string.h>
+#include <map>
+
+//-----------------------------------------------------------------------------
+
+struct DiffComparer
+{
+	PK2Reader & old_reader;
+	PK2Reader & new_reader;
+	std::vector<PK2DiffEntry> & candidates;
+	std::vector<uint8_t> & changed;
+
+	DiffComparer(PK2Reader & old_reader_, PK2Reader & new_reader_, std::vector<PK2DiffEntry> & candidates_, std::vector<uint8_t> & changed_) : old_reader(old_reader_), new_reader(new_reader_), candidates(candidates_), changed(changed_)
+	{
+	}
+
+	void operator()(size_t x)
+	{
+		PK2DiffEntry & e = candidates[x];
+		const char * a = old_reader.Extract(e.old_entry);
+		const char * b = new_reader.Extract(e.new_entry);
+
+		// Both sides are mapped, so a direct compare is exact and reads each byte once.
+		// A side that points outside its file cannot be shown equal.
+		changed[x] = (a == 0 || b == 0 || memcmp(a, b, e.new_entry.size) != 0) ? 1 : 0;
+	}
+
+private:
+	DiffComparer & operator = (const DiffComparer & rhs);
+};
+
+//-----------------------------------------------------------------------------
+
+PK2Diff::PK2Diff()
+{
+}
+
+//-----------------------------------------------------------------------------
+
+PK2Diff::~PK2Diff()
+{
+}
+
+//-----------------------------------------------------------------------------
+
+std::string PK2Diff::GetError()
+{
+	std::string e = m_error.str();
+	m_error.str("");
+	return e;
+}
+
+//-----------------------------------------------------------------------------
+
+bool PK2Diff::Compare(PK2Reader & old_reader, PK2Reader & new_reader, uint32_t flags, uint32_t threads)
+{
+	m_added.clear();
+	m_removed.clear();
+	m_changed.clear();
+
+	std::map<std::string, PK2Entry> old_index;
+	std::map<std::string, PK2Entry> new_index;
+
+	if(!old_reader.BuildIndex(old_index))
+	{
+		m_error.str(""); m_error << old_reader.GetError();
+		return false;
+	}
+	if(!new_reader.BuildIndex(new_index))
+	{
+		m_error.str(""); m_error << new_reader.GetError();
+		return false;
+	}
+
+	std::vector<PK2DiffEntry> candidates;
+
+	// Both indexes are sorted by path so they can be joined in a single pass
+	std::map<std::string, PK2Entry>::iterator old_itr = old_index.begin();
+	std::map<std::string, PK2Entry>::iterator new_itr = new_index.begin();
+	while(old_itr != old_index.end() || new_itr != new_index.end())
+	{
+		if(old_itr != old_index.end() && old_itr->second.type != 2)
+		{
+			++old_itr;
+			continue;
+		}
+		if(new_itr != new_index.end() && new_itr->second.type != 2)
+		{
+			++new_itr;
+			continue;
+		}
+
+		PK2DiffEntry e;
+		memset(&e.old_entry, 0, sizeof(PK2Entry));
+		memset(&e.new_entry, 0, sizeof(PK2Entry));
+
+		if(new_itr == new_index.end() || (old_itr != old_index.end() && old_itr->first < new_itr->first))
+		{
+			e.path = old_itr->first;
+			e.old_entry = old_itr->second;
+			m_removed.push_back(e);
+			++old_itr;
+		}
+		else if(old_itr == old_index.end() || new_itr->first < old_itr->first)
+		{
+			e.path = new_itr->first;
+			e.new_entry = new_itr->second;
+			m_added.push_back(e);
+			++new_itr;
+		}
+		else
+		{
+			e.path = new_itr->first;
+			e.old_entry = old_itr->second;
+			e.new_entry = new_itr->second;
+
+			if(e.old_entry.size != e.new_entry.size)
+			{
+				m_changed.push_back(e);
+			}
+			else if((flags & Diff_CompareAll) || e.old_entry.position != e.new_entry.position || e.old_entry.modifyTime != e.new_entry.modifyTime)
+			{
+				candidates.push_back(e);
+			}
+
+			++old_itr;
+			++new_itr;
+		}
+	}
+
+	if(!candidates.empty())
+	{
+		std::vector<uint8_t> changed(candidates.size(), 0);
+
+		PK2AccessMode old_mode = old_reader.GetAccessMode();
+		PK2AccessMode new_mode = new_reader.GetAccessMode();
+		old_reader.SetAccessMode(Access_Random);
+		new_reader.SetAccessMode(Access_Random);
+
+		DiffComparer comparer(old_reader, new_reader, candidates, changed);
+		parallel_for(candidates.size(), comparer, threads);
+
+		old_reader.SetAccessMode(old_mode);
+		new_reader.SetAccessMode(new_mode);
+
+		// Merge back so the changed list stays sorted by path
+		std::vector<PK2DiffEntry> merged;
+		merged.reserve(m_changed.size() + candidates.size());
+		size_t y = 0;
+		for(size_t x = 0; x < candidates.size(); ++x)
+		{
+			if(!changed[x])
+			{
+				continue;
+			}
+			while(y < m_changed.size() && m_changed[y].path < candidates[x].path)
+			{
+				merged.push_back(m_changed[y++]);
+			}
+			merged.push_back(candidates[x]);
+		}
+		while(y < m_changed.size())
+		{
+			merged.push_back(m_changed[y++]);
+		}
+		m_changed.swap(merged);
+	}
+
+	return true;
+}
+
+//-----------------------------------------------------------------------------
+
+const std::vector<PK2DiffEntry> & PK2Diff::GetAdded()
+{
+	return m_added;
+}
+
+//-----------------------------------------------------------------------------
+
+const std::vector<PK2DiffEntry> & PK2Diff::GetRemoved()
+{
+	return m_removed;
+}
+
+//-----------------------------------------------------------------------------
+
+const std::vector<PK2DiffEntry> & PK2Diff::GetChanged()
+{
+	return m_changed;
+}
+
+//-----------------------------------------------------------------------------
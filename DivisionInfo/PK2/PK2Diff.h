@@ -0,0 +1,70 @@
+#pragma once
+
+#ifndef PK2DIFF_H_
+#define PK2DIFF_H_
+
+//-----------------------------------------------------------------------------
+
+#include "PK2.h"
+#include <vector>
+#include <sstream>
+#include <string>
+
+//-----------------------------------------------------------------------------
+
+class PK2Reader;
+
+enum PK2DiffFlags
+{
+	Diff_CompareAll = 1 // compare the content of every file whose size matches, even if its metadata does too
+};
+
+struct PK2DiffEntry
+{
+	std::string path; // lower case, backslash separated
+	PK2Entry old_entry; // zero'ed for added files
+	PK2Entry new_entry; // zero'ed for removed files
+};
+
+//-----------------------------------------------------------------------------
+
+// Works out which files were added, removed or changed between two PK2s. Files are
+// joined by path and compared by metadata first: a different size is a change,
+// and a file whose size, position and modify time all match is taken as
+// unchanged. Only the remaining files have their content compared, in parallel
+// straight from both mappings, so a patched archive is diffed without reading
+// it whole. This trusts that rewritten data was moved or had its modify time
+// updated, as PK2Writer does; two unrelated builds with the same layout, or an
+// in-place rewrite, should be compared with Diff_CompareAll.
+class PK2Diff
+{
+private:
+	std::vector<PK2DiffEntry> m_added;
+	std::vector<PK2DiffEntry> m_removed;
+	std::vector<PK2DiffEntry> m_changed;
+	std::stringstream m_error;
+
+private:
+	PK2Diff & operator = (const PK2Diff & rhs);
+	PK2Diff(const PK2Diff & rhs);
+
+public:
+	PK2Diff();
+	~PK2Diff();
+
+	// Returns the error if a function returns false.
+	std::string GetError();
+
+	// Compares two opened PK2s. 'flags' is a combination of PK2DiffFlags and
+	// 'threads' of 0 uses one thread per core.
+	bool Compare(PK2Reader & old_reader, PK2Reader & new_reader, uint32_t flags = 0, uint32_t threads = 0);
+
+	// Returns the results of the last Compare, each sorted by path.
+	const std::vector<PK2DiffEntry> & GetAdded();
+	const std::vector<PK2DiffEntry> & GetRemoved();
+	const std::vector<PK2DiffEntry> & GetChanged();
+};
+
+//-----------------------------------------------------------------------------
+
+#endif
@@ -0,0 +1,272 @@
+#include "PK2FileSystem.h"
+#include "PK2Reader.h"
+#include <algorithm>
+#include <string.h>
+
+//-----------------------------------------------------------------------------
+
+// Brings a path into the form used by PK2Reader::BuildIndex: lower case,
+// backslash separated and without empty components.
+std::string NormalizePK2Path(const char * pathname)
+{
+	std::string result;
+	result.reserve(strlen(pathname));
+
+	for(const char * p = pathname; *p; ++p)
+	{
+		char ch = *p;
+		if(ch == '/' || ch == '\\')
+		{
+			if(!result.empty() && result[result.size() - 1] != '\\')
+			{
+				result += '\\';
+			}
+		}
+		else
+		{
+			result += (char)tolower((unsigned char)ch);
+		}
+	}
+
+	if(!result.empty() && result[result.size() - 1] == '\\')
+	{
+		result.resize(result.size() - 1);
+	}
+
+	return result;
+}
+
+//-----------------------------------------------------------------------------
+
+PK2FileSystem::PK2FileSystem()
+{
+}
+
+//-----------------------------------------------------------------------------
+
+PK2FileSystem::~PK2FileSystem()
+{
+	UnmountAll();
+}
+
+//-----------------------------------------------------------------------------
+
+std::string PK2FileSystem::GetError()
+{
+	boost::mutex::scoped_lock lock(m);
+
+	std::string e = m_error.str();
+	m_error.str("");
+	return e;
+}
+
+//-----------------------------------------------------------------------------
+
+bool PK2FileSystem::Merge(size_t archive)
+{
+	Archive & a = m_archives[archive];
+
+	std::map<std::string, PK2Entry> index;
+	if(!a.reader->BuildIndex(index))
+	{
+		m_error.str(""); m_error << "Could not index \"" << a.filename << "\".\n" << a.reader->GetError();
+		return false;
+	}
+
+	for(std::map<std::string, PK2Entry>::iterator itr = index.begin(); itr != index.end(); ++itr)
+	{
+		std::map<std::string, IndexEntry>::iterator existing = m_index.find(itr->first);
+		if(existing != m_index.end() && m_archives[existing->second.archive].priority > a.priority)
+		{
+			continue;
+		}
+
+		IndexEntry & e = m_index[itr->first];
+		e.entry = itr->second;
+		e.archive = archive;
+	}
+
+	return true;
+}
+
+//-----------------------------------------------------------------------------
+
+bool PK2FileSystem::Mount(const std::string & filename, int priority, char * ascii_key, uint8_t ascii_key_length, char * base_key, uint8_t base_key_length)
+{
+	boost::mutex::scoped_lock lock(m);
+
+	for(size_t x = 0; x < m_archives.size(); ++x)
+	{
+		if(m_archives[x].filename == filename)
+		{
+			m_error.str(""); m_error << "\"" << filename << "\" is already mounted.";
+			return false;
+		}
+	}
+
+	Archive a;
+	a.reader.reset(new PK2Reader);
+	a.filename = filename;
+	a.priority = priority;
+
+	a.reader->SetDecryptionKey(ascii_key, ascii_key_length, base_key, base_key_length);
+	if(!a.reader->Open(filename))
+	{
+		m_error.str(""); m_error << a.reader->GetError();
+		return false;
+	}
+
+	m_archives.push_back(a);
+
+	if(!Merge(m_archives.size() - 1))
+	{
+		// Entries that were merged before the failure must not point at a closed archive
+		m_archives.pop_back();
+		m_index.clear();
+		for(size_t x = 0; x < m_archives.size(); ++x)
+		{
+			Merge(x);
+		}
+		return false;
+	}
+
+	return true;
+}
+
+//-----------------------------------------------------------------------------
+
+bool PK2FileSystem::Unmount(const std::string & filename)
+{
+	boost::mutex::scoped_lock lock(m);
+
+	for(size_t x = 0; x < m_archives.size(); ++x)
+	{
+		if(m_archives[x].filename == filename)
+		{
+			m_archives.erase(m_archives.begin() + x);
+
+			// Archive numbers have shifted, so start over in mount order
+			m_index.clear();
+			for(size_t y = 0; y < m_archives.size(); ++y)
+			{
+				Merge(y);
+			}
+			return true;
+		}
+	}
+
+	m_error.str(""); m_error << "\"" << filename << "\" is not mounted.";
+	return false;
+}
+
+//-----------------------------------------------------------------------------
+
+void PK2FileSystem::UnmountAll()
+{
+	boost::mutex::scoped_lock lock(m);
+
+	m_index.clear();
+	m_archives.clear();
+}
+
+//-----------------------------------------------------------------------------
+
+size_t PK2FileSystem::GetEntryCount()
+{
+	boost::mutex::scoped_lock lock(m);
+	return m_index.size();
+}
+
+//-----------------------------------------------------------------------------
+
+bool PK2FileSystem::Find(const char * pathname, IndexEntry & result)
+{
+	std::map<std::string, IndexEntry>::iterator itr = m_index.find(NormalizePK2Path(pathname));
+	if(itr == m_index.end())
+	{
+		m_error.str(""); m_error << "The entry does not exist";
+		return false;
+	}
+
+	result = itr->second;
+	return true;
+}
+
+//-----------------------------------------------------------------------------
+
+bool PK2FileSystem::GetEntry(const char * pathname, PK2Entry & entry, PK2Reader ** reader)
+{
+	boost::mutex::scoped_lock lock(m);
+
+	IndexEntry e;
+	if(!Find(pathname, e))
+	{
+		return false;
+	}
+
+	entry = e.entry;
+	if(reader)
+	{
+		*reader = m_archives[e.archive].reader.get();
+	}
+
+	return true;
+}
+
+//-----------------------------------------------------------------------------
+
+bool PK2FileSystem::Exists(const char * pathname)
+{
+	boost::mutex::scoped_lock lock(m);
+	return m_index.find(NormalizePK2Path(pathname)) != m_index.end();
+}
+
+//-----------------------------------------------------------------------------
+
+bool PK2FileSystem::ExtractToMemory(const char * pathname, std::vector<uint8_t> & buffer)
+{
+	boost::shared_ptr<PK2Reader> reader;
+	IndexEntry e;
+
+	{
+		boost::mutex::scoped_lock lock(m);
+		if(!Find(pathname, e))
+		{
+			return false;
+		}
+		reader = m_archives[e.archive].reader;
+	}
+
+	if(!reader->ExtractToMemory(e.entry, buffer))
+	{
+		boost::mutex::scoped_lock lock(m);
+		m_error.str(""); m_error << reader->GetError();
+		return false;
+	}
+
+	return true;
+}
+
+//-----------------------------------------------------------------------------
+
+const char * PK2FileSystem::Extract(const char * pathname, uint32_t & size)
+{
+	boost::mutex::scoped_lock lock(m);
+
+	IndexEntry e;
+	if(!Find(pathname, e))
+	{
+		return 0;
+	}
+
+	if(e.entry.type != 2)
+	{
+		m_error.str(""); m_error << "The entry is not a file.";
+		return 0;
+	}
+
+	size = e.entry.size;
+	return m_archives[e.archive].reader->Extract(e.entry);
+}
+
+//-----------------------------------------------------------------------------
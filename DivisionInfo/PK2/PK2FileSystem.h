@@ -0,0 +1,93 @@
+#pragma once
+
+#ifndef PK2FILESYSTEM_H_
+#define PK2FILESYSTEM_H_
+
+//-----------------------------------------------------------------------------
+
+#include <stdint.h>
+#include <vector>
+#include <map>
+#include <sstream>
+#include <string>
+#include "PK2.h"
+
+#include <boost/shared_ptr.hpp>
+#include <boost/thread/mutex.hpp>
+
+//-----------------------------------------------------------------------------
+
+class PK2Reader;
+
+// Mounts several PK2 archives (Media.pk2, Data.pk2, Map.pk2, ...) into a single
+// namespace. All mounted archives are merged into one index so any path is
+// resolved with a single lookup, no matter which archive it lives in.
+class PK2FileSystem
+{
+private:
+	struct Archive
+	{
+		boost::shared_ptr<PK2Reader> reader;
+		std::string filename;
+		int priority;
+	};
+
+	struct IndexEntry
+	{
+		PK2Entry entry;
+		size_t archive; // index into m_archives
+	};
+
+	std::vector<Archive> m_archives;
+	std::map<std::string, IndexEntry> m_index;
+	std::stringstream m_error;
+
+	boost::mutex m;
+
+private:
+	PK2FileSystem & operator = (const PK2FileSystem & rhs);
+	PK2FileSystem(const PK2FileSystem & rhs);
+	bool Merge(size_t archive);
+	bool Find(const char * pathname, IndexEntry & result);
+
+public:
+	PK2FileSystem();
+	~PK2FileSystem();
+
+	// Returns the error if a function returns false.
+	std::string GetError();
+
+	// Opens 'filename' and merges its entries into the namespace. When the same path
+	// exists in more than one archive, the archive with the highest priority wins; on
+	// equal priority the one mounted last wins. Each archive has its own key, see
+	// PK2Reader::SetDecryptionKey for the meaning of the key parameters.
+	bool Mount(const std::string & filename, int priority = 0, char * ascii_key = "169841", uint8_t ascii_key_length = 6, char * base_key = "\x03\xF8\xE4\x44\x88\x99\x3F\x64\xFE\x35", uint8_t base_key_length = 10);
+
+	// Closes a mounted archive and rebuilds the index from the remaining ones.
+	bool Unmount(const std::string & filename);
+
+	// Closes every mounted archive.
+	void UnmountAll();
+
+	// Returns how many paths the merged index holds.
+	size_t GetEntryCount();
+
+	// Resolves a path in the merged namespace. 'reader' optionally receives the
+	// reader of the archive the entry belongs to, which stays valid until that
+	// archive is unmounted.
+	bool GetEntry(const char * pathname, PK2Entry & entry, PK2Reader ** reader = 0);
+
+	// Returns true if the path exists in any mounted archive.
+	bool Exists(const char * pathname);
+
+	// Extracts a file to memory.
+	bool ExtractToMemory(const char * pathname, std::vector<uint8_t> & buffer);
+
+	// Returns a pointer to a file's data inside its archive's mapping, or 0 if the
+	// path is not a file. 'size' receives the size of the file.
+	const char * Extract(const char * pathname, uint32_t & size);
+};
+
+//-----------------------------------------------------------------------------
+
+#endif
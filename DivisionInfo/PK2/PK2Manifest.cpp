@@ -0,0 +1,316 @@
+#include "PK2Manifest.h"
+#include "PK2Reader.h"
+#include "sha256.h"
+#include "parallel_for.h"
+#include <string.h>
+#include <stdio.h>
+#include <fstream>
+#include <map>
+
+#define XXH_INLINE_ALL
+#include <xxhash.h>
+
+//-----------------------------------------------------------------------------
+
+// Binary layout: "PK2M", version, flags, entry count, then per entry the path
+// length (uint16), path, size (uint32), XXH3 (uint64) and the SHA-256 if present.
+const char manifest_magic[4] = { 'P', 'K', '2', 'M' };
+const uint32_t manifest_version = 1;
+
+//-----------------------------------------------------------------------------
+
+struct ManifestHasher
+{
+	PK2Reader & reader;
+	std::vector<PK2ManifestEntry> & entries;
+	std::vector<PK2Entry> & files;
+	std::vector<uint8_t> & failed; // 1 data outside the PK2
+	bool sha256;
+
+	ManifestHasher(PK2Reader & reader_, std::vector<PK2ManifestEntry> & entries_, std::vector<PK2Entry> & files_, std::vector<uint8_t> & failed_, bool sha256_) : reader(reader_), entries(entries_), files(files_), failed(failed_), sha256(sha256_)
+	{
+	}
+
+	void operator()(size_t x)
+	{
+		PK2Entry & e = files[x];
+		const char * data = reader.Extract(e);
+		if(data == 0)
+		{
+			failed[x] = 1;
+			return;
+		}
+
+		entries[x].xxh3 = XXH3_64bits(data, e.size);
+		if(sha256)
+		{
+			SHA256::Hash(data, e.size, entries[x].sha256);
+		}
+	}
+
+private:
+	ManifestHasher & operator = (const ManifestHasher & rhs);
+};
+
+//-----------------------------------------------------------------------------
+
+PK2Manifest::PK2Manifest()
+{
+	m_flags = 0;
+}
+
+//-----------------------------------------------------------------------------
+
+PK2Manifest::~PK2Manifest()
+{
+}
+
+//-----------------------------------------------------------------------------
+
+std::string PK2Manifest::GetError()
+{
+	std::string e = m_error.str();
+	m_error.str("");
+	return e;
+}
+
+//-----------------------------------------------------------------------------
+
+bool PK2Manifest::Build(PK2Reader & reader, uint32_t flags, uint32_t threads)
+{
+	m_entries.clear();
+	m_flags = flags;
+
+	std::map<std::string, PK2Entry> index;
+	if(!reader.BuildIndex(index))
+	{
+		m_error.str(""); m_error << reader.GetError();
+		return false;
+	}
+
+	std::vector<PK2Entry> files;
+	for(std::map<std::string, PK2Entry>::iterator itr = index.begin(); itr != index.end(); ++itr)
+	{
+		if(itr->second.type != 2)
+		{
+			continue;
+		}
+
+		PK2ManifestEntry e;
+		e.path = itr->first;
+		e.size = itr->second.size;
+		e.xxh3 = 0;
+		memset(e.sha256, 0, sizeof(e.sha256));
+
+		m_entries.push_back(e);
+		files.push_back(itr->second);
+	}
+
+	// Hashing reads the whole archive once; tell the kernel so readahead is large
+	PK2AccessMode access_mode = reader.GetAccessMode();
+	reader.SetAccessMode(Access_Sequential);
+
+	std::vector<uint8_t> failed(files.size(), 0);
+	ManifestHasher hasher(reader, m_entries, files, failed, (flags & Manifest_SHA256) != 0);
+	parallel_for(files.size(), hasher, threads);
+
+	reader.SetAccessMode(access_mode);
+
+	// A manifest of a damaged archive would make a broken install look valid
+	for(size_t x = 0; x < failed.size(); ++x)
+	{
+		if(failed[x])
+		{
+			m_error.str(""); m_error << "The data of the entry \"" << m_entries[x].path << "\" is not inside the PK2.";
+			m_entries.clear();
+			return false;
+		}
+	}
+
+	return true;
+}
+
+//-----------------------------------------------------------------------------
+
+const std::vector<PK2ManifestEntry> & PK2Manifest::GetEntries()
+{
+	return m_entries;
+}
+
+//-----------------------------------------------------------------------------
+
+uint32_t PK2Manifest::GetFlags()
+{
+	return m_flags;
+}
+
+//-----------------------------------------------------------------------------
+
+bool PK2Manifest::WriteBinary(const std::string & filename)
+{
+	std::ofstream out(filename.c_str(), std::ios::out | std::ios::binary | std::ios::trunc);
+	if(!out)
+	{
+		m_error.str(""); m_error << "Could not open the file \"" << filename << "\".";
+		return false;
+	}
+
+	uint32_t count = (uint32_t)m_entries.size();
+
+	out.write(manifest_magic, 4);
+	out.write((const char *)&manifest_version, 4);
+	out.write((const char *)&m_flags, 4);
+	out.write((const char *)&count, 4);
+
+	for(size_t x = 0; x < m_entries.size(); ++x)
+	{
+		const PK2ManifestEntry & e = m_entries[x];
+		uint16_t length = (uint16_t)e.path.size();
+
+		out.write((const char *)&length, 2);
+		out.write(e.path.c_str(), length);
+		out.write((const char *)&e.size, 4);
+		out.write((const char *)&e.xxh3, 8);
+		if(m_flags & Manifest_SHA256)
+		{
+			out.write((const char *)e.sha256, 32);
+		}
+	}
+
+	if(!out)
+	{
+		m_error.str(""); m_error << "Could not write to the file \"" << filename << "\".";
+		return false;
+	}
+
+	return true;
+}
+
+//-----------------------------------------------------------------------------
+
+bool PK2Manifest::ReadBinary(const std::string & filename)
+{
+	std::ifstream in(filename.c_str(), std::ios::in | std::ios::binary);
+	if(!in)
+	{
+		m_error.str(""); m_error << "Could not open the file \"" << filename << "\".";
+		return false;
+	}
+
+	char magic[4] = {0};
+	uint32_t version = 0;
+	uint32_t flags = 0;
+	uint32_t count = 0;
+
+	in.read(magic, 4);
+	in.read((char *)&version, 4);
+	in.read((char *)&flags, 4);
+	in.read((char *)&count, 4);
+
+	if(!in || memcmp(magic, manifest_magic, 4) != 0 || version != manifest_version)
+	{
+		m_error.str(""); m_error << "\"" << filename << "\" is not a PK2 manifest.";
+		return false;
+	}
+
+	std::vector<PK2ManifestEntry> entries;
+
+	for(uint32_t x = 0; x < count && in; ++x)
+	{
+		PK2ManifestEntry e;
+		uint16_t length = 0;
+
+		in.read((char *)&length, 2);
+		e.path.resize(length);
+		if(length)
+		{
+			in.read(&e.path[0], length);
+		}
+		in.read((char *)&e.size, 4);
+		in.read((char *)&e.xxh3, 8);
+		memset(e.sha256, 0, sizeof(e.sha256));
+		if(flags & Manifest_SHA256)
+		{
+			in.read((char *)e.sha256, 32);
+		}
+
+		entries.push_back(e);
+	}
+
+	if(!in)
+	{
+		m_error.str(""); m_error << "\"" << filename << "\" is truncated.";
+		return false;
+	}
+
+	m_entries.swap(entries);
+	m_flags = flags;
+
+	return true;
+}
+
+//-----------------------------------------------------------------------------
+
+bool PK2Manifest::WriteJson(const std::string & filename)
+{
+	std::ofstream out(filename.c_str(), std::ios::out | std::ios::binary | std::ios::trunc);
+	if(!out)
+	{
+		m_error.str(""); m_error << "Could not open the file \"" << filename << "\".";
+		return false;
+	}
+
+	char hex[72] = {0};
+
+	out << "{\n\t\"entries\": [";
+
+	for(size_t x = 0; x < m_entries.size(); ++x)
+	{
+		const PK2ManifestEntry & e = m_entries[x];
+
+		out << (x ? ",\n" : "\n") << "\t\t{ \"path\": \"";
+		for(size_t y = 0; y < e.path.size(); ++y)
+		{
+			unsigned char ch = (unsigned char)e.path[y];
+			if(ch == '\\' || ch == '"')
+			{
+				out << '\\' << (char)ch;
+			}
+			else if(ch < 0x20)
+			{
+				sprintf(hex, "\\u%.4x", ch);
+				out << hex;
+			}
+			else
+			{
+				out << (char)ch;
+			}
+		}
+
+		sprintf(hex, "%.16llx", (unsigned long long)e.xxh3);
+		out << "\", \"size\": " << e.size << ", \"xxh3\": \"" << hex << "\"";
+
+		if(m_flags & Manifest_SHA256)
+		{
+			for(int y = 0; y < 32; ++y)
+			{
+				sprintf(hex + y * 2, "%.2x", e.sha256[y]);
+			}
+			out << ", \"sha256\": \"" << hex << "\"";
+		}
+
+		out << " }";
+	}
+
+	out << "\n\t]\n}\n";
+
+	if(!out)
+	{
+		m_error.str(""); m_error << "Could not write to the file \"" << filename << "\".";
+		return false;
+	}
+
+	return true;
+}
+
+//-----------------------------------------------------------------------------
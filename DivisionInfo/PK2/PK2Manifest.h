@@ -0,0 +1,73 @@
+#pragma once
+
+#ifndef PK2MANIFEST_H_
+#define PK2MANIFEST_H_
+
+//-----------------------------------------------------------------------------
+
+#include <stdint.h>
+#include <vector>
+#include <sstream>
+#include <string>
+
+//-----------------------------------------------------------------------------
+
+class PK2Reader;
+
+enum PK2ManifestFlags
+{
+	Manifest_SHA256 = 1 // also compute a SHA-256 of every entry
+};
+
+struct PK2ManifestEntry
+{
+	std::string path; // lower case, backslash separated
+	uint32_t size;
+	uint64_t xxh3; // XXH3 64 bit hash of the data
+	uint8_t sha256[32]; // only valid with Manifest_SHA256
+};
+
+//-----------------------------------------------------------------------------
+
+// Lists every file of a PK2 with its size and content hash. Entry data is hashed
+// straight from the reader's mapping on all cores, so nothing is extracted.
+class PK2Manifest
+{
+private:
+	std::vector<PK2ManifestEntry> m_entries;
+	uint32_t m_flags;
+	std::stringstream m_error;
+
+private:
+	PK2Manifest & operator = (const PK2Manifest & rhs);
+	PK2Manifest(const PK2Manifest & rhs);
+
+public:
+	PK2Manifest();
+	~PK2Manifest();
+
+	// Returns the error if a function returns false.
+	std::string GetError();
+
+	// Hashes every file in an opened PK2. 'flags' is a combination of
+	// PK2ManifestFlags and 'threads' of 0 uses one thread per core. Fails, naming
+	// the path, if the data of any entry lies outside the file.
+	bool Build(PK2Reader & reader, uint32_t flags = 0, uint32_t threads = 0);
+
+	// Returns the entries sorted by path.
+	const std::vector<PK2ManifestEntry> & GetEntries();
+
+	// Returns the PK2ManifestFlags the manifest was built or loaded with.
+	uint32_t GetFlags();
+
+	// Saves/loads the compact binary form.
+	bool WriteBinary(const std::string & filename);
+	bool ReadBinary(const std::string & filename);
+
+	// Saves the manifest as JSON.
+	bool WriteJson(const std::string & filename);
+};
+
+//-----------------------------------------------------------------------------
+
+#endif
@@ -0,0 +1,638 @@
+#include "PK2Patch.h"
+#include "PK2Reader.h"
+#include "PK2Writer.h"
+#include "parallel_for.h"
+#include <string.h>
+#include <algorithm>
+#include <fstream>
+#include <map>
+
+#include <boost/date_time/posix_time/posix_time_types.hpp>
+
+#define XXH_INLINE_ALL
+#include <xxhash.h>
+
+//-----------------------------------------------------------------------------
+
+// Binary layout: "PK2P", version, record count, then per record the path length
+// (uint16), path, kind (uint8), size (uint32), XXH3 (uint64), for deltas the
+// base size (uint32) and base XXH3 (uint64), then the data length (uint32) and
+// the data. Delta data is a list of operations: 'C', offset (uint32), length
+// (uint32) copies from the old content; 'A', length (uint32), bytes adds new ones.
+const char patch_magic[4] = { 'P', 'K', '2', 'P' };
+const uint32_t patch_version = 1;
+
+// Matches shorter than this are not worth a copy operation.
+const uint32_t delta_block_size = 16;
+
+const uint8_t delta_copy = 'C';
+const uint8_t delta_add = 'A';
+
+//-----------------------------------------------------------------------------
+
+static bool PatchRecordLess(const PK2PatchRecord & a, const PK2PatchRecord & b)
+{
+	return a.path < b.path;
+}
+
+//-----------------------------------------------------------------------------
+
+static void AppendDeltaValue(std::vector<uint8_t> & ops, uint32_t value)
+{
+	const uint8_t * bytes = reinterpret_cast<const uint8_t *>(&value);
+	ops.insert(ops.end(), bytes, bytes + 4);
+}
+
+static void AppendDeltaAdd(std::vector<uint8_t> & ops, const uint8_t * data, uint32_t length)
+{
+	if(length)
+	{
+		ops.push_back(delta_add);
+		AppendDeltaValue(ops, length);
+		ops.insert(ops.end(), data, data + length);
+	}
+}
+
+static void AppendDeltaCopy(std::vector<uint8_t> & ops, uint32_t offset, uint32_t length)
+{
+	ops.push_back(delta_copy);
+	AppendDeltaValue(ops, offset);
+	AppendDeltaValue(ops, length);
+}
+
+//-----------------------------------------------------------------------------
+
+// Finds runs of 'data' that are in 'old_data'. The old content is indexed by
+// the hash of every aligned block, the new content is searched at every byte
+// and each hit is grown in both directions as far as the bytes agree.
+static void EncodeDelta(const uint8_t * old_data, uint32_t old_size, const uint8_t * data, uint32_t size, std::vector<uint8_t> & ops)
+{
+	const uint32_t empty = 0xFFFFFFFF;
+
+	size_t table_size = 1;
+	while(table_size < (old_size / delta_block_size) * 2)
+	{
+		table_size <<= 1;
+	}
+	std::vector<uint32_t> table(table_size, empty);
+	size_t mask = table_size - 1;
+
+	for(uint32_t x = 0; x + delta_block_size <= old_size; x += delta_block_size)
+	{
+		uint32_t & slot = table[(size_t)XXH3_64bits(old_data + x, delta_block_size) & mask];
+		if(slot == empty)
+		{
+			slot = x;
+		}
+	}
+
+	uint32_t add_start = 0;
+	uint32_t pos = 0;
+	while(pos + delta_block_size <= size)
+	{
+		uint32_t source = table[(size_t)XXH3_64bits(data + pos, delta_block_size) & mask];
+		if(source == empty || memcmp(old_data + source, data + pos, delta_block_size) != 0)
+		{
+			++pos;
+			continue;
+		}
+
+		uint32_t begin = pos;
+		while(begin > add_start && source > 0 && old_data[source - 1] == data[begin - 1])
+		{
+			--begin;
+			--source;
+		}
+
+		uint32_t end = pos + delta_block_size;
+		uint32_t source_end = source + (end - begin);
+		while(end < size && source_end < old_size && old_data[source_end] == data[end])
+		{
+			++end;
+			++source_end;
+		}
+
+		AppendDeltaAdd(ops, data + add_start, begin - add_start);
+		AppendDeltaCopy(ops, source, end - begin);
+		pos = add_start = end;
+	}
+
+	AppendDeltaAdd(ops, data + add_start, size - add_start);
+}
+
+//-----------------------------------------------------------------------------
+
+// Rebuilds the new content from the old one. The operations are checked before
+// anything is allocated, so a damaged patch fails instead of reading outside the
+// mapping or reserving a size it cannot fill.
+static bool DecodeDelta(const uint8_t * old_data, uint32_t old_size, const std::vector<uint8_t> & ops, uint32_t size, std::vector<uint8_t> & output)
+{
+	for(int pass = 0; pass < 2; ++pass)
+	{
+		if(pass == 1)
+		{
+			output.resize(size);
+		}
+
+		size_t x = 0;
+		uint64_t written = 0;
+		while(x < ops.size())
+		{
+			uint8_t op = ops[x++];
+			uint32_t offset = 0;
+			uint32_t length = 0;
+
+			if(op == delta_copy)
+			{
+				if(ops.size() - x < 8)
+				{
+					return false;
+				}
+				memcpy(&offset, &ops[x], 4);
+				memcpy(&length, &ops[x + 4], 4);
+				x += 8;
+
+				if((uint64_t)offset + length > old_size || written + length > size)
+				{
+					return false;
+				}
+				if(pass == 1 && length)
+				{
+					memcpy(&output[(size_t)written], old_data + offset, length);
+				}
+			}
+			else if(op == delta_add)
+			{
+				if(ops.size() - x < 4)
+				{
+					return false;
+				}
+				memcpy(&length, &ops[x], 4);
+				x += 4;
+
+				if(ops.size() - x < length || written + length > size)
+				{
+					return false;
+				}
+				if(pass == 1 && length)
+				{
+					memcpy(&output[(size_t)written], &ops[x], length);
+				}
+				x += length;
+			}
+			else
+			{
+				return false;
+			}
+
+			written += length;
+		}
+
+		if(written != size)
+		{
+			return false;
+		}
+	}
+
+	return true;
+}
+
+//-----------------------------------------------------------------------------
+
+// Rebuilds one record's content on a worker thread. Only reads the mapping.
+// Full records are only checked; their content is staged from the record itself.
+struct PK2Patch::BuildRecord
+{
+	PK2Reader & reader;
+	const std::vector<PK2PatchRecord> & records;
+	std::vector<PK2Entry> & bases;
+	std::vector< std::vector<uint8_t> > & outputs;
+	std::vector<uint8_t> & failed; // 1 base mismatch, 2 damaged delta, 3 wrong result, 4 base outside the PK2
+
+	BuildRecord(PK2Reader & reader_, const std::vector<PK2PatchRecord> & records_, std::vector<PK2Entry> & bases_, std::vector< std::vector<uint8_t> > & outputs_, std::vector<uint8_t> & failed_) : reader(reader_), records(records_), bases(bases_), outputs(outputs_), failed(failed_)
+	{
+	}
+
+	void operator()(size_t x)
+	{
+		const PK2PatchRecord & record = records[x];
+		std::vector<uint8_t> & output = outputs[x];
+
+		if(record.kind == Patch_Full)
+		{
+			if(XXH3_64bits(record.data.empty() ? 0 : &record.data[0], record.data.size()) != record.xxh3)
+			{
+				failed[x] = 3;
+			}
+			return;
+		}
+
+		PK2Entry & base = bases[x];
+		const uint8_t * old_data = reinterpret_cast<const uint8_t *>(reader.Extract(base));
+		if(old_data == 0)
+		{
+			failed[x] = 4;
+			return;
+		}
+		if(base.size != record.base_size || XXH3_64bits(old_data, base.size) != record.base_xxh3)
+		{
+			failed[x] = 1;
+			return;
+		}
+		if(!DecodeDelta(old_data, base.size, record.data, record.size, output))
+		{
+			failed[x] = 2;
+			return;
+		}
+
+		if(XXH3_64bits(output.empty() ? 0 : &output[0], output.size()) != record.xxh3)
+		{
+			failed[x] = 3;
+		}
+	}
+
+private:
+	BuildRecord & operator = (const BuildRecord & rhs);
+};
+
+//-----------------------------------------------------------------------------
+
+PK2Patch::PK2Patch()
+{
+	memset(&m_stats, 0, sizeof(PK2PatchStats));
+}
+
+//-----------------------------------------------------------------------------
+
+PK2Patch::~PK2Patch()
+{
+}
+
+//-----------------------------------------------------------------------------
+
+std::string PK2Patch::GetError()
+{
+	std::string e = m_error.str();
+	m_error.str("");
+	return e;
+}
+
+//-----------------------------------------------------------------------------
+
+void PK2Patch::Clear()
+{
+	m_records.clear();
+}
+
+//-----------------------------------------------------------------------------
+
+const std::vector<PK2PatchRecord> & PK2Patch::GetRecords()
+{
+	return m_records;
+}
+
+//-----------------------------------------------------------------------------
+
+PK2PatchStats PK2Patch::GetStats()
+{
+	return m_stats;
+}
+
+//-----------------------------------------------------------------------------
+
+PK2PatchRecord & PK2Patch::AddRecord(const std::string & path)
+{
+	PK2PatchRecord record;
+	record.path = path;
+	std::replace(record.path.begin(), record.path.end(), '/', '\\');
+	std::transform(record.path.begin(), record.path.end(), record.path.begin(), tolower);
+	record.kind = Patch_Full;
+	record.size = 0;
+	record.xxh3 = 0;
+	record.base_size = 0;
+	record.base_xxh3 = 0;
+
+	std::vector<PK2PatchRecord>::iterator itr = std::lower_bound(m_records.begin(), m_records.end(), record, PatchRecordLess);
+	if(itr != m_records.end() && itr->path == record.path)
+	{
+		*itr = record;
+		return *itr;
+	}
+	return *m_records.insert(itr, record);
+}
+
+//-----------------------------------------------------------------------------
+
+bool PK2Patch::AddFull(const std::string & path, const void * data, uint32_t size)
+{
+	if(path.empty())
+	{
+		m_error.str(""); m_error << "Invalid entry name.";
+		return false;
+	}
+
+	const uint8_t * bytes = reinterpret_cast<const uint8_t *>(data);
+
+	PK2PatchRecord & record = AddRecord(path);
+	record.kind = Patch_Full;
+	record.size = size;
+	record.xxh3 = XXH3_64bits(data, size);
+	record.data.assign(bytes, bytes + size);
+
+	return true;
+}
+
+//-----------------------------------------------------------------------------
+
+bool PK2Patch::AddDelta(const std::string & path, const void * old_data, uint32_t old_size, const void * data, uint32_t size)
+{
+	if(path.empty())
+	{
+		m_error.str(""); m_error << "Invalid entry name.";
+		return false;
+	}
+
+	std::vector<uint8_t> ops;
+	EncodeDelta(reinterpret_cast<const uint8_t *>(old_data), old_size, reinterpret_cast<const uint8_t *>(data), size, ops);
+	if(ops.size() >= size)
+	{
+		return AddFull(path, data, size);
+	}
+
+	PK2PatchRecord & record = AddRecord(path);
+	record.kind = Patch_Delta;
+	record.size = size;
+	record.xxh3 = XXH3_64bits(data, size);
+	record.base_size = old_size;
+	record.base_xxh3 = XXH3_64bits(old_data, old_size);
+	record.data.swap(ops);
+
+	return true;
+}
+
+//-----------------------------------------------------------------------------
+
+bool PK2Patch::WriteBinary(const std::string & filename)
+{
+	std::ofstream out(filename.c_str(), std::ios::out | std::ios::binary | std::ios::trunc);
+	if(!out)
+	{
+		m_error.str(""); m_error << "Could not open the file \"" << filename << "\".";
+		return false;
+	}
+
+	uint32_t count = (uint32_t)m_records.size();
+
+	out.write(patch_magic, 4);
+	out.write((const char *)&patch_version, 4);
+	out.write((const char *)&count, 4);
+
+	for(size_t x = 0; x < m_records.size(); ++x)
+	{
+		const PK2PatchRecord & r = m_records[x];
+		uint16_t length = (uint16_t)r.path.size();
+		uint32_t data_length = (uint32_t)r.data.size();
+
+		out.write((const char *)&length, 2);
+		out.write(r.path.c_str(), length);
+		out.write((const char *)&r.kind, 1);
+		out.write((const char *)&r.size, 4);
+		out.write((const char *)&r.xxh3, 8);
+		if(r.kind == Patch_Delta)
+		{
+			out.write((const char *)&r.base_size, 4);
+			out.write((const char *)&r.base_xxh3, 8);
+		}
+		out.write((const char *)&data_length, 4);
+		if(data_length)
+		{
+			out.write((const char *)&r.data[0], data_length);
+		}
+	}
+
+	if(!out)
+	{
+		m_error.str(""); m_error << "Could not write to the file \"" << filename << "\".";
+		return false;
+	}
+
+	return true;
+}
+
+//-----------------------------------------------------------------------------
+
+bool PK2Patch::ReadBinary(const std::string & filename)
+{
+	std::ifstream in(filename.c_str(), std::ios::in | std::ios::binary);
+	if(!in)
+	{
+		m_error.str(""); m_error << "Could not open the file \"" << filename << "\".";
+		return false;
+	}
+
+	char magic[4] = {0};
+	uint32_t version = 0;
+	uint32_t count = 0;
+
+	in.read(magic, 4);
+	in.read((char *)&version, 4);
+	in.read((char *)&count, 4);
+
+	if(!in || memcmp(magic, patch_magic, 4) != 0 || version != patch_version)
+	{
+		m_error.str(""); m_error << "\"" << filename << "\" is not a PK2 patch.";
+		return false;
+	}
+
+	in.seekg(0, std::ios::end);
+	uint64_t file_size = (uint64_t)in.tellg();
+	in.seekg(12, std::ios::beg);
+
+	std::vector<PK2PatchRecord> records;
+
+	for(uint32_t x = 0; x < count && in; ++x)
+	{
+		records.push_back(PK2PatchRecord());
+		PK2PatchRecord & r = records.back();
+		uint16_t length = 0;
+		uint32_t data_length = 0;
+
+		r.kind = Patch_Full;
+		r.size = 0;
+		r.xxh3 = 0;
+		r.base_size = 0;
+		r.base_xxh3 = 0;
+
+		in.read((char *)&length, 2);
+		r.path.resize(length);
+		if(length)
+		{
+			in.read(&r.path[0], length);
+		}
+		in.read((char *)&r.kind, 1);
+		in.read((char *)&r.size, 4);
+		in.read((char *)&r.xxh3, 8);
+		if(r.kind == Patch_Delta)
+		{
+			in.read((char *)&r.base_size, 4);
+			in.read((char *)&r.base_xxh3, 8);
+		}
+		in.read((char *)&data_length, 4);
+
+		// Paths are matched against the index, so store them the way AddRecord does
+		std::replace(r.path.begin(), r.path.end(), '/', '\\');
+		std::transform(r.path.begin(), r.path.end(), r.path.begin(), tolower);
+
+		// A delta can only produce as much as its operations describe: each copy
+		// (9 bytes) brings at most the whole base, each added byte one byte
+		uint64_t size_limit = data_length;
+		if(r.kind == Patch_Delta)
+		{
+			size_limit += (uint64_t)(data_length / 9) * r.base_size;
+		}
+
+		if(!in || (r.kind != Patch_Full && r.kind != Patch_Delta) || (r.kind == Patch_Full && data_length != r.size) || data_length > file_size || r.size > size_limit)
+		{
+			m_error.str(""); m_error << "\"" << filename << "\" is damaged.";
+			return false;
+		}
+
+		r.data.resize(data_length);
+		if(data_length)
+		{
+			in.read((char *)&r.data[0], data_length);
+		}
+	}
+
+	if(!in)
+	{
+		m_error.str(""); m_error << "\"" << filename << "\" is truncated.";
+		return false;
+	}
+
+	std::sort(records.begin(), records.end(), PatchRecordLess);
+	for(size_t x = 1; x < records.size(); ++x)
+	{
+		if(records[x - 1].path == records[x].path)
+		{
+			m_error.str(""); m_error << "\"" << filename << "\" has more than one record for \"" << records[x].path << "\".";
+			return false;
+		}
+	}
+	m_records.swap(records);
+
+	return true;
+}
+
+//-----------------------------------------------------------------------------
+
+bool PK2Patch::Apply(PK2Reader & reader, PK2Writer & writer, uint32_t threads)
+{
+	boost::posix_time::ptime start = boost::posix_time::microsec_clock::universal_time();
+	memset(&m_stats, 0, sizeof(PK2PatchStats));
+
+	// Every target is resolved through one index instead of a walk per path
+	std::map<std::string, PK2Entry> index;
+	if(!reader.BuildIndex(index))
+	{
+		m_error.str(""); m_error << reader.GetError();
+		return false;
+	}
+
+	std::vector<PK2Entry> bases(m_records.size());
+	for(size_t x = 0; x < m_records.size(); ++x)
+	{
+		const PK2PatchRecord & record = m_records[x];
+		memset(&bases[x], 0, sizeof(PK2Entry));
+
+		std::map<std::string, PK2Entry>::iterator itr = index.find(record.path);
+		if(itr != index.end() && itr->second.type != 2)
+		{
+			m_error.str(""); m_error << "The entry \"" << record.path << "\" is a folder.";
+			return false;
+		}
+
+		if(record.kind == Patch_Delta)
+		{
+			if(itr == index.end())
+			{
+				m_error.str(""); m_error << "The entry \"" << record.path << "\" the delta applies to does not exist.";
+				return false;
+			}
+			bases[x] = itr->second;
+			++m_stats.delta;
+		}
+		else
+		{
+			if(record.data.size() != record.size)
+			{
+				m_error.str(""); m_error << "The content of \"" << record.path << "\" was handed to the writer by an earlier Apply; load the patch again.";
+				return false;
+			}
+			++m_stats.full;
+		}
+
+		m_stats.patch_bytes += record.data.size();
+		m_stats.output_bytes += record.size;
+	}
+
+	std::vector< std::vector<uint8_t> > outputs(m_records.size());
+	std::vector<uint8_t> failed(m_records.size(), 0);
+
+	BuildRecord build(reader, m_records, bases, outputs, failed);
+	parallel_for(m_records.size(), build, threads);
+
+	for(size_t x = 0; x < m_records.size(); ++x)
+	{
+		if(failed[x] == 4)
+		{
+			m_error.str(""); m_error << "The data of the entry \"" << m_records[x].path << "\" is not inside the PK2.";
+			return false;
+		}
+		if(failed[x] == 1)
+		{
+			m_error.str(""); m_error << "The entry \"" << m_records[x].path << "\" is not the version the delta was made from.";
+			return false;
+		}
+		if(failed[x])
+		{
+			m_error.str(""); m_error << "The patch record for \"" << m_records[x].path << "\" is damaged.";
+			return false;
+		}
+	}
+
+	boost::posix_time::ptime built = boost::posix_time::microsec_clock::universal_time();
+	m_stats.build_ms = (built - start).total_microseconds() / 1000.0;
+
+	// One transaction, so the data is written in offset order by a single Commit
+	if(!writer.BeginTransaction())
+	{
+		m_error.str(""); m_error << writer.GetError();
+		return false;
+	}
+
+	for(size_t x = 0; x < m_records.size(); ++x)
+	{
+		// StageFile takes the vector's content, so full records are handed over
+		// rather than copied
+		std::vector<uint8_t> & content = m_records[x].kind == Patch_Full ? m_records[x].data : outputs[x];
+		if(!writer.StageFile(m_records[x].path.c_str(), content))
+		{
+			m_error.str(""); m_error << writer.GetError();
+			writer.Rollback();
+			return false;
+		}
+	}
+
+	if(!writer.Commit())
+	{
+		m_error.str(""); m_error << writer.GetError();
+		return false;
+	}
+
+	m_stats.commit_ms = (boost::posix_time::microsec_clock::universal_time() - built).total_microseconds() / 1000.0;
+
+	return true;
+}
+
+//-----------------------------------------------------------------------------
@@ -0,0 +1,108 @@
+#pragma once
+
+#ifndef PK2PATCH_H_
+#define PK2PATCH_H_
+
+//-----------------------------------------------------------------------------
+
+#include <stdint.h>
+#include <vector>
+#include <sstream>
+#include <string>
+
+//-----------------------------------------------------------------------------
+
+class PK2Reader;
+class PK2Writer;
+
+enum PK2PatchKind
+{
+	Patch_Full = 0,	// 'data' is the new content
+	Patch_Delta = 1	// 'data' is a list of copy/add operations against the current content
+};
+
+struct PK2PatchRecord
+{
+	std::string path; // lower case, backslash separated
+	uint8_t kind; // PK2PatchKind
+	uint32_t size; // size of the new content
+	uint64_t xxh3; // XXH3 64 bit hash of the new content
+	uint32_t base_size; // deltas only, size of the content they apply to
+	uint64_t base_xxh3; // deltas only, XXH3 of the content they apply to
+	std::vector<uint8_t> data;
+};
+
+// Sizes from the last Apply.
+struct PK2PatchStats
+{
+	uint32_t full; // records applied from full content
+	uint32_t delta; // records applied from deltas
+	uint64_t patch_bytes; // record data read from the patch
+	uint64_t output_bytes; // file data written to the PK2
+	double build_ms; // resolving targets and rebuilding content
+	double commit_ms; // writing through PK2Writer
+};
+
+//-----------------------------------------------------------------------------
+
+// A set of file updates for a PK2. Each target is either shipped whole or as a
+// binary delta against the entry it replaces: "copy n bytes from offset o of
+// the old content" and "add these n bytes" operations. Apply resolves every
+// target through one index of the archive, rebuilds the new content straight
+// from the reader's mapping on all cores and stages it all in one PK2Writer
+// transaction, so the data goes to the archive in offset order in one Commit.
+class PK2Patch
+{
+private:
+	std::vector<PK2PatchRecord> m_records;
+	PK2PatchStats m_stats;
+	std::stringstream m_error;
+
+private:
+	struct BuildRecord;
+
+	PK2Patch & operator = (const PK2Patch & rhs);
+	PK2Patch(const PK2Patch & rhs);
+	PK2PatchRecord & AddRecord(const std::string & path);
+
+public:
+	PK2Patch();
+	~PK2Patch();
+
+	// Returns the error if a function returns false.
+	std::string GetError();
+
+	// Drops every record.
+	void Clear();
+
+	// Adds 'path' with the whole new content. Adding a path again replaces it.
+	bool AddFull(const std::string & path, const void * data, uint32_t size);
+
+	// Adds 'path' as a delta from 'old_data' to 'data'. If the delta would not be
+	// smaller than the new content, the content is stored whole instead.
+	bool AddDelta(const std::string & path, const void * old_data, uint32_t old_size, const void * data, uint32_t size);
+
+	// Returns the records sorted by path.
+	const std::vector<PK2PatchRecord> & GetRecords();
+
+	// Saves/loads the binary form.
+	bool WriteBinary(const std::string & filename);
+	bool ReadBinary(const std::string & filename);
+
+	// Applies the patch to the PK2 open in both 'reader' and 'writer'. A delta
+	// whose current content is not the one it was made from fails the whole
+	// patch, as does a missing folder; nothing is written unless every record
+	// could be rebuilt. 'writer' must not have a transaction open. 'reader' is
+	// stale afterwards unless it was attached with PK2Writer::AttachReader.
+	// The content of full records is moved into the writer instead of copied,
+	// so once the records are staged their data is empty; load the patch again
+	// to apply it a second time. 'threads' of 0 uses one thread per core.
+	bool Apply(PK2Reader & reader, PK2Writer & writer, uint32_t threads = 0);
+
+	// Returns the sizes of the last Apply.
+	PK2PatchStats GetStats();
+};
+
+//-----------------------------------------------------------------------------
+
+#endif
@@ -2,6 +2,35 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <algorithm>
+#include <fstream>
+#include <set>
+#include "parallel_for.h"
+
+#ifdef _WIN32
+	#include <windows.h>
+#else
+	#include <sys/mman.h>
+	#include <fcntl.h>
+	#include <unistd.h>
+#endif
+
+//-----------------------------------------------------------------------------
+
+// Platform neutral versions of the madvise flags used by PK2Reader::Advise
+enum
+{
+	Advice_Normal,
+	Advice_Sequential,
+	Advice_Random,
+	Advice_WillNeed,
+	Advice_DontNeed,
+	Advice_HugePage
+};
+
+// Open_LazyDecrypt keeps one bit per 8 bytes of file. A chunk of the bitmap covers
+// 512KB of file and is only allocated once a block inside it is decrypted.
+const int lazy_chunk_shift = 16;
+const uint32_t lazy_chunk_words = (1 << lazy_chunk_shift) / 32;
 
 //-----------------------------------------------------------------------------
 
@@ -15,6 +44,17 @@ int64_t file_tell(boost::iostreams::mapped_file & file, const char* offset)
 	return offset - file.const_data();
 }
 
+uint64_t SystemPageSize()
+{
+#ifdef _WIN32
+	SYSTEM_INFO info;
+	GetSystemInfo(&info);
+	return info.dwPageSize;
+#else
+	return (uint64_t)sysconf(_SC_PAGESIZE);
+#endif
+}
+
 int MakePathSlashWindows_1(int ch)
 {
 	return ch == '/' ? '\\' : ch;
@@ -52,9 +92,457 @@ void PK2Reader::Cache(std::string & base_name, PK2Entry & e)
 
 //-----------------------------------------------------------------------------
 
+bool PK2Reader::Advise(int64_t offset, uint64_t length, int advice)
+{
+	if(!file.is_open())
+	{
+		m_error.str(""); m_error << "There is no PK2 loaded yet.";
+		return false;
+	}
+
+	if(offset < 0 || (uint64_t)offset > file.size())
+	{
+		m_error.str(""); m_error << "Invalid seek index.";
+		return false;
+	}
+
+	if(length > file.size() - offset)
+	{
+		length = file.size() - offset;
+	}
+
+	if(length == 0)
+	{
+		return true;
+	}
+
+#ifdef _WIN32
+	// Windows has no readahead hints for views. Unlocking pages that were never
+	// locked removes them from the working set, which is the closest to DONTNEED.
+	if(advice == Advice_DontNeed)
+	{
+		VirtualUnlock((LPVOID)file_seek(file, offset), (SIZE_T)length);
+	}
+	return true;
+#else
+	// madvise works on whole pages
+	static const int64_t page_size = (int64_t)SystemPageSize();
+	int64_t start = offset & ~(page_size - 1);
+	length += offset - start;
+
+	int madv = MADV_NORMAL;
+	switch(advice)
+	{
+		case Advice_Sequential: madv = MADV_SEQUENTIAL; break;
+		case Advice_Random: madv = MADV_RANDOM; break;
+		case Advice_WillNeed: madv = MADV_WILLNEED; break;
+		case Advice_DontNeed: madv = MADV_DONTNEED; break;
+#ifdef MADV_HUGEPAGE
+		case Advice_HugePage: madv = MADV_HUGEPAGE; break;
+#else
+		case Advice_HugePage: return true;
+#endif
+	}
+
+	if(advice == Advice_DontNeed && m_lazy_decrypt)
+	{
+		// Dropping a private page throws away the copy that was decrypted in place
+		// and the file's ciphertext comes back, so pages holding any decrypted
+		// block are kept. The lock stops a block being decrypted in the meantime.
+		boost::mutex::scoped_lock lock(m_lazy_mutex);
+
+		int64_t end = start + (int64_t)length;
+		int64_t run = start;
+		for(int64_t page = start; page < end; page += page_size)
+		{
+			if(!AnyDecrypted(page, page + page_size))
+			{
+				continue;
+			}
+			if(page > run && madvise((void *)file_seek(file, run), (size_t)(page - run), madv) != 0)
+			{
+				m_error.str(""); m_error << "madvise failed.";
+				return false;
+			}
+			run = page + page_size;
+		}
+		if(end > run && madvise((void *)file_seek(file, run), (size_t)(end - run), madv) != 0)
+		{
+			m_error.str(""); m_error << "madvise failed.";
+			return false;
+		}
+	}
+	else if(madvise((void *)file_seek(file, start), (size_t)length, madv) != 0)
+	{
+		m_error.str(""); m_error << "madvise failed.";
+		return false;
+	}
+
+	// Dropping our mapping alone leaves the pages in the page cache, so tell the
+	// kernel we will not need them again either.
+	if(advice == Advice_DontNeed && m_fd >= 0)
+	{
+		posix_fadvise(m_fd, start, length, POSIX_FADV_DONTNEED);
+	}
+
+	return true;
+#endif
+}
+
+//-----------------------------------------------------------------------------
+
+// Copies the directory block at 'offset' out of the mapping and decodes all 20
+// entries at once. With Open_LazyDecrypt the mapping itself is decrypted the first
+// time so later reads are a plain copy. Returns false if the block is not inside
+// the file. Does not touch m_error so it is safe to call from several threads.
+bool PK2Reader::ReadBlock(int64_t offset, PK2EntryBlock & block)
+{
+	// Blocks already decrypted at Open only need a copy
+	if(!m_directory_image.empty())
+	{
+		std::vector<int64_t>::const_iterator itr = std::lower_bound(m_directory_blocks.begin(), m_directory_blocks.end(), offset);
+		if(itr != m_directory_blocks.end() && *itr == offset)
+		{
+			memcpy(&block, &m_directory_image[itr - m_directory_blocks.begin()], sizeof(PK2EntryBlock));
+			return true;
+		}
+	}
+
+	if(offset < m_root_offset || (uint64_t)offset + sizeof(PK2EntryBlock) > file.size())
+	{
+		return false;
+	}
+
+	if(m_lazy_decrypt)
+	{
+		boost::mutex::scoped_lock lock(m_lazy_mutex);
+
+		char * data = file.data() + offset;
+
+		if(TestAndSetDecrypted(offset, false))
+		{
+			memcpy(&block, data, sizeof(PK2EntryBlock));
+			return true;
+		}
+
+		m_blowfish.DecodeBlocks(data, data, sizeof(PK2EntryBlock) / 8);
+		memcpy(&block, data, sizeof(PK2EntryBlock));
+
+		// A bad seek could land in the middle of a real block. Only keep blocks that
+		// look valid decrypted, and put anything else back the way it was.
+		for(int x = 0; x < 20; ++x)
+		{
+			if(block.entries[x].padding[0] != 0 || block.entries[x].padding[1] != 0)
+			{
+				m_blowfish.EncodeBlocks(data, data, sizeof(PK2EntryBlock) / 8);
+				return true;
+			}
+		}
+
+		TestAndSetDecrypted(offset, true);
+		return true;
+	}
+
+	memcpy(&block, file_seek(file, offset), sizeof(PK2EntryBlock));
+
+	if(m_header.encryption)
+	{
+		m_blowfish.DecodeBlocks(&block, &block, sizeof(PK2EntryBlock) / 8);
+	}
+
+	return true;
+}
+
+//-----------------------------------------------------------------------------
+
+// Returns whether the block at 'offset' was already decrypted in place, marking
+// it if 'set' is true. Blocks never share an 8 byte unit so the unit holding the
+// first byte identifies the block. Must be called with m_lazy_mutex held.
+bool PK2Reader::TestAndSetDecrypted(int64_t offset, bool set)
+{
+	uint64_t unit = (uint64_t)offset >> 3;
+	std::vector<uint32_t> & chunk = m_decrypted[(size_t)(unit >> lazy_chunk_shift)];
+	uint32_t index = (uint32_t)(unit & ((1 << lazy_chunk_shift) - 1));
+
+	if(chunk.empty())
+	{
+		if(!set)
+		{
+			return false;
+		}
+		chunk.resize(lazy_chunk_words, 0);
+	}
+
+	bool was_set = (chunk[index >> 5] & (1u << (index & 31))) != 0;
+	if(set)
+	{
+		chunk[index >> 5] |= 1u << (index & 31);
+	}
+	return was_set;
+}
+
+//-----------------------------------------------------------------------------
+
+// Returns whether any block decrypted in place overlaps [begin, end). Must be
+// called with m_lazy_mutex held.
+bool PK2Reader::AnyDecrypted(int64_t begin, int64_t end)
+{
+	// A block starting less than one block before 'begin' still reaches into it
+	begin -= (int64_t)sizeof(PK2EntryBlock) - 1;
+	uint64_t unit = begin > 0 ? (uint64_t)begin >> 3 : 0;
+	uint64_t last = (uint64_t)(end - 1) >> 3;
+
+	while(unit <= last)
+	{
+		size_t chunk_index = (size_t)(unit >> lazy_chunk_shift);
+		if(chunk_index >= m_decrypted.size())
+		{
+			break;
+		}
+
+		const std::vector<uint32_t> & chunk = m_decrypted[chunk_index];
+		if(chunk.empty())
+		{
+			unit = (uint64_t)(chunk_index + 1) << lazy_chunk_shift;
+			continue;
+		}
+
+		uint32_t index = (uint32_t)(unit & ((1 << lazy_chunk_shift) - 1));
+		uint32_t word = chunk[index >> 5] >> (index & 31);
+		if(word == 0)
+		{
+			unit += 32 - (index & 31);
+			continue;
+		}
+		if(word & 1)
+		{
+			return true;
+		}
+		++unit;
+	}
+
+	return false;
+}
+
+//-----------------------------------------------------------------------------
+
+// Decodes one directory block and returns where the walk has to go next: child
+// folders and the next block in the chain. The decoded block is left in 'block'.
+// Safe to call from several threads.
+bool PK2Reader::ScanDirectoryBlock(int64_t offset, std::vector<int64_t> & children, PK2EntryBlock & block)
+{
+	if(!ReadBlock(offset, block))
+	{
+		return false;
+	}
+
+	for(int x = 0; x < 20; ++x)
+	{
+		PK2Entry & e = block.entries[x];
+
+		if(e.padding[0] != 0 || e.padding[1] != 0)
+		{
+			return false;
+		}
+
+		if(e.type == 1 && !(e.name[0] == '.' && (e.name[1] == 0 || (e.name[1] == '.' && e.name[2] == 0))))
+		{
+			children.push_back(e.position);
+		}
+	}
+
+	if(block.entries[19].nextChain)
+	{
+		children.push_back(block.entries[19].nextChain);
+	}
+
+	return true;
+}
+
+//-----------------------------------------------------------------------------
+
+struct PK2Reader::DirectoryScan
+{
+	PK2Reader * reader;
+	const std::vector<int64_t> & level;
+	std::vector< std::vector<int64_t> > children;
+	std::vector<PK2EntryBlock> blocks;
+	std::vector<uint8_t> failed; // One flag per block so workers never share a write
+
+	DirectoryScan(PK2Reader * reader_, const std::vector<int64_t> & level_) : reader(reader_), level(level_), children(level_.size()), blocks(level_.size()), failed(level_.size(), 0)
+	{
+	}
+
+	void operator()(size_t x)
+	{
+		if(!reader->ScanDirectoryBlock(level[x], children[x], blocks[x]))
+		{
+			failed[x] = 1;
+		}
+	}
+
+	bool Failed() const
+	{
+		return std::find(failed.begin(), failed.end(), 1) != failed.end();
+	}
+
+private:
+	DirectoryScan & operator = (const DirectoryScan & rhs);
+};
+
+// Walks the directory tree one level at a time. Every block of a level is
+// prefetched and decoded in parallel so the reads overlap instead of faulting
+// in one page after another. With 'keep_image' the decoded blocks are kept in
+// m_directory_image so later reads skip the cipher.
+bool PK2Reader::LocateDirectoryBlocks(bool prefetch, bool keep_image)
+{
+	m_directory_blocks.clear();
+	m_directory_image.clear();
+
+	std::vector<PK2EntryBlock> image;
+	std::set<int64_t> visited;
+	std::vector<int64_t> level(1, m_root_offset);
+	visited.insert(m_root_offset);
+
+	while(!level.empty())
+	{
+		if(prefetch)
+		{
+			for(size_t x = 0; x < level.size(); ++x)
+			{
+				Advise(level[x], sizeof(PK2EntryBlock), Advice_WillNeed);
+			}
+		}
+
+		DirectoryScan scan(this, level);
+		parallel_for(level.size(), scan);
+
+		if(scan.Failed())
+		{
+			m_directory_blocks.clear();
+			m_error.str(""); m_error << "Invalid directory block. User seek error.";
+			return false;
+		}
+
+		m_directory_blocks.insert(m_directory_blocks.end(), level.begin(), level.end());
+		if(keep_image)
+		{
+			image.insert(image.end(), scan.blocks.begin(), scan.blocks.end());
+		}
+
+		std::vector<int64_t> next;
+		for(size_t x = 0; x < scan.children.size(); ++x)
+		{
+			std::vector<int64_t> & children = scan.children[x];
+			for(size_t y = 0; y < children.size(); ++y)
+			{
+				if(visited.insert(children[y]).second)
+				{
+					next.push_back(children[y]);
+				}
+			}
+		}
+		level.swap(next);
+	}
+
+	if(keep_image)
+	{
+		// Sort the offsets and carry each block along to its new position
+		std::vector< std::pair<int64_t, size_t> > order(m_directory_blocks.size());
+		for(size_t x = 0; x < order.size(); ++x)
+		{
+			order[x] = std::make_pair(m_directory_blocks[x], x);
+		}
+		std::sort(order.begin(), order.end());
+
+		m_directory_image.resize(image.size());
+		for(size_t x = 0; x < order.size(); ++x)
+		{
+			m_directory_blocks[x] = order[x].first;
+			m_directory_image[x] = image[order[x].second];
+		}
+	}
+	else
+	{
+		std::sort(m_directory_blocks.begin(), m_directory_blocks.end());
+	}
+
+	return true;
+}
+
+//-----------------------------------------------------------------------------
+
+// Each chunk reads into its own slot of 'sinks' so no two workers write the
+// same memory.
+struct PageToucher
+{
+	const volatile char * base;
+	uint64_t size;
+	uint64_t chunk;
+	uint64_t page_size;
+	std::vector<char> & sinks;
+
+	PageToucher(std::vector<char> & sinks_) : sinks(sinks_)
+	{
+	}
+
+	void operator()(size_t x)
+	{
+		uint64_t begin = x * chunk;
+		uint64_t end = (size - begin > chunk) ? begin + chunk : size;
+		char sink = 0;
+		for(uint64_t offset = begin; offset < end; offset += page_size)
+		{
+			sink ^= base[offset];
+		}
+		sinks[x] = sink;
+	}
+
+private:
+	PageToucher & operator = (const PageToucher &);
+};
+
+// boost's mapped_file does not expose MAP_POPULATE, so the same effect is had by
+// asking for readahead of the whole file and touching every page on all cores.
+void PK2Reader::Populate()
+{
+	Advise(0, file.size(), Advice_HugePage);
+	Advise(0, file.size(), Advice_WillNeed);
+
+	std::vector<char> sinks;
+	PageToucher toucher(sinks);
+	toucher.base = file.const_data();
+	toucher.size = file.size();
+	toucher.chunk = 4 * 1024 * 1024;
+	toucher.page_size = SystemPageSize();
+
+	sinks.resize((size_t)((toucher.size + toucher.chunk - 1) / toucher.chunk));
+	parallel_for(sinks.size(), toucher);
+}
+
+//-----------------------------------------------------------------------------
+
+void PK2Reader::NoteLookup()
+{
+	if(m_first_lookup_pending)
+	{
+		m_first_lookup_pending = false;
+		m_open_stats.first_lookup_ms = (boost::posix_time::microsec_clock::universal_time() - m_open_time).total_microseconds() / 1000.0;
+	}
+}
+
+//-----------------------------------------------------------------------------
+
 PK2Reader::PK2Reader()
 {
 	m_root_offset = 0;
+	m_access_mode = Access_Normal;
+#ifndef _WIN32
+	m_fd = -1;
+#endif
+	m_first_lookup_pending = false;
+	m_lazy_decrypt = false;
+	memset(&m_open_stats, 0, sizeof(PK2OpenStats));
 	memset(&m_header, 0, sizeof(PK2Header));
 	SetDecryptionKey();
 }
@@ -95,29 +583,145 @@ std::string PK2Reader::GetError()
 
 //-----------------------------------------------------------------------------
 
-void PK2Reader::SetDecryptionKey(char * ascii_key, uint8_t ascii_key_length, char * base_key, uint8_t base_key_length)
+// The Blowfish key is the ascii key xor'ed with the base key. Returns the length.
+uint8_t DeriveBlowfishKey(const char * ascii_key, size_t ascii_key_length, const char * base_key, uint8_t base_key_length, uint8_t bf_key[56])
+{
+	if(ascii_key_length > 56)
+	{
+		ascii_key_length = 56;
+	}
+	if(base_key_length > 56)
+	{
+		base_key_length = 56;
+	}
+
+	uint8_t a_key[56] = { 0x00 };
+	memcpy(a_key, ascii_key, ascii_key_length);
+
+	uint8_t b_key[56] = { 0x00 };
+	memcpy(b_key, base_key, base_key_length);
+
+	memset(bf_key, 0, 56);
+	for(size_t x = 0; x < ascii_key_length; ++x)
+	{
+		bf_key[x] = a_key[x] ^ b_key[x];
+	}
+
+	return (uint8_t)ascii_key_length;
+}
+
+//-----------------------------------------------------------------------------
+
+void PK2Reader::SetDecryptionKey(char * ascii_key, uint8_t ascii_key_length, char * base_key, uint8_t base_key_length)
+{
+	boost::mutex::scoped_lock lock(m);
+
+	uint8_t bf_key[56] = { 0x00 };
+	ascii_key_length = DeriveBlowfishKey(ascii_key, ascii_key_length, base_key, base_key_length, bf_key);
+
+	m_blowfish.Initialize(bf_key, ascii_key_length);
+}
+
+//-----------------------------------------------------------------------------
+
+void PK2Reader::SetDecryption(const Blowfish & blowfish)
+{
+	boost::mutex::scoped_lock lock(m);
+
+	m_blowfish = blowfish;
+}
+
+//-----------------------------------------------------------------------------
+
+// Gets the schedule for each candidate from the shared cache, building the ones
+// not seen before, and checks it against the header's verify bytes.
+struct PK2Reader::KeyCheck
+{
+	const std::vector<std::string> & keys;
+	const uint8_t * verify;
+	std::vector<Blowfish> schedules;
+	std::vector<uint8_t> matched;
+
+	KeyCheck(const std::vector<std::string> & keys_, const uint8_t * verify_) : keys(keys_), verify(verify_), schedules(keys_.size()), matched(keys_.size(), 0)
+	{
+	}
+
+	void operator()(size_t x)
+	{
+		const std::string & key = keys[x];
+		if(key.empty() || !schedules[x].Initialize(key.data(), (uint8_t)key.size()))
+		{
+			return;
+		}
+
+		uint8_t test[16] = {0};
+		schedules[x].Encode("Joymax Pak File", 16, test, 16);
+		matched[x] = memcmp(test, verify, 3) == 0 ? 1 : 0; // PK2s only store 1st 3 bytes
+	}
+
+private:
+	KeyCheck & operator = (const KeyCheck & rhs);
+};
+
+//-----------------------------------------------------------------------------
+
+bool PK2Reader::Open(std::string filename, const std::vector<std::string> & ascii_keys, int & key_index, uint32_t flags, char * base_key, uint8_t base_key_length)
 {
-	boost::mutex::scoped_lock lock(m);
+	key_index = -1;
 
-	if(ascii_key_length > 56)
 	{
-		ascii_key_length = 56;
-	}
+		boost::mutex::scoped_lock lock(m);
 
-	uint8_t bf_key[56] = { 0x00 };
+		if(file.is_open())
+		{
+			m_error.str(""); m_error << "There is already a PK2 opened.";
+			return false;
+		}
 
-	uint8_t a_key[56] = { 0x00 };
-	memcpy(a_key, ascii_key, ascii_key_length);
+		PK2Header header;
+		memset(&header, 0, sizeof(PK2Header));
 
-	uint8_t b_key[56] = { 0x00 };
-	memcpy(b_key, base_key, base_key_length);
+		std::ifstream in(filename.c_str(), std::ios::in | std::ios::binary);
+		if(!in || !in.read(reinterpret_cast<char *>(&header), sizeof(PK2Header)))
+		{
+			m_error.str(""); m_error << "Could not open the file \"" << filename << "\".";
+			return false;
+		}
+		in.close();
 
-	for(int x = 0; x < ascii_key_length; ++x)
-	{
-		bf_key[x] = a_key[x] ^ b_key[x];
+		if(header.encryption)
+		{
+			std::vector<std::string> derived(ascii_keys.size());
+			for(size_t x = 0; x < ascii_keys.size(); ++x)
+			{
+				uint8_t bf_key[56] = { 0x00 };
+				uint8_t length = DeriveBlowfishKey(ascii_keys[x].data(), ascii_keys[x].size(), base_key, base_key_length, bf_key);
+				derived[x].assign(reinterpret_cast<char *>(bf_key), length);
+			}
+
+			KeyCheck check(derived, header.verify);
+			parallel_for(derived.size(), check);
+
+			// Keys keep their order of preference, the first one that matches wins
+			for(size_t x = 0; x < derived.size(); ++x)
+			{
+				if(check.matched[x])
+				{
+					m_blowfish = check.schedules[x];
+					key_index = (int)x;
+					break;
+				}
+			}
+
+			if(key_index == -1)
+			{
+				m_error.str(""); m_error << "Invalid Blowfish key.";
+				return false;
+			}
+		}
 	}
 
-	m_blowfish.Initialize(bf_key, ascii_key_length);
+	return Open(filename, flags);
 }
 
 //-----------------------------------------------------------------------------
@@ -131,7 +735,21 @@ void PK2Reader::Close()
 		file.close();
 	}
 
+#ifndef _WIN32
+	if(m_fd >= 0)
+	{
+		close(m_fd);
+		m_fd = -1;
+	}
+#endif
+
 	m_cache.clear();
+	m_filename.clear();
+	m_directory_blocks.clear();
+	m_directory_image.clear();
+	m_lazy_decrypt = false;
+	m_decrypted.clear();
+	m_first_lookup_pending = false;
 	m_root_offset = 0;
 	m_error.str("");
 	memset(&m_header, 0, sizeof(PK2Header));
@@ -139,7 +757,7 @@ void PK2Reader::Close()
 
 //-----------------------------------------------------------------------------
 
-bool PK2Reader::Open(std::string filename)
+bool PK2Reader::Open(std::string filename, uint32_t flags)
 {
 	boost::mutex::scoped_lock lock(m);
 
@@ -151,6 +769,9 @@ bool PK2Reader::Open(std::string filename)
 		return false;
 	}
 
+	m_open_time = boost::posix_time::microsec_clock::universal_time();
+	memset(&m_open_stats, 0, sizeof(PK2OpenStats));
+
 #if _WIN32
 	while(filename.find("/") != std::string::npos)
 		filename.replace(filename.find("/"), 1, "\\");
@@ -160,7 +781,9 @@ bool PK2Reader::Open(std::string filename)
 	{
 		boost::iostreams::mapped_file_params params;
 		params.path = filename;
-		params.flags = boost::iostreams::mapped_file_base::readonly;
+		// A private mapping lets directory blocks be decrypted in place; the pages
+		// touched become copies owned by this process and the file is never written
+		params.flags = (flags & Open_LazyDecrypt) ? boost::iostreams::mapped_file_base::priv : boost::iostreams::mapped_file_base::readonly;
 		file.open(params);
 	}
 	catch(std::exception & e)
@@ -199,28 +822,104 @@ bool PK2Reader::Open(std::string filename)
 
 	m_root_offset = file_tell(file, file_base);
 
-	if(m_header.encryption == 0)
+	if(m_header.encryption)
 	{
-		return true;
+		uint8_t verify[16] = {0};
+		m_blowfish.Encode("Joymax Pak File", 16, verify, 16);
+		memset(verify + 3, 0, 13); // PK2s only store 1st 3 bytes
+
+		if(memcmp(verify, m_header.verify, 16) != 0)
+		{
+			file.close();
+			file_base = 0;
+			m_error.str(""); m_error << "Invalid Blowfish key.";
+			return false;
+		}
+	}
+
+	m_filename = filename;
+	m_lazy_decrypt = (flags & Open_LazyDecrypt) && m_header.encryption;
+	if(m_lazy_decrypt)
+	{
+		m_decrypted.resize((size_t)((file.size() >> (3 + lazy_chunk_shift)) + 1));
 	}
 
-	uint8_t verify[16] = {0};
-	m_blowfish.Encode("Joymax Pak File", 16, verify, 16);
-	memset(verify + 3, 0, 13); // PK2s only store 1st 3 bytes
+#ifndef _WIN32
+	// Only used for page cache hints
+	m_fd = open(filename.c_str(), O_RDONLY | O_CLOEXEC);
+#endif
 
-	if(memcmp(verify, m_header.verify, 16) != 0)
+	// Apply a mode that was set before the file was opened
+	switch(m_access_mode)
+	{
+		case Access_Sequential:
+		case Access_Bulk:
+			Advise(0, file.size(), Advice_Sequential);
+			break;
+		case Access_Random:
+			Advise(0, file.size(), Advice_Random);
+			break;
+		default:
+			break;
+	}
+
+	boost::posix_time::ptime warm_time = boost::posix_time::microsec_clock::universal_time();
+
+	if(flags & Open_Populate)
+	{
+		Populate();
+	}
+
+	// Warming up is best effort, a damaged directory is reported by the lookups.
+	// A plaintext image is only worth its memory when there is a cipher to skip.
+	if(flags & (Open_PrefetchDirectory | Open_DecryptDirectory))
+	{
+		LocateDirectoryBlocks((flags & Open_PrefetchDirectory) != 0, (flags & Open_DecryptDirectory) && m_header.encryption);
+		m_error.str("");
+	}
+
+	boost::posix_time::ptime now = boost::posix_time::microsec_clock::universal_time();
+	m_open_stats.warm_ms = (now - warm_time).total_microseconds() / 1000.0;
+	m_open_stats.open_ms = (now - m_open_time).total_microseconds() / 1000.0;
+	m_open_stats.directory_blocks = (uint32_t)m_directory_blocks.size();
+	m_first_lookup_pending = true;
+
+	return true;
+}
+
+//-----------------------------------------------------------------------------
+
+std::string PK2Reader::GetFilename()
+{
+	boost::mutex::scoped_lock lock(m);
+	return m_filename;
+}
+
+//-----------------------------------------------------------------------------
+
+bool PK2Reader::GetBlowfish(Blowfish & blowfish)
+{
+	boost::mutex::scoped_lock lock(m);
+
+	if(!file.is_open() || !m_header.encryption)
 	{
-		file.close();
-		file_base = 0;
-		m_error.str(""); m_error << "Invalid Blowfish key.";
 		return false;
 	}
 
+	blowfish = m_blowfish;
 	return true;
 }
 
 //-----------------------------------------------------------------------------
 
+PK2OpenStats PK2Reader::GetOpenStats()
+{
+	boost::mutex::scoped_lock lock(m);
+	return m_open_stats;
+}
+
+//-----------------------------------------------------------------------------
+
 bool PK2Reader::GetEntries(PK2Entry & parent, std::list<PK2Entry> & entries)
 {
 	boost::mutex::scoped_lock lock(m);
@@ -246,22 +945,20 @@ bool PK2Reader::GetEntries(PK2Entry & parent, std::list<PK2Entry> & entries)
 		return false;
 	}
 
-	const char* file_base = file_seek(file, parent.position);
+	int64_t offset = parent.position;
 
 	while(true)
 	{
-		memcpy(&block, file_base, sizeof(PK2EntryBlock));
-		file_base += sizeof(PK2EntryBlock);
+		if(!ReadBlock(offset, block))
+		{
+			m_error.str(""); m_error << "Invalid seek index.";
+			return false;
+		}
 
 		for(int x = 0; x < 20; ++x)
 		{
 			PK2Entry & e = block.entries[x];
 
-			if(m_header.encryption)
-			{
-				m_blowfish.Decode(&e, sizeof(PK2Entry), &e, sizeof(PK2Entry));
-			}
-
 			// Protect against possible user seeking errors
 			if(e.padding[0] != 0 || e.padding[1] != 0)
 			{
@@ -278,7 +975,7 @@ bool PK2Reader::GetEntries(PK2Entry & parent, std::list<PK2Entry> & entries)
 		if(block.entries[19].nextChain)
 		{
 			// More entries in the current directory
-			file_base = file_seek(file, block.entries[19].nextChain);
+			offset = block.entries[19].nextChain;
 		}
 		else
 		{
@@ -287,6 +984,142 @@ bool PK2Reader::GetEntries(PK2Entry & parent, std::list<PK2Entry> & entries)
 		}
 	}
 
+	NoteLookup();
+
+	return true;
+}
+
+//-----------------------------------------------------------------------------
+
+// Maps the file again with the same parameters Open used. Must be called with m
+// held.
+bool PK2Reader::Remap()
+{
+	file.close();
+
+	try
+	{
+		boost::iostreams::mapped_file_params params;
+		params.path = m_filename;
+		params.flags = m_lazy_decrypt ? boost::iostreams::mapped_file_base::priv : boost::iostreams::mapped_file_base::readonly;
+		file.open(params);
+	}
+	catch(std::exception & e)
+	{
+		m_error.str(""); m_error << "Could not map the file \"" << m_filename << "\" again.\n" << e.what();
+		return false;
+	}
+
+	if(!file.is_open())
+	{
+		m_error.str(""); m_error << "Could not map the file \"" << m_filename << "\" again.";
+		return false;
+	}
+
+	if(m_lazy_decrypt)
+	{
+		// Every page is the file's again, so nothing is decrypted any more
+		m_decrypted.clear();
+		m_decrypted.resize((size_t)((file.size() >> (3 + lazy_chunk_shift)) + 1));
+	}
+
+	switch(m_access_mode)
+	{
+		case Access_Sequential:
+		case Access_Bulk:
+			Advise(0, file.size(), Advice_Sequential);
+			break;
+		case Access_Random:
+			Advise(0, file.size(), Advice_Random);
+			break;
+		default:
+			break;
+	}
+
+	return true;
+}
+
+//-----------------------------------------------------------------------------
+
+bool PK2Reader::ApplyDirectoryUpdate(const PK2DirectoryUpdate & update)
+{
+	boost::mutex::scoped_lock lock(m);
+
+	if(!file.is_open())
+	{
+		m_error.str(""); m_error << "There is no PK2 loaded yet.";
+		return false;
+	}
+
+	// A shared mapping already sees what was written over it, only growth needs
+	// a new one
+	if((m_lazy_decrypt || (uint64_t)update.file_size > file.size()) && !Remap())
+	{
+		// Nothing can be read without a mapping, so drop what was kept of the old one
+		m_cache.clear();
+		m_directory_blocks.clear();
+		m_directory_image.clear();
+		m_decrypted.clear();
+		return false;
+	}
+
+	if(!m_directory_image.empty())
+	{
+		for(std::set<int64_t>::const_iterator itr = update.freed_blocks.begin(); itr != update.freed_blocks.end(); ++itr)
+		{
+			std::vector<int64_t>::iterator block = std::lower_bound(m_directory_blocks.begin(), m_directory_blocks.end(), *itr);
+			if(block != m_directory_blocks.end() && *block == *itr)
+			{
+				m_directory_image.erase(m_directory_image.begin() + (block - m_directory_blocks.begin()));
+				m_directory_blocks.erase(block);
+			}
+		}
+
+		for(std::map<int64_t, PK2EntryBlock>::const_iterator itr = update.blocks.begin(); itr != update.blocks.end(); ++itr)
+		{
+			std::vector<int64_t>::iterator block = std::lower_bound(m_directory_blocks.begin(), m_directory_blocks.end(), itr->first);
+			size_t index = block - m_directory_blocks.begin();
+			if(block == m_directory_blocks.end() || *block != itr->first)
+			{
+				m_directory_blocks.insert(block, itr->first);
+				m_directory_image.insert(m_directory_image.begin() + index, itr->second);
+			}
+			else
+			{
+				m_directory_image[index] = itr->second;
+			}
+		}
+	}
+
+	if(!update.stale_paths.empty())
+	{
+		std::set<std::string> stale(update.stale_paths.begin(), update.stale_paths.end());
+
+		// Cache keys are paths as they were passed to GetEntry, so compare them in
+		// the normalized form: a key goes if it or any folder above it is stale
+		std::map<std::string, PK2Entry>::iterator itr = m_cache.begin();
+		while(itr != m_cache.end())
+		{
+			std::list<std::string> tokens = TokenizeString_1(itr->first, "\\");
+			std::string path;
+			bool drop = false;
+			for(std::list<std::string>::iterator token = tokens.begin(); token != tokens.end() && !drop; ++token)
+			{
+				path += (path.empty() ? "" : "\\") + *token;
+				drop = stale.find(path) != stale.end();
+			}
+
+			if(drop)
+			{
+				m_cache.erase(itr++);
+			}
+			else
+			{
+				++itr;
+			}
+		}
+	}
+
 	return true;
 }
 
@@ -313,21 +1146,22 @@ bool PK2Reader::GetEntry(const char * pathname, PK2Entry & entry)
 	if(itr != m_cache.end())
 	{
 		entry = itr->second;
+		NoteLookup();
 		return true;
 	}
 
 	PK2EntryBlock block;
 	size_t read_count = 0;
 	std::string name;
-	const char* file_base = 0;
+	int64_t offset = 0;
 
 	if(entry.position == 0)
 	{
-		file_base = file_seek(file, m_root_offset);
+		offset = m_root_offset;
 	}
 	else
 	{
-		file_base = file_seek(file, entry.position);
+		offset = entry.position;
 	}
 
 	while(!tokens.empty())
@@ -335,8 +1169,13 @@ bool PK2Reader::GetEntry(const char * pathname, PK2Entry & entry)
 		std::string path = tokens.front();
 		tokens.pop_front();
 
-		memcpy(&block, file_base, sizeof(PK2EntryBlock));
-		file_base += sizeof(PK2EntryBlock);
+		// The whole block is decoded up front; the batched cipher makes that cheaper
+		// than decoding entry by entry and stopping early.
+		if(!ReadBlock(offset, block))
+		{
+			m_error.str(""); m_error << "Invalid seek index.";
+			return false;
+		}
 
 		bool cycle = false;
 
@@ -344,13 +1183,6 @@ bool PK2Reader::GetEntry(const char * pathname, PK2Entry & entry)
 		{
 			PK2Entry & e = block.entries[x];
 
-			// I opt to decode entries as we process them rather than before hand to save 'some' processing
-			// from extra entries we don't have to search.
-			if(m_header.encryption)
-			{
-				m_blowfish.Decode(&e, sizeof(PK2Entry), &e, sizeof(PK2Entry));
-			}
-
 			// Protect against possible user seeking errors
 			if(e.padding[0] != 0 || e.padding[1] != 0)
 			{
@@ -375,6 +1207,7 @@ bool PK2Reader::GetEntry(const char * pathname, PK2Entry & entry)
 				{
 					entry = e;
 					Cache(base_name, e);
+					NoteLookup();
 					return true;
 				}
 				else
@@ -383,7 +1216,7 @@ bool PK2Reader::GetEntry(const char * pathname, PK2Entry & entry)
 					// bugs could result.
 					if(e.type == 1)
 					{
-						file_base = file_seek(file, e.position);
+						offset = e.position;
 						cycle = true;
 						break;
 					}
@@ -405,7 +1238,7 @@ bool PK2Reader::GetEntry(const char * pathname, PK2Entry & entry)
 		// More entries to search in the current directory
 		if(block.entries[19].nextChain)
 		{
-			file_base = file_seek(file, block.entries[19].nextChain);
+			offset = block.entries[19].nextChain;
 			tokens.push_front(path);
 			continue;
 		}
@@ -434,7 +1267,7 @@ bool PK2Reader::ForEachEntryDo(bool (* UserFunc)(PK2Reader *, const std::string
 	PK2EntryBlock block;
 	size_t read_count = 0;
 
-	const char* file_base = file_seek(file, m_root_offset);
+	int64_t offset = m_root_offset;
 
 	std::list<PK2Entry> folders;
 	std::list<std::string> paths;
@@ -448,7 +1281,7 @@ bool PK2Reader::ForEachEntryDo(bool (* UserFunc)(PK2Reader *, const std::string
 			PK2Entry e = folders.front();
 			folders.pop_front();
 
-			file_base = file_seek(file, e.position);
+			offset = e.position;
 		}
 
 		if(!paths.empty())
@@ -457,8 +1290,11 @@ bool PK2Reader::ForEachEntryDo(bool (* UserFunc)(PK2Reader *, const std::string
 			paths.pop_front();
 		}
 
-		memcpy(&block, file_base, sizeof(PK2EntryBlock));
-		file_base += sizeof(PK2EntryBlock);
+		if(!ReadBlock(offset, block))
+		{
+			m_error.str(""); m_error << "Invalid seek index.";
+			return false;
+		}
 
 		for(int x = 0; x < 20; ++x)
 		{
@@ -466,8 +1302,6 @@ bool PK2Reader::ForEachEntryDo(bool (* UserFunc)(PK2Reader *, const std::string
 
 			if(m_header.encryption)
 			{
-				m_blowfish.Decode(&e, sizeof(PK2Entry), &e, sizeof(PK2Entry));
-
 				// Protect against possible user seeking errors
 				if(e.padding[0] != 0 || e.padding[1] != 0)
 				{
@@ -519,6 +1353,46 @@ bool PK2Reader::ForEachEntryDo(bool (* UserFunc)(PK2Reader *, const std::string
 
 //-----------------------------------------------------------------------------
 
+bool BuildIndexFunc(PK2Reader *, const std::string & path, PK2EntryBlock & block, void * userdata)
+{
+	std::map<std::string, PK2Entry> & index = *reinterpret_cast<std::map<std::string, PK2Entry> *>(userdata);
+
+	std::string base_path = path;
+	std::transform(base_path.begin(), base_path.end(), base_path.begin(), tolower);
+	if(!base_path.empty())
+	{
+		base_path += "\\";
+	}
+
+	for(int x = 0; x < 20; ++x)
+	{
+		PK2Entry & e = block.entries[x];
+
+		if(e.type != 1 && e.type != 2)
+		{
+			continue;
+		}
+
+		if(e.name[0] == '.' && (e.name[1] == 0 || (e.name[1] == '.' && e.name[2] == 0)))
+		{
+			continue;
+		}
+
+		std::string name = e.name;
+		std::transform(name.begin(), name.end(), name.begin(), tolower);
+		index[base_path + name] = e;
+	}
+
+	return true;
+}
+
+bool PK2Reader::BuildIndex(std::map<std::string, PK2Entry> & index)
+{
+	return ForEachEntryDo(BuildIndexFunc, &index);
+}
+
+//-----------------------------------------------------------------------------
+
 bool PK2Reader::ExtractToMemory(PK2Entry & entry, std::vector<uint8_t> & buffer)
 {
 	boost::mutex::scoped_lock lock(m);
@@ -528,6 +1402,11 @@ bool PK2Reader::ExtractToMemory(PK2Entry & entry, std::vector<uint8_t> & buffer)
 		m_error.str(""); m_error << "The entry is not a file.";
 		return false;
 	}
+	if(!file.is_open() || (uint64_t)entry.position + entry.size > file.size())
+	{
+		m_error.str(""); m_error << "The entry \"" << entry.name << "\" is not inside the PK2.";
+		return false;
+	}
 	buffer.resize(entry.size);
 	if(buffer.empty())
 	{
@@ -537,11 +1416,86 @@ bool PK2Reader::ExtractToMemory(PK2Entry & entry, std::vector<uint8_t> & buffer)
 	const char* file_base = file_seek(file, entry.position);
 	memcpy(&buffer[0], file_base, entry.size);
 
+	// The data now lives in the caller's buffer
+	if(m_access_mode == Access_Bulk)
+	{
+		Advise(entry.position, entry.size, Advice_DontNeed);
+	}
+
 	return true;
 }
 
 const char* PK2Reader::Extract(PK2Entry & entry)
 {
+	// A damaged entry must not send the caller past the end of the mapping
+	if(!file.is_open() || (uint64_t)entry.position + entry.size > file.size())
+	{
+		return 0;
+	}
 	return file_seek(file, entry.position);
 }
+
+//-----------------------------------------------------------------------------
+
+bool PK2Reader::SetAccessMode(PK2AccessMode mode)
+{
+	boost::mutex::scoped_lock lock(m);
+
+	m_access_mode = mode;
+
+	if(!file.is_open())
+	{
+		return true;
+	}
+
+	switch(mode)
+	{
+		case Access_Sequential:
+		case Access_Bulk:
+			return Advise(0, file.size(), Advice_Sequential);
+		case Access_Random:
+			return Advise(0, file.size(), Advice_Random);
+		default:
+			return Advise(0, file.size(), Advice_Normal);
+	}
+}
+
+//-----------------------------------------------------------------------------
+
+PK2AccessMode PK2Reader::GetAccessMode()
+{
+	boost::mutex::scoped_lock lock(m);
+	return m_access_mode;
+}
+
+//-----------------------------------------------------------------------------
+
+bool PK2Reader::Prefetch(const PK2Entry & entry)
+{
+	boost::mutex::scoped_lock lock(m);
+
+	if(entry.type != 2)
+	{
+		m_error.str(""); m_error << "The entry is not a file.";
+		return false;
+	}
+
+	return Advise(entry.position, entry.size, Advice_WillNeed);
+}
+
+//-----------------------------------------------------------------------------
+
+bool PK2Reader::Release(const PK2Entry & entry)
+{
+	boost::mutex::scoped_lock lock(m);
+
+	if(entry.type != 2)
+	{
+		m_error.str(""); m_error << "The entry is not a file.";
+		return false;
+	}
+
+	return Advise(entry.position, entry.size, Advice_DontNeed);
+}
+
 //-----------------------------------------------------------------------------
\ No newline at end of file
@@ -9,6 +9,7 @@
 #include "blowfish.h"
 #include <vector>
 #include <map>
+#include <set>
 #include <list>
 #include <sstream>
 #include <string>
@@ -16,6 +17,53 @@
 
 #include <boost/thread/mutex.hpp>
 #include <boost/iostreams/device/mapped_file.hpp>
+#include <boost/date_time/posix_time/posix_time_types.hpp>
+
+//-----------------------------------------------------------------------------
+
+// Hints passed to the OS about how the mapped PK2 will be accessed.
+enum PK2AccessMode
+{
+	Access_Normal,		// default readahead
+	Access_Sequential,	// whole archive traversal, aggressive readahead
+	Access_Random,		// point lookups, no readahead
+	Access_Bulk			// like sequential, but extracted entries are released right away
+};
+
+//-----------------------------------------------------------------------------
+
+// Optional work done by Open so the first lookups do not stall on page faults.
+enum PK2OpenFlags
+{
+	Open_PrefetchDirectory = 1,	// locate every directory block and prefetch those pages
+	Open_Populate = 2,			// fault in the whole mapping (huge pages where available)
+	Open_DecryptDirectory = 4,	// decrypt every directory block once and keep the plaintext in memory
+	Open_LazyDecrypt = 8		// map copy-on-write and decrypt directory blocks in place on first use
+};
+
+// Timings from the last Open, in milliseconds.
+struct PK2OpenStats
+{
+	double open_ms; // total time spent in Open, including warm up
+	double warm_ms; // time spent on the PK2OpenFlags work
+	double first_lookup_ms; // from the start of Open until the first lookup returned, 0 if none yet
+	uint32_t directory_blocks; // number of directory blocks located, 0 if not requested
+};
+
+// What a PK2Writer changed in the archive, see PK2Reader::ApplyDirectoryUpdate.
+struct PK2DirectoryUpdate
+{
+	std::map<int64_t, PK2EntryBlock> blocks; // plaintext of every directory block written
+	std::set<int64_t> freed_blocks; // directory blocks no folder uses any more
+	std::vector<std::string> stale_paths; // lower case, backslash separated; covers everything below
+	int64_t file_size; // size of the file after the update
+};
+
+//-----------------------------------------------------------------------------
+
+// The Blowfish key of a PK2 is the ascii key xor'ed with the base key. Fills
+// 'bf_key' and returns its length. Shared by PK2Reader and PK2Writer.
+uint8_t DeriveBlowfishKey(const char * ascii_key, size_t ascii_key_length, const char * base_key, uint8_t base_key_length, uint8_t bf_key[56]);
 
 //-----------------------------------------------------------------------------
 
@@ -24,18 +72,44 @@ class PK2Reader
 private:
 
 	boost::iostreams::mapped_file file;
+	std::string m_filename;
 	PK2Header m_header;
 	int64_t m_root_offset;
 	Blowfish m_blowfish;
 	std::stringstream m_error;
 	std::map<std::string, PK2Entry> m_cache;
+	PK2AccessMode m_access_mode;
+#ifndef _WIN32
+	int m_fd;
+#endif
+	std::vector<int64_t> m_directory_blocks;
+	std::vector<PK2EntryBlock> m_directory_image; // plaintext of m_directory_blocks, same order
+	bool m_lazy_decrypt;
+	std::vector< std::vector<uint32_t> > m_decrypted; // one bit per 8 bytes of file, chunks allocated on demand
+	boost::mutex m_lazy_mutex;
+	PK2OpenStats m_open_stats;
+	boost::posix_time::ptime m_open_time;
+	bool m_first_lookup_pending;
 
 	boost::mutex m;
 
 private:
+	struct DirectoryScan;
+	friend struct DirectoryScan;
+	struct KeyCheck;
+
 	PK2Reader & operator = (const PK2Reader & rhs);
 	PK2Reader(const PK2Reader & rhs);
 	void Cache(std::string & base_name, PK2Entry & e);
+	bool Advise(int64_t offset, uint64_t length, int advice);
+	bool ReadBlock(int64_t offset, PK2EntryBlock & block);
+	bool TestAndSetDecrypted(int64_t offset, bool set);
+	bool AnyDecrypted(int64_t begin, int64_t end);
+	bool ScanDirectoryBlock(int64_t offset, std::vector<int64_t> & children, PK2EntryBlock & block);
+	bool LocateDirectoryBlocks(bool prefetch, bool keep_image);
+	void Populate();
+	void NoteLookup();
+	bool Remap();
 
 public:
 	PK2Reader();
@@ -57,11 +131,40 @@ public:
 	// base_key does not change!
 	void SetDecryptionKey(char * ascii_key = "169841", uint8_t ascii_key_length = 6, char * base_key = "\x03\xF8\xE4\x44\x88\x99\x3F\x64\xFE\x35", uint8_t base_key_length = 10);
 
+	// Uses the key of another PK2, as returned by GetBlowfish.
+	void SetDecryption(const Blowfish & blowfish);
+
 	// Opens/Closes a PK2 file. There is no overhead for these functions and the file
 	// remains open until Close is explicitly called or the PK2Reader object is destroyed.
-	bool Open(std::string filename);
+	// 'flags' is a combination of PK2OpenFlags to warm up the mapping before returning.
+	bool Open(std::string filename, uint32_t flags = 0);
+
+	// Opens a PK2 whose key is one of 'ascii_keys'. The header is read once, every
+	// candidate is checked against it on all cores and the file is only mapped for
+	// the key that matches, which is left set as the decryption key. 'key_index'
+	// receives the index of that key, or -1 if the PK2 is not encrypted. Key
+	// schedules come from Blowfish's shared cache, so trying the same keys again
+	// later costs nothing.
+	bool Open(std::string filename, const std::vector<std::string> & ascii_keys, int & key_index, uint32_t flags = 0, char * base_key = "\x03\xF8\xE4\x44\x88\x99\x3F\x64\xFE\x35", uint8_t base_key_length = 10);
 	void Close();
 
+	// Returns the timings of the last Open.
+	PK2OpenStats GetOpenStats();
+
+	// Returns the filename passed to Open, or an empty string if no PK2 is open.
+	std::string GetFilename();
+
+	// Returns true if the open PK2 is encrypted and copies its key into 'blowfish'.
+	bool GetBlowfish(Blowfish & blowfish);
+
+	// Brings the reader up to date after a PK2Writer changed the same file, see
+	// PK2Writer::AttachReader. Only the cached entries under the stale paths are
+	// dropped and only the changed blocks of an Open_DecryptDirectory image are
+	// replaced. The file is mapped again when it grew, or always with
+	// Open_LazyDecrypt since its private copies of pages would hide the new data;
+	// pointers returned by Extract before the update are invalid in that case.
+	bool ApplyDirectoryUpdate(const PK2DirectoryUpdate & update);
+
 	// Returns true of an entry was found with the 'pathname' using 'entry' as the parent. If
 	// you want to search from the root, make sure entry is a zero'ed out object.
 	bool GetEntry(const char * pathname, PK2Entry & entry);
@@ -77,12 +180,34 @@ public:
 	// efficiency and flexibility when implementing more complicated logic (like defragment).
 	bool ForEachEntryDo(bool (* UserFunc)(PK2Reader *, const std::string &, PK2EntryBlock &, void *), void * userdata);
 
+	// Fills 'index' with every file and folder in the PK2 keyed by full path. Paths
+	// are lower case and separated by backslashes, the same form GetEntry accepts.
+	// The "." and ".." entries are not included.
+	bool BuildIndex(std::map<std::string, PK2Entry> & index);
+
 	// Extracts the current entry to memory. Returns true on success and false on failure.
 	// Users are advised to use on common buffer to reduce the need for frequent memory 
 	// reallocations on the vector side.
 	bool ExtractToMemory(PK2Entry & entry, std::vector<uint8_t> & buffer);
 
+	// Returns a pointer to the entry's data inside the mapping, or 0 if the entry
+	// does not lie inside the file.
 	const char* Extract(PK2Entry & entry);
+
+	// Sets how the archive is going to be accessed so the OS can tune readahead. This
+	// can be called before or after Open and stays in effect until changed.
+	bool SetAccessMode(PK2AccessMode mode);
+
+	// Returns the mode last set with SetAccessMode.
+	PK2AccessMode GetAccessMode();
+
+	// Asks the OS to start reading the entry's data in the background so a following
+	// Extract does not stall on page faults.
+	bool Prefetch(const PK2Entry & entry);
+
+	// Drops the entry's pages from this process and from the page cache once they
+	// have been processed so long bulk jobs do not push out other programs' data.
+	bool Release(const PK2Entry & entry);
 };
 
 //-----------------------------------------------------------------------------
@@ -1,684 +1,1813 @@
-#include "pk2writer.h"
-#include <windows.h>
-#include <stdio.h>
-#include <vector>
-#include <string>
-#include <sstream>
+#include "PK2Writer.h"
+#include "PK2Reader.h"
+#include "shared_io.h"
+#include <string.h>
+#include <time.h>
+#include <algorithm>
+
+#define XXH_INLINE_ALL
+#include <xxhash.h>
 
 //-----------------------------------------------------------------------------
 
-// Start 1 byte alignment
-#pragma pack(push, 1)
+// Writes closer together than this are merged into one before they reach the file.
+const size_t writer_buffer_size = 4 * 1024 * 1024;
 
-	// Structure to the gfx dll object, not going to try and decode it all
-	struct tGFXAccess
-	{
-		DWORD addr1;
-		DWORD addr2;
-		unsigned char buffer[5930];
-	};
+// Each journal record is an offset and a size followed by one directory block
+// as it was before the Commit and as it is written.
+const size_t journal_record_size = sizeof(int64_t) + sizeof(uint64_t) + 2 * sizeof(PK2EntryBlock);
+
+// Disks write whole sectors, so a block cut short by a crash still has each of
+// its sectors either old or new.
+const size_t journal_sector_size = 512;
+
+//-----------------------------------------------------------------------------
 
-// End 1 byte alignment
-#pragma pack(pop)
+int MakePathSlashWindows_2(int ch)
+{
+	return ch == '/' ? '\\' : ch;
+}
 
 //-----------------------------------------------------------------------------
 
-// Pk2 success function
-__declspec(naked) void SuccessFunction()
+// Same as TokenizeString_1 in PK2Reader.cpp.
+std::list<std::string> TokenizeString_2(const std::string& str, const std::string& delim)
 {
-	__asm
+	// http://www.gamedev.net/community/forums/topic.asp?topic_id=381544#TokenizeString
+	using namespace std;
+	list<string> tokens;
+	size_t p0 = 0, p1 = string::npos;
+	while(p0 != string::npos)
 	{
-		mov eax, 1
-		ret
+		p1 = str.find_first_of(delim, p0);
+		if(p1 != p0)
+		{
+			string token = str.substr(p0, p1 - p0);
+			tokens.push_back(token);
+		}
+		p0 = str.find_first_not_of(delim, p1);
 	}
+	return tokens;
 }
 
 //-----------------------------------------------------------------------------
 
-struct PK2WriterPIMPL
+// Current time in the Windows format the PK2 entries use (100ns ticks since 1601).
+uint64_t WindowsTimeNow()
 {
-	// Set of registers for storing registers for context change
-	DWORD dwEax_setup;
-	DWORD dwEbx_setup;
-	DWORD dwEcx_setup;
-	DWORD dwEdx_setup;
+	return (uint64_t)time(0) * 10000000 + 116444736000000000ULL;
+}
 
-	// Object for gfx dll access
-	tGFXAccess * pGFXAccess;
+//-----------------------------------------------------------------------------
 
-	// Handle to the gfx dll
-	HMODULE hDLL;
+bool WriteRunLess(const PK2WriteRun & a, const PK2WriteRun & b)
+{
+	return a.offset < b.offset;
+}
 
-	// Holds the path to the loaded pk2 files
-	char loadPk2Filename[MAX_PATH + 1];
+//-----------------------------------------------------------------------------
 
-	// Handles to the graphics functions
-	FARPROC GFXDllCreateObject;
-	FARPROC GFXDllReleaseObject;
+// A range of the archive something points at, collected by BuildFreeMap.
+struct PK2LiveRange
+{
+	int64_t offset;
+	uint64_t size;
+	bool data; // file data rather than the header or a directory block
+};
 
-	// Initialized and loaded flag
-	bool bInit;
-	bool bLoaded;
-	
-	std::stringstream err;
-	std::string error;
+bool LiveRangeLess(const PK2LiveRange & a, const PK2LiveRange & b)
+{
+	return a.offset < b.offset;
+}
 
-	PK2WriterPIMPL()
-	{
-		// Clear our private data
-		dwEax_setup = 0;
-		dwEbx_setup = 0;
-		dwEcx_setup = 0;
-		dwEdx_setup = 0;
-		bInit = false;
-		bLoaded = false;
-		pGFXAccess = NULL;
-		hDLL = NULL;
+//-----------------------------------------------------------------------------
 
-		// Clear string memory
-		memset(loadPk2Filename, 0, MAX_PATH + 1);
+PK2Writer::PK2Writer()
+{
+	m_file = 0;
+	m_root_offset = 0;
+	m_file_size = 0;
+	m_transaction = false;
+	m_free_valid = false;
+	m_reader = 0;
+	memset(&m_header, 0, sizeof(PK2Header));
+}
 
-		// Clear function pointers
-		GFXDllCreateObject = NULL;
-		GFXDllReleaseObject = NULL;
-	}
+//-----------------------------------------------------------------------------
 
-	// Create the pk2 api access object
-	bool Initialize(std::string gfxDllFilename)
+PK2Writer::~PK2Writer()
+{
+	if(m_file)
 	{
-		if(bInit)
-		{
-			err.str(""); err << "Initialize has already been called.";
-			return false;
-		}
-
-		while(gfxDllFilename.find("/") != std::string::npos)
-			gfxDllFilename.replace(gfxDllFilename.find("/"), 1, "\\");
+		Close();
+	}
+}
 
-		// Try to load the DLL
-		hDLL = LoadLibraryA(gfxDllFilename.c_str());
-		if(hDLL == NULL)
-		{
-			err.str(""); err << "LoadLibraryA failed for \"" << gfxDllFilename << "\". Does the file exist in the current path?";
-			return false;
-		}
+//-----------------------------------------------------------------------------
 
-		// Load the gfx dll startup function
-		GFXDllCreateObject = GetProcAddress(hDLL, "GFXDllCreateObject");
-		if(!GFXDllCreateObject)
-		{
-			FreeLibrary(hDLL);
-			err.str(""); err << "GetProcAddress failed for \"GFXDllCreateObject\" in \"" << gfxDllFilename << "\".";
-			return false;
-		}
+std::string PK2Writer::GetError()
+{
+	std::string e = m_error.str();
+	m_error.str("");
+	return e;
+}
 
-		// Load the gfx dll cleanup function
-		GFXDllReleaseObject = GetProcAddress(hDLL, "GFXDllReleaseObject");
-		if(!GFXDllReleaseObject)
-		{
-			FreeLibrary(hDLL);
-			err.str(""); err << "GetProcAddress failed for \"GFXDllReleaseObject\" in \"" << gfxDllFilename << "\".";
-			return false;
-		}
+//-----------------------------------------------------------------------------
 
-		// Since we are doing a lot of asm code, save initial registers
-		__asm pushad
+bool PK2Writer::ReadBlock(int64_t offset, PK2EntryBlock & block)
+{
+	if(offset < m_root_offset || offset + (int64_t)sizeof(PK2EntryBlock) > m_file_size)
+	{
+		m_error.str(""); m_error << "Invalid seek index.";
+		return false;
+	}
 
-		// This variable holds the pointer to the newly created access object
-		DWORD dwHolder = 0;
-		LPVOID pHolder = &dwHolder;
+	if(file_seek(m_file, offset, SEEK_SET) != 0 || fread(&block, 1, sizeof(PK2EntryBlock), m_file) != sizeof(PK2EntryBlock))
+	{
+		m_error.str(""); m_error << "Could not read the directory block at " << offset << ".";
+		return false;
+	}
 
-		// Store the function pointer we want to call
-		FARPROC gfxFunc = GFXDllCreateObject;
+	if(m_header.encryption)
+	{
+		m_blowfish.DecodeBlocks(&block, &block, sizeof(PK2EntryBlock) / 8);
+	}
 
-		// Setup the access to the DLL by creating the object
-		__asm
-		{
-			push 0x1007
-			push pHolder
-			push 0x01
-			call gfxFunc
-		}
+	return true;
+}
 
-		// Store the pointer to the access object
-		pGFXAccess = (tGFXAccess*)(*((DWORD*)pHolder));
+//-----------------------------------------------------------------------------
 
-		// Holds the registers
-		DWORD dwA = 0;
-		DWORD dwB = 0;
-		DWORD dwC = 0;
-		DWORD dwD = 0;
+PK2EntryBlock * PK2Writer::LoadBlock(int64_t offset)
+{
+	std::map<int64_t, PK2EntryBlock>::iterator itr = m_blocks.find(offset);
+	if(itr != m_blocks.end())
+	{
+		return &itr->second;
+	}
 
-		// Store this to use in asm
-		LPVOID ptr1 = pGFXAccess;
+	PK2EntryBlock block;
+	if(!ReadBlock(offset, block))
+	{
+		return 0;
+	}
 
-		// Setup part two
-		__asm
+	for(int x = 0; x < 20; ++x)
+	{
+		// Protect against possible user seeking errors
+		if(block.entries[x].padding[0] != 0 || block.entries[x].padding[1] != 0)
 		{
-			mov ecx, ptr1
-			mov eax, [ecx]
-			mov edx, [eax + 0xA4]
-			push SuccessFunction
-			call edx
-
-			// Save these for when we set the current pk2
-			mov dwA, eax
-			mov dwB, ebx
-			mov dwC, ecx
-			mov dwD, edx
+			m_error.str(""); m_error << "The padding is not NULL. User seek error.";
+			return 0;
 		}
+	}
 
-		dwEax_setup = dwA;
-		dwEbx_setup = dwB;
-		dwEcx_setup = dwC;
-		dwEdx_setup = dwD;
-
-		// Restore original registers
-		__asm popad
+	return &(m_blocks[offset] = block);
+}
 
-		// We are now initialized
-		bInit = true;
+//-----------------------------------------------------------------------------
 
+bool PK2Writer::WriteData(int64_t offset, const void * data, uint64_t size)
+{
+	if(size == 0)
+	{
 		return true;
 	}
 
-	// Clean up the pk2 api access object
-	bool Deinitialize()
+	if(file_seek(m_file, offset, SEEK_SET) != 0 || fwrite(data, 1, (size_t)size, m_file) != size)
 	{
-		if(bInit == false)
-		{
-			err.str(""); err << "Initialize has not yet been called.";
-			return false;
-		}
-
-		if(bLoaded)
-		{
-			err.str(""); err << "A PK2 is currently open. Call Close first.";
-			return false;
-		}
-
-		// If we have a gfx dll access object
-		if(pGFXAccess)
-		{
-			// Store the function pointer we want to call
-			FARPROC gfxFunc = GFXDllReleaseObject;
+		m_error.str(""); m_error << "Could not write " << size << " bytes of data at " << offset << ".";
+		return false;
+	}
 
-			// Store this to use in asm
-			LPVOID ptr1 = pGFXAccess;
+	return true;
+}
 
-			// Since we are doing a lot of asm code, save initial registers
-			__asm
-			{
-				// Save registers
-				pushad
+//-----------------------------------------------------------------------------
 
-				// Free the graphics dll
-				push ptr1
-				call gfxFunc
+bool PK2Writer::WriteRuns(std::vector<PK2WriteRun> & runs)
+{
+	std::sort(runs.begin(), runs.end(), WriteRunLess);
 
-				// Restore registers
-				popad
-			}
+	// Back to back runs are gathered so the file sees a few large sequential
+	// writes instead of one per entry
+	m_write_buffer.clear();
+	int64_t buffer_offset = 0;
 
-			// Clear the pointer
-			pGFXAccess = 0;
-		}
+	for(size_t x = 0; x < runs.size(); ++x)
+	{
+		const PK2WriteRun & run = runs[x];
 
-		// If the gfx dll is loaded
-		if(hDLL)
+		if(!m_write_buffer.empty() && (run.offset != buffer_offset + (int64_t)m_write_buffer.size() || m_write_buffer.size() + run.size > writer_buffer_size))
 		{
-			// Unload the library
-			FreeLibrary(hDLL);
-
-			// Clear the pointer
-			hDLL = 0;
+			if(!WriteData(buffer_offset, &m_write_buffer[0], m_write_buffer.size()))
+			{
+				return false;
+			}
+			m_write_buffer.clear();
 		}
 
-		// Clear our private data
-		dwEax_setup = 0;
-		dwEbx_setup = 0;
-		dwEcx_setup = 0;
-		dwEdx_setup = 0;
-		bInit = false;
-		bLoaded = false;
-
-		// Clear string memory
-		memset(loadPk2Filename, 0, MAX_PATH + 1);
-
-		// Clear function pointers
-		GFXDllCreateObject = NULL;
-		GFXDllReleaseObject = NULL;
-
-		return true;
-	}
-
-	// Closes the open PK2 file
-	bool Close()
-	{
-		if(bInit == false)
+		if(run.size >= writer_buffer_size)
 		{
-			err.str(""); err << "Initialize has not yet been called.";
-			return false;
+			if(!WriteData(run.offset, run.data, run.size))
+			{
+				return false;
+			}
+			continue;
 		}
 
-		if(!bLoaded)
+		if(m_write_buffer.empty())
 		{
-			err.str(""); err << "Open has not yet been called.";
-			return false;
+			buffer_offset = run.offset;
 		}
+		m_write_buffer.insert(m_write_buffer.end(), run.data, run.data + run.size);
+	}
 
-		// Store this to use in asm
-		LPVOID ptr1 = pGFXAccess;
-
-		// Start opening the file
-		DWORD var1 = 0;
-		LPVOID lpVar1 = &var1;
-
-		// Activate the pk2 file to operate on
-		__asm
-		{
-			// Save registers
-			pushad
+	if(!m_write_buffer.empty() && !WriteData(buffer_offset, &m_write_buffer[0], m_write_buffer.size()))
+	{
+		return false;
+	}
 
-			// Restore these from after the gfx dll was created
-			mov eax, dwEax_setup
-			mov ebx, dwEbx_setup
-			mov ecx, dwEcx_setup
-			mov edx, dwEdx_setup
+	// Keep the memory of one buffer around, not the largest batch ever written
+	if(m_write_buffer.capacity() > writer_buffer_size)
+	{
+		std::vector<uint8_t>().swap(m_write_buffer);
+	}
+	m_write_buffer.clear();
 
-			// Params to open the pk2 for access
-			push lpVar1
-			push 0
-			push 0
+	return true;
+}
 
-			// Code to open the pk2 for access
-			mov ecx, ptr1
-			mov edx, [ecx]
-			mov eax, [edx + 0x10]		
-			call eax
+//-----------------------------------------------------------------------------
 
-			// Restore registers
-			popad
-		}
+bool PK2Writer::FindInFolder(int64_t folder_offset, const std::string & name, int64_t & entry_offset)
+{
+	std::string entry_name;
+	int64_t offset = folder_offset;
 
-		// No longer loaded
-		bLoaded = false;
+	// A damaged chain could loop forever, but it can never be longer than the file
+	int64_t blocks_left = m_file_size / sizeof(PK2EntryBlock);
 
-		return true;
-	}
+	entry_offset = 0;
 
-	// Sets a pk2 file to import into
-	bool Open(std::string pk2Filename, void * accessKey, unsigned char accessKeyLen)
+	while(offset)
 	{
-		if(bInit == false)
+		if(blocks_left-- <= 0)
 		{
-			err.str(""); err << "Initialize has not yet been called.";
+			m_error.str(""); m_error << "The directory chain at " << folder_offset << " loops.";
 			return false;
 		}
 
-		if(bLoaded)
+		PK2EntryBlock * block = LoadBlock(offset);
+		if(block == 0)
 		{
-			err.str(""); err << "A PK2 is currently open. Call Close first.";
 			return false;
 		}
 
-		if(accessKeyLen == 0 || accessKeyLen > 56)
+		for(int x = 0; x < 20; ++x)
 		{
-			err.str(""); err << "The key length may only be 1 - 56 bytes long.";
-			return false;
-		}
-
-		while(pk2Filename.find("/") != std::string::npos)
-			pk2Filename.replace(pk2Filename.find("/"), 1, "\\");
-
-		// Result of a function
-		DWORD dwResult = 0;
-
-		// Start opening the file
-		DWORD var1 = accessKeyLen;
-		LPVOID lpVar1 = &var1;
-
-		// Store these as explicit pointers
-		char * paccess = (char *)accessKey;
-		char * pfilename = loadPk2Filename;
-
-		// Store the values
-		_snprintf_s(loadPk2Filename, MAX_PATH, "%s", pk2Filename.c_str());
-
-		// Store this to use in asm
-		LPVOID ptr1 = pGFXAccess;
+			PK2Entry & e = block->entries[x];
+			if(e.type == 0)
+			{
+				continue;
+			}
 
-		// Activate the pk2 file to operate on
-		__asm
-		{
-			// Save registers
-			pushad
+			entry_name = e.name;
+			std::transform(entry_name.begin(), entry_name.end(), entry_name.begin(), tolower);
+			if(entry_name == name)
+			{
+				entry_offset = offset + x * sizeof(PK2Entry);
+				return true;
+			}
+		}
 
-			// Restore these from after the gfx dll was created
-			mov eax, dwEax_setup
-			mov ebx, dwEbx_setup
-			mov ecx, dwEcx_setup
-			mov edx, dwEdx_setup
+		offset = block->entries[19].nextChain;
+	}
 
-			// Params to open the pk2 for access
-			push lpVar1
-			push paccess
-			push pfilename
+	// Not found, entry_offset stays 0
+	return true;
+}
 
-			// Code to open the pk2 for access
-			mov ecx, ptr1
-			mov edx, [ecx]
-			mov eax, [edx + 0x10]		
-			call eax
+//-----------------------------------------------------------------------------
 
-			// Store the result
-			mov dwResult, eax
+bool PK2Writer::FindFolder(std::list<std::string> & tokens, int64_t & folder_offset)
+{
+	folder_offset = m_root_offset;
 
-			// Restore registers
-			popad
-		}
+	for(std::list<std::string>::iterator itr = tokens.begin(); itr != tokens.end(); ++itr)
+	{
+		std::string name = *itr;
+		std::transform(name.begin(), name.end(), name.begin(), tolower);
 
-		// Check the result
-		if(dwResult == 0)
+		int64_t entry_offset = 0;
+		if(!FindInFolder(folder_offset, name, entry_offset))
 		{
-			err.str(""); err << "There was a problem correctly accessing the GFXFileManager DLL.";
 			return false;
 		}
 
-		// We have a file loaded now
-		bLoaded = true;
-
-		return true;
-	}
-
-	// Replace a file in a pk2 with another from file
-	bool ImportFile(const char * entryFilename, void * fileBuffer, int fileSize)
-	{
-		if(bInit == false)
+		if(entry_offset == 0)
 		{
-			err.str(""); err << "Initialize has not yet been called.";
+			m_error.str(""); m_error << "The folder \"" << *itr << "\" does not exist.";
 			return false;
 		}
 
-		if(!bLoaded)
+		const PK2Entry & entry = LoadedEntry(entry_offset);
+		if(entry.type != 1)
 		{
-			err.str(""); err << "Open has not yet been called.";
+			m_error.str(""); m_error << "Invalid entry, files cannot have children!";
 			return false;
 		}
 
-		// Pointer to the input data
-		LPBYTE updateData = (LPBYTE)fileBuffer;
-
-		// Size of the new data
-		DWORD updateDataSize = fileSize;
+		folder_offset = entry.position;
+	}
 
-		// Store the pointer to the string for asm access
-		char * pkFilePathName = (char*)entryFilename;
+	return true;
+}
 
-		// Make sure there is data to replace the entry with
-		/*if(updateDataSize == 0)
-		{
-			err << "The replacement file must be at least 1 byte in size.";
-			return false;
-		}*/
+//-----------------------------------------------------------------------------
 
-		// Result of the operation
-		DWORD result = 0;
+PK2Entry & PK2Writer::LoadedEntry(int64_t entry_offset)
+{
+	// Only called with offsets FindInFolder/AddToFolder returned, so the block is loaded
+	std::map<int64_t, PK2EntryBlock>::iterator block = --m_blocks.upper_bound(entry_offset);
+	return block->second.entries[(entry_offset - block->first) / sizeof(PK2Entry)];
+}
 
-		// Store this to use in asm
-		LPVOID ptr1 = pGFXAccess;
+//-----------------------------------------------------------------------------
 
-		// Step 1
-		__asm
-		{
-			// Setup dll access functions
-			mov esi, ptr1
-			mov edx, [esi]
-			mov eax, [edx + 0x3C]
-			mov ecx, esi
+PK2Entry & PK2Writer::EditEntry(int64_t entry_offset)
+{
+	m_dirty_blocks.insert((--m_blocks.upper_bound(entry_offset))->first);
+	return LoadedEntry(entry_offset);
+}
 
-			// Prepare the pk2 to be patched
-			push updateDataSize
-			push pkFilePathName
-			call eax
+//-----------------------------------------------------------------------------
 
-			// Save the result, which is the file in the update process
-			mov result, eax
-			mov ebx, eax
+bool PK2Writer::AddToFolder(int64_t folder_offset, const PK2Entry & entry, int64_t & entry_offset)
+{
+	int64_t offset = folder_offset;
+	int64_t last_offset = 0;
+	int64_t blocks_left = m_file_size / sizeof(PK2EntryBlock);
 
-			// Save regs
-			pushad
+	while(offset)
+	{
+		if(blocks_left-- <= 0)
+		{
+			m_error.str(""); m_error << "The directory chain at " << folder_offset << " loops.";
+			return false;
 		}
 
-		// Check result
-		if(result == 0)
+		PK2EntryBlock * block = LoadBlock(offset);
+		if(block == 0)
 		{
-			err.str(""); err << "Step 1 Failed.";
 			return false;
 		}
 
-		// How many bytes were written
-		DWORD asmWrote = 0;
-
-		// Step 2
-		__asm
+		for(int x = 0; x < 20; ++x)
 		{
-			popad 
-
-			// Store how many bytes were written
-			lea ecx, asmWrote
-			push ecx
-
-			// Save the file size
-			mov eax, updateDataSize
-			push eax
+			PK2Entry & e = block->entries[x];
+			if(e.type == 0)
+			{
+				// The last slot of a block carries the chain link, which has to survive
+				int64_t next_chain = e.nextChain;
+				e = entry;
+				e.nextChain = next_chain;
+				m_dirty_blocks.insert(offset);
+				entry_offset = offset + x * sizeof(PK2Entry);
+				return true;
+			}
+		}
 
-			// Prepare the dll functions
-			mov edi, [esi]
-			add edi, 0x4C
-			mov edx, [edi]
+		last_offset = offset;
+		offset = block->entries[19].nextChain;
+	}
 
-			// Data to update
-			mov eax, updateData
-			push eax
+	// The folder is full, so chain a new block to its end
+	int64_t new_offset = Allocate(sizeof(PK2EntryBlock));
 
-			// File # to patch
-			push ebx
+	PK2EntryBlock & block = m_blocks[new_offset];
+	memset(&block, 0, sizeof(PK2EntryBlock));
+	block.entries[0] = entry;
+	block.entries[0].nextChain = 0;
+	m_dirty_blocks.insert(new_offset);
 
-			mov ecx, esi
-			call edx
-			mov result, eax
+	m_blocks[last_offset].entries[19].nextChain = new_offset;
+	m_dirty_blocks.insert(last_offset);
 
-			// Save regs
-			pushad
-		}
+	entry_offset = new_offset;
+	return true;
+}
 
-		// Check result
-		if(result == 0)
-		{
-			err.str(""); err << "Step 2 Failed.";
-			return false;
-		}
+//-----------------------------------------------------------------------------
 
-		// Step 3
-		__asm
-		{
-			popad
-			mov eax, [esi]
-			mov edx,[eax + 0x44]
-			push ebx
-			mov ecx, esi
-			call edx
-			mov result, eax
-		}
+bool PK2Writer::BuildFreeMap()
+{
+	ClearFreeMap();
 
-		// Check result
-		if(result == 0)
-		{
-			err.str(""); err << "Step 3 Failed.";
-			return false;
-		}
+	std::vector<PK2LiveRange> live;
+	PK2LiveRange header = { 0, sizeof(PK2Header), false };
+	live.push_back(header);
 
-		return true;
-	}
+	// Every chain is walked once; a folder reached twice or a looping chain
+	// stops at the first block already seen
+	std::set<int64_t> visited;
+	std::vector<int64_t> folders(1, m_root_offset);
+	PK2EntryBlock block;
 
-	// Replace a file in a pk2 with another from file
-	bool ImportFile(const char * entryFilename, const char * inputFilename)
+	while(!folders.empty())
 	{
-		if(bInit == false)
-		{
-			err.str(""); err << "Initialize has not yet been called.";
-			return false;
-		}
+		int64_t offset = folders.back();
+		folders.pop_back();
 
-		if(!bLoaded)
+		while(offset && visited.insert(offset).second)
 		{
-			err.str(""); err << "Open has not yet been called.";
-			return false;
-		}
-
-		// Pointer to the input data
-		LPBYTE updateData = 0;
-
-		// Size of the new data
-		DWORD updateDataSize = 0;
+			if(!ReadBlock(offset, block))
+			{
+				return false;
+			}
 
-		// Store the pointer to the string for asm access
-		char * pkFilePathName = (char*)entryFilename;
+			PK2LiveRange range = { offset, sizeof(PK2EntryBlock), false };
+			live.push_back(range);
 
-		// Handle to the input file
-		HANDLE hFile = 0;
+			for(int x = 0; x < 20; ++x)
+			{
+				PK2Entry & e = block.entries[x];
+				if(e.type == 1)
+				{
+					if(e.name[0] == '.' && (e.name[1] == 0 || (e.name[1] == '.' && e.name[2] == 0)))
+					{
+						continue;
+					}
+					folders.push_back(e.position);
+				}
+				else if(e.type == 2 && e.size && e.position >= 0 && e.position < m_file_size)
+				{
+					PK2LiveRange data = { e.position, e.size, true };
+					live.push_back(data);
+				}
+			}
 
-		// Try and open the settings config file to verify that it is there
-		hFile = CreateFileA(inputFilename, GENERIC_READ, 0, NULL, OPEN_EXISTING, 0, NULL);
-		if(hFile == INVALID_HANDLE_VALUE)
-		{
-			err.str(""); err << "Could not open the input file: \"" << inputFilename << "\".";
-			return false;
+			offset = block.entries[19].nextChain;
 		}
+	}
 
-		// Store file size
-		updateDataSize = GetFileSize(hFile, NULL);
-
-		// Make sure there is data to replace the entry with
-		/*if(updateDataSize == 0)
-		{
-			// Close the handle
-			CloseHandle(hFile);
-
-			err << "The replacement file must be at least 1 byte in size.";
-			return false;
-		}*/
+	std::sort(live.begin(), live.end(), LiveRangeLess);
 
-		// Vector of data to save us on memory management
-		std::vector<unsigned char> data(updateDataSize, 0);
+	int64_t end = 0;
+	size_t end_index = 0;
+	for(size_t x = 0; x < live.size(); ++x)
+	{
+		const PK2LiveRange & range = live[x];
 
-		if(updateDataSize)
+		if(range.offset < end)
 		{
-			// Allocate data for the new file
-			updateData = &data[0];
-
-			// Read in the data
-			DWORD dwRead = 0;
-			if(ReadFile(hFile, updateData, updateDataSize, &dwRead, 0) == 0)
+			// Overlapping data (such as deduplicated files) belongs to several
+			// entries, so replacing one of them must not free it
+			if(range.data)
 			{
-				// Close the handle
-				CloseHandle(hFile);
-
-				err.str(""); err << "Could not read from the input file.";
-				return false;
+				m_pinned.insert(range.offset);
 			}
-
-			// Make sure we read in all the data
-			if(dwRead != updateDataSize)
+			if(live[end_index].data)
 			{
-				// Close the handle
-				CloseHandle(hFile);
-
-				err.str(""); err << "Could not read all of the data from the input file.";
-				return false;
+				m_pinned.insert(live[end_index].offset);
 			}
 		}
+		else if(range.offset > end)
+		{
+			AddFree(end, range.offset - end);
+		}
 
-		// Close the handle
-		CloseHandle(hFile);
-
-		return ImportFile(entryFilename, updateData, updateDataSize);
+		if(range.offset + (int64_t)range.size > end)
+		{
+			end = range.offset + range.size;
+			end_index = x;
+		}
 	}
 
-	const char * GetError()
+	if(end < m_file_size)
 	{
-		error = err.str();
-		err.str("");
-		return error.c_str();
+		AddFree(end, m_file_size - end);
 	}
-};
 
-//-----------------------------------------------------------------------------
-
-// Ctor
-PK2Writer::PK2Writer()
-{
-	m_PK2WriterPIMPL = new PK2WriterPIMPL;
+	m_free_valid = true;
+	return true;
 }
 
 //-----------------------------------------------------------------------------
 
-// Dtor
-PK2Writer::~PK2Writer()
+void PK2Writer::ClearFreeMap()
 {
-	m_PK2WriterPIMPL->Close();
-	m_PK2WriterPIMPL->Deinitialize();
-	delete m_PK2WriterPIMPL;
+	m_free_valid = false;
+	m_free.clear();
+	m_free_sizes.clear();
+	m_pinned.clear();
+	m_pending_free.clear();
 }
 
 //-----------------------------------------------------------------------------
 
-bool PK2Writer::Initialize(std::string gfxDllFilename)
+void PK2Writer::EraseFree(std::map<int64_t, uint64_t>::iterator itr)
 {
-	return m_PK2WriterPIMPL->Initialize(gfxDllFilename);
+	std::pair<std::multimap<uint64_t, int64_t>::iterator, std::multimap<uint64_t, int64_t>::iterator> sizes = m_free_sizes.equal_range(itr->second);
+	for(std::multimap<uint64_t, int64_t>::iterator size = sizes.first; size != sizes.second; ++size)
+	{
+		if(size->second == itr->first)
+		{
+			m_free_sizes.erase(size);
+			break;
+		}
+	}
+	m_free.erase(itr);
 }
 
 //-----------------------------------------------------------------------------
 
-bool PK2Writer::Deinitialize()
+void PK2Writer::AddFree(int64_t offset, uint64_t size)
 {
-	return m_PK2WriterPIMPL->Deinitialize();
-}
+	if(size == 0)
+	{
+		return;
+	}
 
-//-----------------------------------------------------------------------------
+	// Merge with the free ranges on either side
+	std::map<int64_t, uint64_t>::iterator next = m_free.lower_bound(offset);
+	if(next != m_free.end() && next->first == offset + (int64_t)size)
+	{
+		size += next->second;
+		EraseFree(next++);
+	}
+	if(next != m_free.begin())
+	{
+		std::map<int64_t, uint64_t>::iterator prev = next;
+		--prev;
+		if(prev->first + (int64_t)prev->second == offset)
+		{
+			offset = prev->first;
+			size += prev->second;
+			EraseFree(prev);
+		}
+	}
 
-bool PK2Writer::Open(std::string pk2Filename, void * accessKey, unsigned char accessKeyLen)
-{
-	return m_PK2WriterPIMPL->Open(pk2Filename, accessKey, accessKeyLen);
+	m_free[offset] = size;
+	m_free_sizes.insert(std::make_pair(size, offset));
 }
 
 //-----------------------------------------------------------------------------
 
-bool PK2Writer::Close()
+int64_t PK2Writer::Allocate(uint64_t size)
 {
-	return m_PK2WriterPIMPL->Close();
+	if(size == 0)
+	{
+		return m_file_size;
+	}
+
+	// Best fit: the smallest free range that is large enough
+	std::multimap<uint64_t, int64_t>::iterator fit = m_free_sizes.lower_bound(size);
+	if(fit != m_free_sizes.end())
+	{
+		int64_t offset = fit->second;
+		uint64_t free_size = fit->first;
+		EraseFree(m_free.find(offset));
+		AddFree(offset + size, free_size - size);
+		return offset;
+	}
+
+	// Nothing fits, so grow the archive, starting in the free range at its end
+	int64_t offset = m_file_size;
+	if(!m_free.empty())
+	{
+		std::map<int64_t, uint64_t>::iterator last = --m_free.end();
+		if(last->first + (int64_t)last->second == m_file_size)
+		{
+			offset = last->first;
+			EraseFree(last);
+		}
+	}
+	m_file_size = offset + size;
+	return offset;
 }
 
 //-----------------------------------------------------------------------------
 
-bool PK2Writer::ImportFile(const char * entryFilename, const char * inputFilename)
+void PK2Writer::Release(int64_t offset, uint64_t size)
 {
-	return m_PK2WriterPIMPL->ImportFile(entryFilename, inputFilename);
+	if(size == 0 || m_pinned.count(offset))
+	{
+		return;
+	}
+	m_pending_free.push_back(std::make_pair(offset, size));
 }
 
 //-----------------------------------------------------------------------------
 
-bool PK2Writer::ImportFile(const char * entryFilename, void * fileBuffer, int fileSize)
+bool PK2Writer::ResolvePath(const std::string & path, int64_t & folder_offset, int64_t & entry_offset, std::string & name, std::string & lower_path)
 {
-	return m_PK2WriterPIMPL->ImportFile(entryFilename, fileBuffer, fileSize);
+	std::list<std::string> folders;
+	if(!SplitPath(path, folders, name) || !FindFolder(folders, folder_offset))
+	{
+		return false;
+	}
+
+	lower_path.clear();
+	for(std::list<std::string>::iterator itr = folders.begin(); itr != folders.end(); ++itr)
+	{
+		lower_path += *itr + "\\";
+	}
+	lower_path += name;
+	std::transform(lower_path.begin(), lower_path.end(), lower_path.begin(), tolower);
+
+	std::string lower_name = name;
+	std::transform(lower_name.begin(), lower_name.end(), lower_name.begin(), tolower);
+	return FindInFolder(folder_offset, lower_name, entry_offset);
 }
 
 //-----------------------------------------------------------------------------
 
-const char * PK2Writer::GetError()
+bool PK2Writer::ReleaseFolder(int64_t folder_offset)
 {
-	return m_PK2WriterPIMPL->GetError();
+	// Everything below the folder goes, its blocks included
+	std::set<int64_t> visited;
+	std::vector<int64_t> folders(1, folder_offset);
+	PK2EntryBlock block;
+
+	while(!folders.empty())
+	{
+		int64_t offset = folders.back();
+		folders.pop_back();
+
+		while(offset && visited.insert(offset).second)
+		{
+			if(!ReadBlock(offset, block))
+			{
+				return false;
+			}
+
+			for(int x = 0; x < 20; ++x)
+			{
+				PK2Entry & e = block.entries[x];
+				if(e.type == 1)
+				{
+					if(e.name[0] == '.' && (e.name[1] == 0 || (e.name[1] == '.' && e.name[2] == 0)))
+					{
+						continue;
+					}
+					folders.push_back(e.position);
+				}
+				else if(e.type == 2)
+				{
+					Release(e.position, e.size);
+				}
+			}
+
+			Release(offset, sizeof(PK2EntryBlock));
+			m_freed_blocks.insert(offset);
+			offset = block.entries[19].nextChain;
+		}
+	}
+
+	return true;
+}
+
+//-----------------------------------------------------------------------------
+
+bool PK2Writer::SplitPath(const std::string & path, std::list<std::string> & folders, std::string & name)
+{
+	std::string base_name = path;
+	std::transform(base_name.begin(), base_name.end(), base_name.begin(), MakePathSlashWindows_2);
+
+	folders = TokenizeString_2(base_name, "\\");
+	if(folders.empty())
+	{
+		m_error.str(""); m_error << "Invalid entry name.";
+		return false;
+	}
+
+	name = folders.back();
+	folders.pop_back();
+
+	if(name.size() >= sizeof(((PK2Entry *)0)->name))
+	{
+		m_error.str(""); m_error << "The entry name \"" << name << "\" is too long.";
+		return false;
+	}
+
+	return true;
+}
+
+//-----------------------------------------------------------------------------
+
+std::string PK2Writer::GetJournalFilename()
+{
+	return m_filename + ".journal";
+}
+
+//-----------------------------------------------------------------------------
+
+// Reads the bytes at 'offset' as they are on disk. Anything past 'file_size'
+// has not been written yet and reads as zeros.
+bool PK2Writer::ReadImage(int64_t offset, uint64_t size, int64_t file_size, uint8_t * image)
+{
+	memset(image, 0, (size_t)size);
+	if(offset >= file_size)
+	{
+		return true;
+	}
+
+	size_t count = (size_t)std::min<uint64_t>(size, (uint64_t)(file_size - offset));
+	if(file_seek(m_file, offset, SEEK_SET) != 0 || fread(image, 1, count, m_file) != count)
+	{
+		m_error.str(""); m_error << "Could not read " << count << " bytes at " << offset << ".";
+		return false;
+	}
+	return true;
+}
+
+//-----------------------------------------------------------------------------
+
+bool PK2Writer::WriteJournal(const std::vector<PK2WriteRun> & runs)
+{
+	file_seek(m_file, 0, SEEK_END);
+	int64_t archive_size = file_tell(m_file);
+
+	// Only directory blocks go through the journal, so it is a few KB even for
+	// large patches and is built in memory. Keeping what each block replaces
+	// lets a replay tell this archive from another one of the same name.
+	std::vector<uint8_t> body;
+	std::vector<uint8_t> before;
+	for(size_t x = 0; x < runs.size(); ++x)
+	{
+		const PK2WriteRun & run = runs[x];
+		const uint8_t * offset = reinterpret_cast<const uint8_t *>(&run.offset);
+		const uint8_t * size = reinterpret_cast<const uint8_t *>(&run.size);
+		before.resize((size_t)run.size);
+		if(!ReadImage(run.offset, run.size, archive_size, &before[0]))
+		{
+			return false;
+		}
+		body.insert(body.end(), offset, offset + sizeof(int64_t));
+		body.insert(body.end(), size, size + sizeof(uint64_t));
+		body.insert(body.end(), before.begin(), before.end());
+		body.insert(body.end(), run.data, run.data + run.size);
+	}
+
+	PK2JournalHeader header;
+	memset(&header, 0, sizeof(PK2JournalHeader));
+	memcpy(header.magic, "PK2JRNL", 7);
+	header.version = 2;
+	header.record_count = (uint32_t)runs.size();
+	header.body_size = body.size();
+	header.checksum = body.empty() ? 0 : XXH3_64bits(&body[0], body.size());
+	header.archive_size = (uint64_t)archive_size;
+	header.header_xxh3 = XXH3_64bits(&m_header, sizeof(PK2Header));
+
+	std::string filename = GetJournalFilename();
+	FILE * journal = file_open(filename.c_str(), "wb");
+	if(journal == 0)
+	{
+		m_error.str(""); m_error << "Could not create the journal \"" << filename << "\".";
+		return false;
+	}
+
+	bool written = fwrite(&header, 1, sizeof(PK2JournalHeader), journal) == sizeof(PK2JournalHeader);
+	written = written && (body.empty() || fwrite(&body[0], 1, body.size(), journal) == body.size());
+	written = written && file_sync(journal) == 0;
+	fclose(journal);
+
+	// A journal whose folder entry is lost in a crash cannot be replayed
+	written = written && file_sync_dir(filename.c_str()) == 0;
+
+	if(!written)
+	{
+		file_remove(filename.c_str());
+		m_error.str(""); m_error << "Could not write the journal \"" << filename << "\".";
+		return false;
+	}
+
+	return true;
+}
+
+//-----------------------------------------------------------------------------
+
+bool PK2Writer::RemoveJournal()
+{
+	std::string filename = GetJournalFilename();
+	if(file_remove(filename.c_str()) == 0)
+	{
+		// Otherwise the journal could come back after a crash and be replayed
+		// over later changes
+		file_sync_dir(filename.c_str());
+		return true;
+	}
+
+	// A journal left behind would be replayed over later changes, so at least
+	// make it invalid
+	FILE * journal = file_open(filename.c_str(), "wb");
+	if(journal)
+	{
+		fclose(journal);
+		return true;
+	}
+
+	m_error.str(""); m_error << "Could not remove the journal \"" << filename << "\".";
+	return false;
+}
+
+//-----------------------------------------------------------------------------
+
+// Returns 1 if the journal was written for the open archive, 0 if it was not
+// and -1 if the archive could not be read.
+int PK2Writer::MatchJournal(const PK2JournalHeader & header, const std::vector<uint8_t> & body)
+{
+	if(header.header_xxh3 != XXH3_64bits(&m_header, sizeof(PK2Header)))
+	{
+		return 0;
+	}
+
+	// Writing the journaled blocks can only grow the file up to the end of the
+	// last block appended
+	file_seek(m_file, 0, SEEK_END);
+	int64_t file_size = file_tell(m_file);
+	int64_t largest_size = (int64_t)header.archive_size;
+	for(uint32_t x = 0; x < header.record_count; ++x)
+	{
+		int64_t offset = 0;
+		memcpy(&offset, &body[x * journal_record_size], sizeof(int64_t));
+		largest_size = std::max(largest_size, offset + (int64_t)sizeof(PK2EntryBlock));
+	}
+	if(file_size < (int64_t)header.archive_size || file_size > largest_size)
+	{
+		return 0;
+	}
+
+	PK2EntryBlock current;
+	for(uint32_t x = 0; x < header.record_count; ++x)
+	{
+		const uint8_t * record = &body[x * journal_record_size];
+		const uint8_t * before = record + sizeof(int64_t) + sizeof(uint64_t);
+		const uint8_t * after = before + sizeof(PK2EntryBlock);
+		int64_t offset = 0;
+		memcpy(&offset, record, sizeof(int64_t));
+
+		uint8_t * bytes = reinterpret_cast<uint8_t *>(&current);
+		if(!ReadImage(offset, sizeof(PK2EntryBlock), file_size, bytes))
+		{
+			return -1;
+		}
+
+		// Sectors are counted from the start of the file, blocks are not aligned to them
+		size_t length = 0;
+		for(size_t y = 0; y < sizeof(PK2EntryBlock); y += length)
+		{
+			length = journal_sector_size - (size_t)((offset + y) % journal_sector_size);
+			length = std::min(length, sizeof(PK2EntryBlock) - y);
+			if(memcmp(bytes + y, before + y, length) != 0 && memcmp(bytes + y, after + y, length) != 0)
+			{
+				return 0;
+			}
+		}
+	}
+
+	return 1;
+}
+
+//-----------------------------------------------------------------------------
+
+bool PK2Writer::ReplayJournal()
+{
+	std::string filename = GetJournalFilename();
+	FILE * journal = file_open(filename.c_str(), "rb");
+	if(journal == 0)
+	{
+		return true;
+	}
+
+	file_seek(journal, 0, SEEK_END);
+	int64_t journal_size = file_tell(journal);
+	file_seek(journal, 0, SEEK_SET);
+
+	PK2JournalHeader header;
+	std::vector<uint8_t> body;
+	bool complete = fread(&header, 1, sizeof(PK2JournalHeader), journal) == sizeof(PK2JournalHeader);
+	complete = complete && memcmp(header.magic, "PK2JRNL", 8) == 0 && header.version == 2;
+	complete = complete && header.body_size == (uint64_t)header.record_count * journal_record_size;
+	complete = complete && header.body_size == (uint64_t)(journal_size - sizeof(PK2JournalHeader));
+	if(complete && header.body_size)
+	{
+		body.resize((size_t)header.body_size);
+		complete = fread(&body[0], 1, body.size(), journal) == body.size();
+		complete = complete && XXH3_64bits(&body[0], body.size()) == header.checksum;
+	}
+	fclose(journal);
+
+	// A journal that is not complete was cut short before anything in the
+	// archive was changed in place, so dropping it rolls the Commit back
+	if(complete)
+	{
+		for(uint32_t x = 0; x < header.record_count; ++x)
+		{
+			const uint8_t * record = &body[x * journal_record_size];
+			int64_t offset = 0;
+			uint64_t size = 0;
+			memcpy(&offset, record, sizeof(int64_t));
+			memcpy(&size, record + sizeof(int64_t), sizeof(uint64_t));
+
+			if(offset < m_root_offset || size != sizeof(PK2EntryBlock))
+			{
+				m_error.str(""); m_error << "The journal \"" << filename << "\" is damaged.";
+				return false;
+			}
+		}
+
+		int matched = MatchJournal(header, body);
+		if(matched < 0)
+		{
+			return false;
+		}
+
+		// A journal of some other archive, such as one downloaded again after the
+		// crash, would overwrite its directory with blocks that do not belong
+		// there. It is dropped and the archive is left as it is.
+		complete = matched == 1;
+	}
+
+	if(complete)
+	{
+		for(uint32_t x = 0; x < header.record_count; ++x)
+		{
+			const uint8_t * record = &body[x * journal_record_size];
+			int64_t offset = 0;
+			memcpy(&offset, record, sizeof(int64_t));
+
+			if(!WriteData(offset, record + sizeof(int64_t) + sizeof(uint64_t) + sizeof(PK2EntryBlock), sizeof(PK2EntryBlock)))
+			{
+				return false;
+			}
+		}
+
+		if(header.record_count && file_sync(m_file) != 0)
+		{
+			m_error.str(""); m_error << "Could not flush the PK2 to disk.";
+			return false;
+		}
+	}
+
+	return RemoveJournal();
+}
+
+//-----------------------------------------------------------------------------
+
+bool PK2Writer::Open(std::string pk2Filename, const void * accessKey, uint8_t accessKeyLen, const char * base_key, uint8_t base_key_length)
+{
+	if(m_file)
+	{
+		m_error.str(""); m_error << "There is already a PK2 opened.";
+		return false;
+	}
+
+	if(accessKeyLen == 0 || accessKeyLen > 56)
+	{
+		m_error.str(""); m_error << "The key length may only be 1 - 56 bytes long.";
+		return false;
+	}
+
+#if _WIN32
+	while(pk2Filename.find("/") != std::string::npos)
+		pk2Filename.replace(pk2Filename.find("/"), 1, "\\");
+#endif
+
+	m_file = file_open(pk2Filename.c_str(), "r+b");
+	if(m_file == 0)
+	{
+		m_error.str(""); m_error << "Could not open the file \"" << pk2Filename << "\".";
+		return false;
+	}
+
+	if(fread(&m_header, 1, sizeof(PK2Header), m_file) != sizeof(PK2Header))
+	{
+		fclose(m_file);
+		m_file = 0;
+		m_error.str(""); m_error << "Could not read the PK2 header.";
+		return false;
+	}
+
+	char name[30] = {0};
+	memcpy(name, "JoyMax File Manager!\n", 21);
+	if(memcmp(name, m_header.name, 30) != 0)
+	{
+		fclose(m_file);
+		m_file = 0;
+		m_error.str(""); m_error << "Invalid PK2 name.";
+		return false;
+	}
+
+	if(m_header.version != 0x01000002)
+	{
+		fclose(m_file);
+		m_file = 0;
+		m_error.str(""); m_error << "Invalid PK2 version.";
+		return false;
+	}
+
+	if(m_header.encryption)
+	{
+		uint8_t bf_key[56] = { 0x00 };
+		uint8_t bf_key_length = DeriveBlowfishKey(reinterpret_cast<const char *>(accessKey), accessKeyLen, base_key, base_key_length, bf_key);
+		m_blowfish.Initialize(bf_key, bf_key_length);
+
+		uint8_t verify[16] = {0};
+		m_blowfish.Encode("Joymax Pak File", 16, verify, 16);
+		memset(verify + 3, 0, 13); // PK2s only store 1st 3 bytes
+
+		if(memcmp(verify, m_header.verify, 16) != 0)
+		{
+			fclose(m_file);
+			m_file = 0;
+			m_error.str(""); m_error << "Invalid Blowfish key.";
+			return false;
+		}
+	}
+
+	m_root_offset = sizeof(PK2Header);
+	m_filename = pk2Filename;
+
+	// Finish or drop a Commit that was cut short
+	if(!ReplayJournal())
+	{
+		fclose(m_file);
+		m_file = 0;
+		m_filename.clear();
+		return false;
+	}
+
+	file_seek(m_file, 0, SEEK_END);
+	m_file_size = file_tell(m_file);
+
+	if(m_file_size < m_root_offset + (int64_t)sizeof(PK2EntryBlock))
+	{
+		fclose(m_file);
+		m_file = 0;
+		m_filename.clear();
+		m_error.str(""); m_error << "The PK2 has no root directory.";
+		return false;
+	}
+
+	return true;
+}
+
+//-----------------------------------------------------------------------------
+
+bool PK2Writer::Close()
+{
+	if(m_file == 0)
+	{
+		m_error.str(""); m_error << "There is no PK2 loaded yet.";
+		return false;
+	}
+
+	Rollback();
+
+	bool flushed = fflush(m_file) == 0;
+	fclose(m_file);
+
+	m_file = 0;
+	m_filename.clear();
+	m_file_size = 0;
+	ClearFreeMap();
+	memset(&m_header, 0, sizeof(PK2Header));
+
+	if(!flushed)
+	{
+		m_error.str(""); m_error << "Could not flush the PK2 to disk.";
+		return false;
+	}
+
+	return true;
+}
+
+//-----------------------------------------------------------------------------
+
+bool PK2Writer::BeginTransaction()
+{
+	if(m_file == 0)
+	{
+		m_error.str(""); m_error << "There is no PK2 loaded yet.";
+		return false;
+	}
+
+	if(m_transaction)
+	{
+		m_error.str(""); m_error << "A transaction is already open.";
+		return false;
+	}
+
+	m_transaction = true;
+	return true;
+}
+
+//-----------------------------------------------------------------------------
+
+bool PK2Writer::Stage(const char * entryFilename, std::vector<uint8_t> & data)
+{
+	if(!m_transaction)
+	{
+		m_error.str(""); m_error << "There is no transaction open.";
+		return false;
+	}
+
+	if(data.size() > 0xFFFFFFFF)
+	{
+		m_error.str(""); m_error << "The data for \"" << entryFilename << "\" is too large for a PK2 entry.";
+		return false;
+	}
+
+	std::list<std::string> folders;
+	std::string name;
+	if(!SplitPath(entryFilename, folders, name))
+	{
+		return false;
+	}
+
+	std::string key;
+	for(std::list<std::string>::iterator itr = folders.begin(); itr != folders.end(); ++itr)
+	{
+		key += *itr + "\\";
+	}
+	key += name;
+	std::string path = key;
+	std::transform(key.begin(), key.end(), key.begin(), tolower);
+
+	std::map<std::string, size_t>::iterator itr = m_staged_index.find(key);
+	if(itr != m_staged_index.end())
+	{
+		m_staged[itr->second].data.swap(data);
+		return true;
+	}
+
+	m_staged_index[key] = m_staged.size();
+	m_staged.push_back(PK2StagedFile());
+	m_staged.back().path = path;
+	m_staged.back().data.swap(data);
+
+	return true;
+}
+
+//-----------------------------------------------------------------------------
+
+bool PK2Writer::StageFile(const char * entryFilename, const void * fileBuffer, uint32_t fileSize)
+{
+	const uint8_t * buffer = reinterpret_cast<const uint8_t *>(fileBuffer);
+	std::vector<uint8_t> data(buffer, buffer + fileSize);
+	return Stage(entryFilename, data);
+}
+
+//-----------------------------------------------------------------------------
+
+bool PK2Writer::StageFile(const char * entryFilename, std::vector<uint8_t> & data)
+{
+	return Stage(entryFilename, data);
+}
+
+//-----------------------------------------------------------------------------
+
+bool PK2Writer::StageFile(const char * entryFilename, const char * inputFilename)
+{
+	FILE * infile = file_open(inputFilename, "rb");
+	if(infile == 0)
+	{
+		m_error.str(""); m_error << "Could not open the input file: \"" << inputFilename << "\".";
+		return false;
+	}
+
+	file_seek(infile, 0, SEEK_END);
+	int64_t size = file_tell(infile);
+	file_seek(infile, 0, SEEK_SET);
+
+	if(size < 0 || size > 0xFFFFFFFFLL)
+	{
+		fclose(infile);
+		m_error.str(""); m_error << "The input file \"" << inputFilename << "\" is too large for a PK2 entry.";
+		return false;
+	}
+
+	std::vector<uint8_t> data((size_t)size);
+	if(size && fread(&data[0], 1, (size_t)size, infile) != (size_t)size)
+	{
+		fclose(infile);
+		m_error.str(""); m_error << "Could not read all of the data from the input file.";
+		return false;
+	}
+	fclose(infile);
+
+	return Stage(entryFilename, data);
+}
+
+//-----------------------------------------------------------------------------
+
+void PK2Writer::BeginUpdate()
+{
+	m_blocks.clear();
+	m_dirty_blocks.clear();
+	m_pending_free.clear();
+	m_freed_blocks.clear();
+	m_stale_paths.clear();
+
+	// A damaged chain somewhere else should not stop updates, new data is just
+	// appended until the map can be built
+	if(!m_free_valid && !BuildFreeMap())
+	{
+		ClearFreeMap();
+		m_error.str("");
+	}
+}
+
+//-----------------------------------------------------------------------------
+
+void PK2Writer::AbortUpdate(int64_t original_size)
+{
+	m_file_size = original_size;
+	ClearFreeMap();
+	m_blocks.clear();
+	m_dirty_blocks.clear();
+	m_freed_blocks.clear();
+	m_stale_paths.clear();
+}
+
+//-----------------------------------------------------------------------------
+
+bool PK2Writer::WriteDirectory()
+{
+	if(m_dirty_blocks.empty())
+	{
+		return true;
+	}
+
+	std::vector<PK2EntryBlock> encoded;
+	encoded.reserve(m_dirty_blocks.size());
+	std::vector<PK2WriteRun> runs;
+	for(std::set<int64_t>::iterator itr = m_dirty_blocks.begin(); itr != m_dirty_blocks.end(); ++itr)
+	{
+		encoded.push_back(m_blocks[*itr]);
+		if(m_header.encryption)
+		{
+			m_blowfish.EncodeBlocks(&encoded.back(), &encoded.back(), sizeof(PK2EntryBlock) / 8);
+		}
+		PK2WriteRun run = { *itr, reinterpret_cast<const uint8_t *>(&encoded.back()), sizeof(PK2EntryBlock) };
+		runs.push_back(run);
+	}
+
+	if(!WriteJournal(runs))
+	{
+		return false;
+	}
+
+	bool written = WriteRuns(runs);
+	if(written && file_sync(m_file) != 0)
+	{
+		m_error.str(""); m_error << "Could not flush the PK2 to disk.";
+		written = false;
+	}
+	written = written && RemoveJournal();
+
+	if(!written)
+	{
+		// The journal holds the whole new directory, so try once more from it
+		std::string error = m_error.str();
+		if(!ReplayJournal())
+		{
+			Close();
+			m_error.str(""); m_error << error << " The PK2 was closed; its journal is replayed when it is opened again.";
+			return false;
+		}
+		m_error.str("");
+	}
+
+	return true;
+}
+
+//-----------------------------------------------------------------------------
+
+bool PK2Writer::FinishUpdate(bool written)
+{
+	if(m_file == 0)
+	{
+		// WriteDirectory had to give up and closed the PK2
+		written = false;
+	}
+	else if(written)
+	{
+		for(size_t x = 0; x < m_pending_free.size(); ++x)
+		{
+			AddFree(m_pending_free[x].first, m_pending_free[x].second);
+		}
+		m_pending_free.clear();
+
+		if(m_reader)
+		{
+			PK2DirectoryUpdate update;
+			for(std::set<int64_t>::iterator itr = m_dirty_blocks.begin(); itr != m_dirty_blocks.end(); ++itr)
+			{
+				update.blocks[*itr] = m_blocks[*itr];
+			}
+			update.freed_blocks = m_freed_blocks;
+			update.stale_paths.swap(m_stale_paths);
+			update.file_size = m_file_size;
+
+			if(!m_reader->ApplyDirectoryUpdate(update))
+			{
+				m_error.str(""); m_error << "The PK2 was written but the attached reader could not follow: " << m_reader->GetError();
+				written = false;
+			}
+		}
+	}
+	else
+	{
+		// Part of the update may be on disk; the real size is whatever the file says
+		file_seek(m_file, 0, SEEK_END);
+		m_file_size = file_tell(m_file);
+		ClearFreeMap();
+	}
+
+	m_blocks.clear();
+	m_dirty_blocks.clear();
+	m_freed_blocks.clear();
+	m_stale_paths.clear();
+
+	return written;
+}
+
+//-----------------------------------------------------------------------------
+
+bool PK2Writer::Commit()
+{
+	if(!m_transaction)
+	{
+		m_error.str(""); m_error << "There is no transaction open.";
+		return false;
+	}
+
+	int64_t original_size = m_file_size;
+	std::vector<int64_t> positions(m_staged.size(), 0);
+	uint64_t now = WindowsTimeNow();
+	bool resolved = true;
+
+	BeginUpdate();
+
+	// Resolve every path and edit the directory in memory. Nothing is written
+	// yet, so a missing folder or a damaged chain leaves the archive untouched.
+	for(size_t x = 0; x < m_staged.size() && resolved; ++x)
+	{
+		PK2StagedFile & staged = m_staged[x];
+		uint32_t size = (uint32_t)staged.data.size();
+
+		std::list<std::string> folders;
+		std::string name;
+		int64_t folder_offset = 0;
+		int64_t entry_offset = 0;
+
+		resolved = SplitPath(staged.path, folders, name) && FindFolder(folders, folder_offset);
+		if(!resolved)
+		{
+			break;
+		}
+
+		std::string lower_name = name;
+		std::transform(lower_name.begin(), lower_name.end(), lower_name.begin(), tolower);
+		resolved = FindInFolder(folder_offset, lower_name, entry_offset);
+		if(!resolved)
+		{
+			break;
+		}
+
+		if(entry_offset)
+		{
+			PK2Entry & entry = EditEntry(entry_offset);
+			if(entry.type != 2)
+			{
+				m_error.str(""); m_error << "The entry \"" << staged.path << "\" is a folder.";
+				resolved = false;
+				break;
+			}
+
+			// The old data stays intact until the new directory is on disk
+			Release(entry.position, entry.size);
+			entry.position = Allocate(size);
+			entry.size = size;
+			entry.modifyTime = now;
+			entry.accessTime = now;
+			positions[x] = entry.position;
+		}
+		else
+		{
+			PK2Entry entry;
+			memset(&entry, 0, sizeof(PK2Entry));
+			entry.type = 2;
+			memcpy(entry.name, name.c_str(), name.size());
+			entry.createTime = now;
+			entry.modifyTime = now;
+			entry.accessTime = now;
+			entry.position = Allocate(size);
+			entry.size = size;
+			positions[x] = entry.position;
+
+			resolved = AddToFolder(folder_offset, entry, entry_offset);
+		}
+	}
+
+	if(!resolved)
+	{
+		AbortUpdate(original_size);
+		Rollback();
+		return false;
+	}
+
+	for(std::map<std::string, size_t>::iterator itr = m_staged_index.begin(); itr != m_staged_index.end(); ++itr)
+	{
+		m_stale_paths.push_back(itr->first);
+	}
+
+	// File data first, so no entry ever points at data that is not there yet.
+	// None of it overwrites anything the directory on disk points at.
+	std::vector<PK2WriteRun> runs;
+	runs.reserve(m_staged.size());
+	for(size_t x = 0; x < m_staged.size(); ++x)
+	{
+		if(!m_staged[x].data.empty())
+		{
+			PK2WriteRun run = { positions[x], &m_staged[x].data[0], m_staged[x].data.size() };
+			runs.push_back(run);
+		}
+	}
+	bool written = WriteRuns(runs);
+
+	if(written && !runs.empty() && file_sync(m_file) != 0)
+	{
+		m_error.str(""); m_error << "Could not flush the PK2 to disk.";
+		written = false;
+	}
+
+	// Then each changed directory block, once, through the journal
+	written = written && WriteDirectory();
+
+	written = FinishUpdate(written);
+	Rollback();
+
+	return written;
+}
+
+//-----------------------------------------------------------------------------
+
+void PK2Writer::Rollback()
+{
+	m_staged.clear();
+	m_staged_index.clear();
+	m_transaction = false;
+}
+
+//-----------------------------------------------------------------------------
+
+void PK2Writer::AttachReader(PK2Reader * reader)
+{
+	m_reader = reader;
+}
+
+//-----------------------------------------------------------------------------
+
+bool PK2Writer::DeleteEntry(const char * entryName)
+{
+	if(m_file == 0)
+	{
+		m_error.str(""); m_error << "There is no PK2 loaded yet.";
+		return false;
+	}
+
+	int64_t original_size = m_file_size;
+	int64_t folder_offset = 0;
+	int64_t entry_offset = 0;
+	std::string name;
+	std::string path;
+
+	BeginUpdate();
+
+	bool resolved = ResolvePath(entryName, folder_offset, entry_offset, name, path);
+	if(resolved && (entry_offset == 0 || name == "." || name == ".."))
+	{
+		m_error.str(""); m_error << "The entry \"" << entryName << "\" does not exist.";
+		resolved = false;
+	}
+
+	if(resolved)
+	{
+		PK2Entry & entry = EditEntry(entry_offset);
+		if(entry.type == 1)
+		{
+			resolved = ReleaseFolder(entry.position);
+		}
+		else
+		{
+			Release(entry.position, entry.size);
+		}
+
+		// Leave a null entry behind for the next file added to the folder. The
+		// last slot of a block carries the chain link, which has to survive.
+		int64_t next_chain = entry.nextChain;
+		memset(&entry, 0, sizeof(PK2Entry));
+		entry.nextChain = next_chain;
+	}
+
+	if(!resolved)
+	{
+		AbortUpdate(original_size);
+		return false;
+	}
+
+	m_stale_paths.push_back(path);
+	return FinishUpdate(WriteDirectory());
+}
+
+//-----------------------------------------------------------------------------
+
+bool PK2Writer::MoveEntry(const char * entryName, const char * newEntryName)
+{
+	if(m_file == 0)
+	{
+		m_error.str(""); m_error << "There is no PK2 loaded yet.";
+		return false;
+	}
+
+	int64_t original_size = m_file_size;
+	int64_t folder_offset = 0;
+	int64_t entry_offset = 0;
+	int64_t new_folder_offset = 0;
+	int64_t new_entry_offset = 0;
+	std::string name;
+	std::string new_name;
+	std::string path;
+	std::string new_path;
+
+	BeginUpdate();
+
+	bool resolved = ResolvePath(entryName, folder_offset, entry_offset, name, path);
+	if(resolved && (entry_offset == 0 || name == "." || name == ".."))
+	{
+		m_error.str(""); m_error << "The entry \"" << entryName << "\" does not exist.";
+		resolved = false;
+	}
+
+	resolved = resolved && ResolvePath(newEntryName, new_folder_offset, new_entry_offset, new_name, new_path);
+	if(resolved && new_entry_offset && new_entry_offset != entry_offset)
+	{
+		m_error.str(""); m_error << "The entry \"" << newEntryName << "\" already exists.";
+		resolved = false;
+	}
+	if(resolved && (new_name == "." || new_name == ".."))
+	{
+		m_error.str(""); m_error << "Invalid entry name.";
+		resolved = false;
+	}
+
+	// A folder cannot go inside itself
+	if(resolved && LoadedEntry(entry_offset).type == 1 && new_path.compare(0, path.size() + 1, path + "\\") == 0)
+	{
+		m_error.str(""); m_error << "The folder \"" << entryName << "\" cannot be moved inside itself.";
+		resolved = false;
+	}
+
+	if(resolved && new_folder_offset == folder_offset)
+	{
+		// A rename, the entry stays where it is
+		PK2Entry & entry = EditEntry(entry_offset);
+		memset(entry.name, 0, sizeof(entry.name));
+		memcpy(entry.name, new_name.c_str(), new_name.size());
+	}
+	else if(resolved)
+	{
+		PK2Entry moved = LoadedEntry(entry_offset);
+		memset(moved.name, 0, sizeof(moved.name));
+		memcpy(moved.name, new_name.c_str(), new_name.size());
+
+		resolved = AddToFolder(new_folder_offset, moved, new_entry_offset);
+		if(resolved)
+		{
+			PK2Entry & entry = EditEntry(entry_offset);
+			int64_t next_chain = entry.nextChain;
+			memset(&entry, 0, sizeof(PK2Entry));
+			entry.nextChain = next_chain;
+		}
+
+		// A moved folder's ".." has to point at its new parent
+		if(resolved && moved.type == 1)
+		{
+			int64_t parent_offset = 0;
+			resolved = FindInFolder(moved.position, "..", parent_offset);
+			if(resolved && parent_offset)
+			{
+				EditEntry(parent_offset).position = new_folder_offset;
+			}
+		}
+	}
+
+	if(!resolved)
+	{
+		AbortUpdate(original_size);
+		return false;
+	}
+
+	m_stale_paths.push_back(path);
+	m_stale_paths.push_back(new_path);
+	return FinishUpdate(WriteDirectory());
+}
+
+//-----------------------------------------------------------------------------
+
+bool PK2Writer::RenameEntry(const char * entryName, const char * newName)
+{
+	std::string new_path = entryName;
+	std::transform(new_path.begin(), new_path.end(), new_path.begin(), MakePathSlashWindows_2);
+	while(!new_path.empty() && new_path[new_path.size() - 1] == '\\')
+	{
+		new_path.erase(new_path.size() - 1);
+	}
+
+	size_t slash = new_path.find_last_of('\\');
+	new_path = (slash == std::string::npos ? std::string() : new_path.substr(0, slash + 1)) + newName;
+
+	if(strchr(newName, '\\') || strchr(newName, '/'))
+	{
+		m_error.str(""); m_error << "Invalid entry name.";
+		return false;
+	}
+
+	return MoveEntry(entryName, new_path.c_str());
+}
+
+//-----------------------------------------------------------------------------
+
+bool PK2Writer::MakeDirectory(const char * folderName)
+{
+	if(m_file == 0)
+	{
+		m_error.str(""); m_error << "There is no PK2 loaded yet.";
+		return false;
+	}
+
+	std::string base_name = folderName;
+	std::transform(base_name.begin(), base_name.end(), base_name.begin(), MakePathSlashWindows_2);
+	std::list<std::string> tokens = TokenizeString_2(base_name, "\\");
+	if(tokens.empty())
+	{
+		m_error.str(""); m_error << "Invalid entry name.";
+		return false;
+	}
+
+	int64_t original_size = m_file_size;
+	int64_t folder_offset = m_root_offset;
+	uint64_t now = WindowsTimeNow();
+	std::string path;
+	bool resolved = true;
+
+	BeginUpdate();
+
+	// Every missing folder on the way is created, existing ones are kept
+	for(std::list<std::string>::iterator itr = tokens.begin(); itr != tokens.end() && resolved; ++itr)
+	{
+		std::string lower_name = *itr;
+		std::transform(lower_name.begin(), lower_name.end(), lower_name.begin(), tolower);
+		path += (path.empty() ? "" : "\\") + lower_name;
+
+		if(itr->size() >= sizeof(((PK2Entry *)0)->name) || lower_name == "." || lower_name == "..")
+		{
+			m_error.str(""); m_error << "Invalid entry name \"" << *itr << "\".";
+			resolved = false;
+			break;
+		}
+
+		int64_t entry_offset = 0;
+		resolved = FindInFolder(folder_offset, lower_name, entry_offset);
+		if(!resolved)
+		{
+			break;
+		}
+
+		if(entry_offset)
+		{
+			const PK2Entry & entry = LoadedEntry(entry_offset);
+			if(entry.type != 1)
+			{
+				m_error.str(""); m_error << "\"" << path << "\" is a file.";
+				resolved = false;
+				break;
+			}
+			folder_offset = entry.position;
+			continue;
+		}
+
+		PK2Entry entry;
+		memset(&entry, 0, sizeof(PK2Entry));
+		entry.type = 1;
+		entry.createTime = now;
+		entry.modifyTime = now;
+		entry.accessTime = now;
+		entry.position = Allocate(sizeof(PK2EntryBlock));
+
+		PK2EntryBlock & block = m_blocks[entry.position];
+		memset(&block, 0, sizeof(PK2EntryBlock));
+		block.entries[0] = entry;
+		block.entries[0].name[0] = '.';
+		block.entries[1] = entry;
+		block.entries[1].name[0] = '.';
+		block.entries[1].name[1] = '.';
+		block.entries[1].position = folder_offset;
+		m_dirty_blocks.insert(entry.position);
+
+		memcpy(entry.name, itr->c_str(), itr->size());
+		resolved = AddToFolder(folder_offset, entry, entry_offset);
+		folder_offset = entry.position;
+	}
+
+	if(!resolved)
+	{
+		AbortUpdate(original_size);
+		return false;
+	}
+
+	m_stale_paths.push_back(path);
+	return FinishUpdate(WriteDirectory());
+}
+
+//-----------------------------------------------------------------------------
+
+bool PK2Writer::GetFreeSpace(uint64_t & free_bytes, uint32_t & free_ranges)
+{
+	free_bytes = 0;
+	free_ranges = 0;
+
+	if(m_file == 0)
+	{
+		m_error.str(""); m_error << "There is no PK2 loaded yet.";
+		return false;
+	}
+
+	if(!m_free_valid && !BuildFreeMap())
+	{
+		return false;
+	}
+
+	for(std::map<int64_t, uint64_t>::iterator itr = m_free.begin(); itr != m_free.end(); ++itr)
+	{
+		free_bytes += itr->second;
+		++free_ranges;
+	}
+
+	return true;
+}
+
+//-----------------------------------------------------------------------------
+
+size_t PK2Writer::GetStagedCount()
+{
+	return m_staged.size();
+}
+
+//-----------------------------------------------------------------------------
+
+bool PK2Writer::ImportFile(const char * entryFilename, const char * inputFilename)
+{
+	if(m_transaction)
+	{
+		return StageFile(entryFilename, inputFilename);
+	}
+
+	if(!BeginTransaction())
+	{
+		return false;
+	}
+	if(!StageFile(entryFilename, inputFilename))
+	{
+		Rollback();
+		return false;
+	}
+	return Commit();
+}
+
+//-----------------------------------------------------------------------------
+
+bool PK2Writer::ImportFile(const char * entryFilename, const void * fileBuffer, uint32_t fileSize)
+{
+	if(m_transaction)
+	{
+		return StageFile(entryFilename, fileBuffer, fileSize);
+	}
+
+	if(!BeginTransaction())
+	{
+		return false;
+	}
+	if(!StageFile(entryFilename, fileBuffer, fileSize))
+	{
+		Rollback();
+		return false;
+	}
+	return Commit();
 }
 
 //-----------------------------------------------------------------------------
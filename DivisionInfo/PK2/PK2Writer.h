@@ -3,49 +3,217 @@
 #ifndef PK2WRITER_H_
 #define PK2WRITER_H_
 
+//-----------------------------------------------------------------------------
+
+#include <stdint.h>
+#include <stdio.h>
+#include "blowfish.h"
+#include <vector>
+#include <list>
+#include <map>
+#include <set>
+#include <sstream>
 #include <string>
+#include "PK2.h"
+
+//-----------------------------------------------------------------------------
+
+class PK2Reader;
 
 //-----------------------------------------------------------------------------
 
+// A file waiting in a PK2Writer transaction.
+struct PK2StagedFile
+{
+	std::string path; // as passed to StageFile, backslash separated
+	std::vector<uint8_t> data;
+};
+
+// One range written by PK2Writer::Commit.
+struct PK2WriteRun
+{
+	int64_t offset;
+	const uint8_t * data;
+	uint64_t size;
+};
+
+// Start of "<pk2>.journal". It is followed by 'record_count' records, each an
+// int64_t offset, a uint64_t size, the bytes that were at the offset before the
+// Commit and the bytes to write there. The journal is only replayed over the
+// archive it was written for: same header, a size that Commit could have left
+// and every sector of each block still holding either its old or new bytes.
+struct PK2JournalHeader
+{
+	char magic[8]; // "PK2JRNL"
+	uint32_t version; // 2
+	uint32_t record_count;
+	uint64_t body_size; // bytes of records that follow
+	uint64_t checksum; // XXH3 of the records
+	uint64_t archive_size; // size of the PK2 when the journal was written
+	uint64_t header_xxh3; // XXH3 of the PK2Header
+};
+
+//-----------------------------------------------------------------------------
+
+// Edits a PK2 file in place. Directory blocks are read, changed and encrypted
+// again with the archive's key, and file data is written straight into the
+// archive, so nothing outside this project is needed and it runs anywhere.
 class PK2Writer
 {
-	friend struct PK2WriterPIMPL;
-	PK2WriterPIMPL * m_PK2WriterPIMPL;
+private:
+	FILE * m_file;
+	std::string m_filename;
+	PK2Header m_header;
+	int64_t m_root_offset;
+	int64_t m_file_size;
+	Blowfish m_blowfish;
+	std::stringstream m_error;
+
+	bool m_transaction;
+	std::vector<PK2StagedFile> m_staged;
+	std::map<std::string, size_t> m_staged_index; // lower case path -> m_staged
+
+	std::map<int64_t, PK2EntryBlock> m_blocks; // plaintext directory blocks loaded by Commit
+	std::set<int64_t> m_dirty_blocks;
+	std::set<int64_t> m_freed_blocks; // directory blocks of deleted folders
+	std::vector<std::string> m_stale_paths; // lower case paths the update changed
+	PK2Reader * m_reader; // told about every update, see AttachReader
+	std::vector<uint8_t> m_write_buffer;
+
+	// Unused ranges inside the archive, rebuilt from the directory on the first
+	// Commit after Open and kept up to date from then on
+	bool m_free_valid;
+	std::map<int64_t, uint64_t> m_free; // offset -> size, never adjacent
+	std::multimap<uint64_t, int64_t> m_free_sizes; // size -> offset, for best fit
+	std::set<int64_t> m_pinned; // data shared by more than one entry, never freed
+	std::vector< std::pair<int64_t, uint64_t> > m_pending_free; // freed once the Commit is on disk
+
+private:
+	PK2Writer & operator = (const PK2Writer & rhs);
+	PK2Writer(const PK2Writer & rhs);
+	bool ReadBlock(int64_t offset, PK2EntryBlock & block);
+	PK2EntryBlock * LoadBlock(int64_t offset);
+	bool WriteData(int64_t offset, const void * data, uint64_t size);
+	bool WriteRuns(std::vector<PK2WriteRun> & runs);
+	bool FindFolder(std::list<std::string> & tokens, int64_t & folder_offset);
+	bool FindInFolder(int64_t folder_offset, const std::string & name, int64_t & entry_offset);
+	bool AddToFolder(int64_t folder_offset, const PK2Entry & entry, int64_t & entry_offset);
+	PK2Entry & LoadedEntry(int64_t entry_offset);
+	PK2Entry & EditEntry(int64_t entry_offset);
+	bool ResolvePath(const std::string & path, int64_t & folder_offset, int64_t & entry_offset, std::string & name, std::string & lower_path);
+	bool ReleaseFolder(int64_t folder_offset);
+	bool SplitPath(const std::string & path, std::list<std::string> & folders, std::string & name);
+	bool Stage(const char * entryFilename, std::vector<uint8_t> & data);
+	std::string GetJournalFilename();
+	bool ReadImage(int64_t offset, uint64_t size, int64_t file_size, uint8_t * image);
+	bool WriteJournal(const std::vector<PK2WriteRun> & runs);
+	int MatchJournal(const PK2JournalHeader & header, const std::vector<uint8_t> & body);
+	bool ReplayJournal();
+	bool RemoveJournal();
+	bool BuildFreeMap();
+	void ClearFreeMap();
+	void AddFree(int64_t offset, uint64_t size);
+	void EraseFree(std::map<int64_t, uint64_t>::iterator itr);
+	int64_t Allocate(uint64_t size);
+	void Release(int64_t offset, uint64_t size);
+	void BeginUpdate();
+	void AbortUpdate(int64_t original_size);
+	bool WriteDirectory();
+	bool FinishUpdate(bool written);
 
 public:
 	PK2Writer();
 	~PK2Writer();
 
-	// Sets up GfxFileManager.DLL for PK2 operations. This function must be
-	// called first.
-	bool Initialize(std::string gfxDllFilename);
-
-	// Cleans up GfxFileManager.DLL. This function must be called before the
-	// program exits and after Close if a PK2 file was opened.
-	bool Deinitialize();
+	// Returns the error if a function returns false.
+	std::string GetError();
 
 	// Opens a PK2 file for writing. Use:
 	//		"169841" - For official sro, mysro
 	//		"\x32\x30\x30\x39\xC4\xEA" - for zszc, swsro
 	// Refer to this guide:
 	// http://www.elitepvpers.de/forum/sro-guides-templates/612789-guide-finding-pk2-blowfish-key-5-easy-steps.html
-	// To get the "base key"
-	bool Open(std::string pk2Filename, void * accessKey, unsigned char accessKeyLen);
+	// To get the "base key". The key is checked against the header, so trying each
+	// known key in turn is safe. If a Commit was interrupted after its journal was
+	// written the journal is replayed here, and an incomplete one is dropped.
+	bool Open(std::string pk2Filename, const void * accessKey, uint8_t accessKeyLen, const char * base_key = "\x03\xF8\xE4\x44\x88\x99\x3F\x64\xFE\x35", uint8_t base_key_length = 10);
 
-	// Closes an opened PK2 file. This function must be called before the program
-	// exits and before Deinitialize is called.
+	// Flushes and closes an opened PK2 file. A transaction still open is rolled
+	// back. Returns false if there was no PK2 open or the last writes could not be
+	// flushed.
 	bool Close();
 
+	// Starts collecting file imports. Nothing is written until Commit, so a batch
+	// either goes in as a whole or (when a path cannot be resolved) not at all.
+	bool BeginTransaction();
+
+	// Adds a file to the open transaction. 'entryFilename' is the full path the
+	// file should have in the PK2 and every folder on the way must already exist.
+	// The data is copied. Staging the same path again replaces the earlier data.
+	bool StageFile(const char * entryFilename, const void * fileBuffer, uint32_t fileSize);
+	bool StageFile(const char * entryFilename, const char * inputFilename);
+
+	// Same as above, but the data is moved out of 'data' instead of copied.
+	bool StageFile(const char * entryFilename, std::vector<uint8_t> & data);
+
+	// Writes every staged file and ends the transaction, whether it succeeds or
+	// not. All paths are resolved first, and the directory blocks they touch are
+	// read once and edited in memory. File data never overwrites data the
+	// directory points at: every file gets the smallest free range it fits in
+	// (growing the archive only when none does) and the range it replaces is
+	// freed once the Commit is on disk. The data is written in offset order and
+	// synced. Then the changed directory blocks are encrypted, written to
+	// "<pk2>.journal" and synced, written in place and synced, and the journal is
+	// removed. A crash at any point leaves either the old directory or, after the
+	// journal is replayed by the next Open, the new one. A new file takes the
+	// first null entry of its folder, or a new directory block chained to the
+	// folder if it is full. DeleteEntry, RenameEntry, MoveEntry and MakeDirectory
+	// go to disk the same way, each as an update of its own, even while a
+	// transaction is open.
+	bool Commit();
+
+	// Drops everything staged since BeginTransaction.
+	void Rollback();
+
+	// Keeps 'reader', which must have the same PK2 open, current with every
+	// update made here: the directory blocks that changed are handed to it and
+	// the paths they affect are dropped from its cache, so it never has to be
+	// opened again. Pass 0 to detach. The reader must outlive the attachment.
+	void AttachReader(PK2Reader * reader);
+
+	// Deletes a file, or a folder with everything below it. The entry becomes a
+	// null entry that the next file added to the folder reuses, and the space it
+	// and a folder's directory blocks used is freed.
+	bool DeleteEntry(const char * entryName);
+
+	// Gives an entry a new name in the same folder; 'newName' is a name, not a
+	// path. Only the entry's directory block is written.
+	bool RenameEntry(const char * entryName, const char * newName);
+
+	// Moves an entry to the full path 'newEntryName', whose folder must exist. A
+	// folder is moved with its contents and its ".." is pointed at the new
+	// parent; it cannot be moved inside itself. Nothing but directory entries
+	// change, so this costs the same for any size of file or folder.
+	bool MoveEntry(const char * entryName, const char * newEntryName);
+
+	// Creates a folder and every missing folder on the way to it. Folders that
+	// already exist are fine; a file in the way is an error.
+	bool MakeDirectory(const char * folderName);
+
+	// Reports the space inside the archive that no entry or directory block uses
+	// and how many separate ranges it is split into.
+	bool GetFreeSpace(uint64_t & free_bytes, uint32_t & free_ranges);
+
+	// Returns how many files are staged in the open transaction.
+	size_t GetStagedCount();
+
 	// Imports a file to the PK2. 'entryFilename' should be the full path the
-	// file should have in the PK2.
+	// file should have in the PK2. Inside a transaction this stages the file,
+	// otherwise it is a transaction of its own.
 	bool ImportFile(const char * entryFilename, const char * inputFilename);
 
-	// Imports a file's buffer to the PK2. 'entryFilename' should be the full path the
-	// file should have in the PK2.
-	bool ImportFile(const char * entryFilename, void * fileBuffer, int fileSize);
-
-	// Returns the last error if one of the above functions fails.
-	const char * GetError();
+	// Imports a file's buffer to the PK2, see above.
+	bool ImportFile(const char * entryFilename, const void * fileBuffer, uint32_t fileSize);
 };
 
 //-----------------------------------------------------------------------------
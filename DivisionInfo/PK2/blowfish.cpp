@@ -1,31 +1,26 @@
 #include "blowfish.h"
+#include <string.h>
+#include <map>
+#include <string>
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/once.hpp>
 
 //-----------------------------------------------------------------------------
 
-#define S(x,i)			(SBoxes[i][x.w.byte##i])
-#define bf_F(x)			(((S(x,0) + S(x,1)) ^ S(x,2)) + S(x,3))
-#define ROUND(a,b,n)	(a.dword ^= bf_F(b) ^ PArray[n])
+// The S-box indices are taken with plain shifts and masks, byte 0 being the
+// most significant byte of the half block.
+#define bf_F(x)			(((SBoxes[0][(x) >> 24] + SBoxes[1][((x) >> 16) & 0xFF]) ^ SBoxes[2][((x) >> 8) & 0xFF]) + SBoxes[3][(x) & 0xFF])
+#define ROUND(a,b,n)	((a) ^= bf_F(b) ^ PArray[n])
+
+// Runs the same round on four independent blocks. The four dependency chains
+// are interleaved so their table loads overlap instead of waiting on each other.
+#define ROUND4(a,b,n)	ROUND(a##0, b##0, n); ROUND(a##1, b##1, n); ROUND(a##2, b##2, n); ROUND(a##3, b##3, n)
 
 #define MAXKEYBYTES 	56		// 448 bits max
 #define NPASS           16		// SBox passes
 
 //-----------------------------------------------------------------------------
 
-union aword
-{
-	uint32_t dword;
-	uint8_t byte[4];
-	struct
-	{
-		uint32_t byte3 : 8;
-		uint32_t byte2 : 8;
-		uint32_t byte1 : 8;
-		uint32_t byte0 : 8;
-	} w;
-};
-
-//-----------------------------------------------------------------------------
-
 static uint32_t bf_P[NPASS + 2] =
 {
 	0x243f6a88, 0x85a308d3, 0x13198a2e, 0x03707344,
@@ -172,14 +167,12 @@ static uint32_t bf_S[4][256] =
 
 //-----------------------------------------------------------------------------
 
-void BlowfishPIMPL::Blowfish_encipher(uint32_t *xl, uint32_t *xr)
+void BlowfishPIMPL::Blowfish_encipher(uint32_t *xl, uint32_t *xr) const
 {
-	union aword Xl, Xr;
+	uint32_t Xl = *xl;
+	uint32_t Xr = *xr;
 
-	Xl.dword = *xl;
-	Xr.dword = *xr;
-
-	Xl.dword ^= PArray [0];
+	Xl ^= PArray[0];
 	ROUND(Xr, Xl, 1);  ROUND(Xl, Xr, 2);
 	ROUND(Xr, Xl, 3);  ROUND(Xl, Xr, 4);
 	ROUND(Xr, Xl, 5);  ROUND(Xl, Xr, 6);
@@ -188,21 +181,18 @@ void BlowfishPIMPL::Blowfish_encipher(uint32_t *xl, uint32_t *xr)
 	ROUND(Xr, Xl, 11); ROUND(Xl, Xr, 12);
 	ROUND(Xr, Xl, 13); ROUND(Xl, Xr, 14);
 	ROUND(Xr, Xl, 15); ROUND(Xl, Xr, 16);
-	Xr.dword ^= PArray [17];
+	Xr ^= PArray[17];
 
-	*xr = Xl.dword;
-	*xl = Xr.dword;
+	*xr = Xl;
+	*xl = Xr;
 }
 
-void BlowfishPIMPL::Blowfish_decipher(uint32_t *xl, uint32_t *xr)
+void BlowfishPIMPL::Blowfish_decipher(uint32_t *xl, uint32_t *xr) const
 {
-	union aword  Xl;
-	union aword  Xr;
-
-	Xl.dword = *xl;
-	Xr.dword = *xr;
+	uint32_t Xl = *xl;
+	uint32_t Xr = *xr;
 
-	Xl.dword ^= PArray [17];
+	Xl ^= PArray[17];
 	ROUND(Xr, Xl, 16);  ROUND(Xl, Xr, 15);
 	ROUND(Xr, Xl, 14);  ROUND(Xl, Xr, 13);
 	ROUND(Xr, Xl, 12);  ROUND(Xl, Xr, 11);
@@ -211,10 +201,155 @@ void BlowfishPIMPL::Blowfish_decipher(uint32_t *xl, uint32_t *xr)
 	ROUND(Xr, Xl, 6);   ROUND(Xl, Xr, 5);
 	ROUND(Xr, Xl, 4);   ROUND(Xl, Xr, 3);
 	ROUND(Xr, Xl, 2);   ROUND(Xl, Xr, 1);
-	Xr.dword ^= PArray[0];
+	Xr ^= PArray[0];
+
+	*xl = Xr;
+	*xr = Xl;
+}
+
+void BlowfishPIMPL::Blowfish_encipher4(uint32_t * blocks) const
+{
+	uint32_t Xl0 = blocks[0], Xr0 = blocks[1];
+	uint32_t Xl1 = blocks[2], Xr1 = blocks[3];
+	uint32_t Xl2 = blocks[4], Xr2 = blocks[5];
+	uint32_t Xl3 = blocks[6], Xr3 = blocks[7];
+
+	Xl0 ^= PArray[0]; Xl1 ^= PArray[0]; Xl2 ^= PArray[0]; Xl3 ^= PArray[0];
+	ROUND4(Xr, Xl, 1);  ROUND4(Xl, Xr, 2);
+	ROUND4(Xr, Xl, 3);  ROUND4(Xl, Xr, 4);
+	ROUND4(Xr, Xl, 5);  ROUND4(Xl, Xr, 6);
+	ROUND4(Xr, Xl, 7);  ROUND4(Xl, Xr, 8);
+	ROUND4(Xr, Xl, 9);  ROUND4(Xl, Xr, 10);
+	ROUND4(Xr, Xl, 11); ROUND4(Xl, Xr, 12);
+	ROUND4(Xr, Xl, 13); ROUND4(Xl, Xr, 14);
+	ROUND4(Xr, Xl, 15); ROUND4(Xl, Xr, 16);
+	Xr0 ^= PArray[17]; Xr1 ^= PArray[17]; Xr2 ^= PArray[17]; Xr3 ^= PArray[17];
+
+	blocks[0] = Xr0; blocks[1] = Xl0;
+	blocks[2] = Xr1; blocks[3] = Xl1;
+	blocks[4] = Xr2; blocks[5] = Xl2;
+	blocks[6] = Xr3; blocks[7] = Xl3;
+}
 
-	*xl = Xr.dword;
-	*xr = Xl.dword;
+void BlowfishPIMPL::Blowfish_decipher4(uint32_t * blocks) const
+{
+	uint32_t Xl0 = blocks[0], Xr0 = blocks[1];
+	uint32_t Xl1 = blocks[2], Xr1 = blocks[3];
+	uint32_t Xl2 = blocks[4], Xr2 = blocks[5];
+	uint32_t Xl3 = blocks[6], Xr3 = blocks[7];
+
+	Xl0 ^= PArray[17]; Xl1 ^= PArray[17]; Xl2 ^= PArray[17]; Xl3 ^= PArray[17];
+	ROUND4(Xr, Xl, 16);  ROUND4(Xl, Xr, 15);
+	ROUND4(Xr, Xl, 14);  ROUND4(Xl, Xr, 13);
+	ROUND4(Xr, Xl, 12);  ROUND4(Xl, Xr, 11);
+	ROUND4(Xr, Xl, 10);  ROUND4(Xl, Xr, 9);
+	ROUND4(Xr, Xl, 8);   ROUND4(Xl, Xr, 7);
+	ROUND4(Xr, Xl, 6);   ROUND4(Xl, Xr, 5);
+	ROUND4(Xr, Xl, 4);   ROUND4(Xl, Xr, 3);
+	ROUND4(Xr, Xl, 2);   ROUND4(Xl, Xr, 1);
+	Xr0 ^= PArray[0]; Xr1 ^= PArray[0]; Xr2 ^= PArray[0]; Xr3 ^= PArray[0];
+
+	blocks[0] = Xr0; blocks[1] = Xl0;
+	blocks[2] = Xr1; blocks[3] = Xl1;
+	blocks[4] = Xr2; blocks[5] = Xl2;
+	blocks[6] = Xr3; blocks[7] = Xl3;
+}
+
+// The kernel is picked once per process. Both are constant initialized, so this
+// also works for ciphers set up during static initialization.
+static boost::once_flag bf_simd_once = BOOST_ONCE_INIT;
+static bool bf_simd = false;
+
+// Runs the AVX2 kernel against the scalar code once before trusting it.
+static bool bf_simd_selfcheck(BlowfishPIMPL & bf)
+{
+	uint8_t plain[128], scalar[128], simd[128];
+
+	for(int x = 0; x < 128; ++x)
+	{
+		plain[x] = (uint8_t)(x * 37 + 11);
+	}
+
+	for(int x = 0; x < 16; ++x)
+	{
+		uint32_t block[2];
+		memcpy(block, plain + x * 8, 8);
+		bf.Blowfish_encipher(&block[0], &block[1]);
+		memcpy(scalar + x * 8, block, 8);
+	}
+	blowfish_avx2_encode(bf, plain, simd, 16);
+	if(memcmp(scalar, simd, sizeof(simd)) != 0)
+	{
+		return false;
+	}
+
+	blowfish_avx2_decode(bf, scalar, simd, 16);
+	return memcmp(plain, simd, sizeof(simd)) == 0;
+}
+
+// Runs on a single thread while any others wait, so the timing is not skewed
+// by several first callers measuring at the same time.
+static void bf_select_kernel()
+{
+	BlowfishPIMPL bf;
+	bf.Initialize(const_cast<char *>("Joymax Pak File"), 15);
+	bf_simd = blowfish_avx2_supported() && bf_simd_selfcheck(bf) && blowfish_avx2_faster(bf);
+}
+
+static bool bf_use_simd()
+{
+	boost::call_once(bf_select_kernel, bf_simd_once);
+	return bf_simd;
+}
+
+void BlowfishPIMPL::EncodeBlocks(const uint8_t * input, uint8_t * output, uint64_t count) const
+{
+	uint32_t blocks[8];
+	uint64_t x = 0;
+
+	if(count >= 8 && bf_use_simd())
+	{
+		x = count & ~static_cast<uint64_t>(7);
+		blowfish_avx2_encode(*this, input, output, x);
+	}
+
+	for(; x + 4 <= count; x += 4)
+	{
+		memcpy(blocks, input + x * 8, 32);
+		Blowfish_encipher4(blocks);
+		memcpy(output + x * 8, blocks, 32);
+	}
+	for(; x < count; ++x)
+	{
+		memcpy(blocks, input + x * 8, 8);
+		Blowfish_encipher(&blocks[0], &blocks[1]);
+		memcpy(output + x * 8, blocks, 8);
+	}
+}
+
+void BlowfishPIMPL::DecodeBlocks(const uint8_t * input, uint8_t * output, uint64_t count) const
+{
+	uint32_t blocks[8];
+	uint64_t x = 0;
+
+	if(count >= 8 && bf_use_simd())
+	{
+		x = count & ~static_cast<uint64_t>(7);
+		blowfish_avx2_decode(*this, input, output, x);
+	}
+
+	for(; x + 4 <= count; x += 4)
+	{
+		memcpy(blocks, input + x * 8, 32);
+		Blowfish_decipher4(blocks);
+		memcpy(output + x * 8, blocks, 32);
+	}
+	for(; x < count; ++x)
+	{
+		memcpy(blocks, input + x * 8, 8);
+		Blowfish_decipher(&blocks[0], &blocks[1]);
+		memcpy(output + x * 8, blocks, 8);
+	}
 }
 
 // constructs the encryption sieve
@@ -234,31 +369,18 @@ bool BlowfishPIMPL::Initialize(void * key_ptr, uint8_t key_size)
 
 	uint32_t i, j;
 	uint32_t data, datal, datar;
-	union aword temp;
 
 	// first fill arrays from data tables
-	for(i = 0; i < 18; i++)
-	{
-		PArray [i] = bf_P [i];
-	}
-
-	for(i = 0; i < 4; i++)
-	{
-		for(j = 0; j < 256; j++)
-		{
-			SBoxes [i][j] = bf_S [i][j];
-		}
-	}
+	memcpy(PArray, bf_P, sizeof(PArray));
+	memcpy(SBoxes, bf_S, sizeof(SBoxes));
 
 	j = 0;
 	for(i = 0; i < NPASS + 2; ++i)
 	{
-		temp.dword = 0;
-		temp.w.byte0 = key[j];
-		temp.w.byte1 = key[(j+1) % key_size];
-		temp.w.byte2 = key[(j+2) % key_size];
-		temp.w.byte3 = key[(j+3) % key_size];
-		data = temp.dword;
+		data = ((uint32_t)key[j] << 24) |
+			((uint32_t)key[(j + 1) % key_size] << 16) |
+			((uint32_t)key[(j + 2) % key_size] << 8) |
+			(uint32_t)key[(j + 3) % key_size];
 		PArray [i] ^= data;
 		j =(j + 4) % key_size;
 	}
@@ -287,7 +409,7 @@ bool BlowfishPIMPL::Initialize(void * key_ptr, uint8_t key_size)
 }
 
 // get output length, which must be even MOD 8
-uint64_t BlowfishPIMPL::GetOutputLength(uint64_t input_size)
+uint64_t BlowfishPIMPL::GetOutputLength(uint64_t input_size) const
 {
 	uint64_t lVal = 0;
 	lVal = input_size % 8;	// find out if uneven number of bytes at the end
@@ -304,14 +426,12 @@ uint64_t BlowfishPIMPL::GetOutputLength(uint64_t input_size)
 // Encode pIntput into pOutput.  Input length in lSize.  Returned value
 // is length of output which will be even MOD 8 bytes.  Input buffer and
 // output buffer can be the same, but be sure buffer length is even MOD 8.
-bool BlowfishPIMPL::Encode(const void * const input_ptr, uint64_t input_size, void * output_ptr, uint64_t output_size)
+bool BlowfishPIMPL::Encode(const void * const input_ptr, uint64_t input_size, void * output_ptr, uint64_t output_size) const
 {
-	uint64_t lCount, lOutSize, lGoodBytes;
-	uint8_t * pi, * po;
-	uint64_t i, j;
-	bool sameDest = (input_ptr == output_ptr);
-	uint8_t * pInput = reinterpret_cast<uint8_t *>(const_cast<void *>(input_ptr));
+	const uint8_t * pInput = reinterpret_cast<const uint8_t *>(input_ptr);
 	uint8_t * pOutput = reinterpret_cast<uint8_t *>(output_ptr);
+	uint64_t lOutSize, lFullSize;
+	uint32_t block[2];
 
 	if(!input_ptr || !output_ptr)
 	{
@@ -324,62 +444,29 @@ bool BlowfishPIMPL::Encode(const void * const input_ptr, uint64_t input_size, vo
 		return false;
 	}
 
-	for(lCount = 0; lCount < lOutSize; lCount += 8)
+	// Each block is loaded and stored as whole words. memcpy keeps this safe for
+	// unaligned buffers and for encoding in place.
+	lFullSize = input_size & ~static_cast<uint64_t>(7);
+	EncodeBlocks(pInput, pOutput, lFullSize / 8);
+
+	// pad end of data with null bytes to complete encryption
+	if(lFullSize < lOutSize)
 	{
-		if(sameDest)	// if encoded data is being written into input buffer
-		{
-			if(lCount < input_size - 7)	// if not dealing with uneven bytes at end
-			{
-				Blowfish_encipher(reinterpret_cast<uint32_t *>(pInput), reinterpret_cast<uint32_t *>(pInput + 4));
-			}
-			else		// pad end of data with null bytes to complete encryption
-			{
-				po = pInput + input_size;	// point at byte past the end of actual data
-				j = lOutSize - input_size;	// number of bytes to set to null
-				for(i = 0; i < j; i++)
-					*po++ = 0;
-				Blowfish_encipher(reinterpret_cast<uint32_t *>(pInput), reinterpret_cast<uint32_t *>(pInput + 4));
-			}
-			pInput += 8;
-		}
-		else 			// output buffer not equal to input buffer, so must copy
-		{               // input to output buffer prior to encrypting
-			if(lCount < input_size - 7)	// if not dealing with uneven bytes at end
-			{
-				pi = pInput;
-				po = pOutput;
-				for(i = 0; i < 8; i++)
-					// copy bytes to output
-					*po++ = *pi++;
-				// now encrypt them
-				Blowfish_encipher(reinterpret_cast<uint32_t *>(pOutput), reinterpret_cast<uint32_t *>(pOutput + 4));
-			}
-			else		// pad end of data with null bytes to complete encryption
-			{
-				lGoodBytes = input_size - lCount;	// number of remaining data bytes
-				po = pOutput;
-				for(i = 0; i < lGoodBytes; i++)
-					*po++ = *pInput++;
-				for(j = i; j < 8; j++)
-					*po++ = 0;
-				Blowfish_encipher(reinterpret_cast<uint32_t *>(pOutput), reinterpret_cast<uint32_t *>(pOutput + 4));
-			}
-			pInput += 8;
-			pOutput += 8;
-		}
+		block[0] = 0;
+		block[1] = 0;
+		memcpy(block, pInput + lFullSize, static_cast<size_t>(input_size - lFullSize));
+		Blowfish_encipher(&block[0], &block[1]);
+		memcpy(pOutput + lFullSize, block, 8);
 	}
+
 	return true;
 }
 
 // Decode pIntput into pOutput.  Input length in lSize.  Input buffer and
 // output buffer can be the same, but be sure buffer length is even MOD 8.
-bool BlowfishPIMPL::Decode(const void * const input_ptr, uint64_t input_size, void * output_ptr, uint64_t output_size)
+bool BlowfishPIMPL::Decode(const void * const input_ptr, uint64_t input_size, void * output_ptr, uint64_t output_size) const
 {
-	uint64_t 	lCount;
-	uint8_t	*pi, *po;
-	uint64_t i;
-	bool sameDest = input_ptr == output_ptr;
-	uint8_t * pInput = reinterpret_cast<uint8_t *>(const_cast<void *>(input_ptr));
+	const uint8_t * pInput = reinterpret_cast<const uint8_t *>(input_ptr);
 	uint8_t * pOutput = reinterpret_cast<uint8_t *>(output_ptr);
 
 	if(!input_ptr || !output_ptr)
@@ -397,57 +484,294 @@ bool BlowfishPIMPL::Decode(const void * const input_ptr, uint64_t input_size, vo
 		return false;
 	}
 
-	for(lCount = 0; lCount < input_size; lCount += 8)
+	DecodeBlocks(pInput, pOutput, input_size / 8);
+
+	return true;
+}
+
+//-----------------------------------------------------------------------------
+
+// Precomputed schedule for the SV.T key, see blowfish_version.cpp
+extern const char bf_version_key[8];
+extern const uint32_t bf_version_P[18];
+extern const uint32_t bf_version_S[4][256];
+
+// Schedules by key bytes. Programs only ever use a handful of keys, so entries
+// are kept for the life of the process.
+struct BlowfishScheduleCache
+{
+	std::map<std::string, BlowfishSchedule> schedules;
+	boost::mutex lock;
+};
+
+// Ciphers are set up during static initialization too (a global PK2Reader sets
+// its key in the constructor), so the cache cannot be a global object that may
+// not be constructed yet. It is created on first use instead and never freed,
+// which also keeps it valid for objects destroyed after main returns.
+static boost::once_flag bf_schedule_cache_once = BOOST_ONCE_INIT;
+static BlowfishScheduleCache * bf_schedule_cache_instance = 0;
+
+static void bf_create_schedule_cache()
+{
+	bf_schedule_cache_instance = new BlowfishScheduleCache;
+}
+
+static BlowfishScheduleCache & bf_schedule_cache()
+{
+	boost::call_once(bf_create_schedule_cache, bf_schedule_cache_once);
+	return *bf_schedule_cache_instance;
+}
+
+//-----------------------------------------------------------------------------
+
+Blowfish::Blowfish()
+{
+}
+
+Blowfish::~Blowfish()
+{
+}
+
+BlowfishSchedule Blowfish::GetSchedule(const void * key_ptr, uint8_t key_size)
+{
+	if(!key_ptr || key_size == 0 || key_size > MAXKEYBYTES)
+	{
+		return BlowfishSchedule();
+	}
+
+	std::string key(reinterpret_cast<const char *>(key_ptr), key_size);
+	BlowfishScheduleCache & cache = bf_schedule_cache();
+
 	{
-		if(sameDest)	// if encoded data is being written into input buffer
+		boost::mutex::scoped_lock lock(cache.lock);
+		std::map<std::string, BlowfishSchedule>::iterator itr = cache.schedules.find(key);
+		if(itr != cache.schedules.end())
 		{
-			Blowfish_decipher(reinterpret_cast<uint32_t *>(pInput), reinterpret_cast<uint32_t *>(pInput + 4));
-			pInput += 8;
-		}
-		else 			// output buffer not equal to input buffer
-		{               // so copy input to output before decoding
-			pi = pInput;
-			po = pOutput;
-			for(i = 0; i < 8; i++)
-			{
-				*po++ = *pi++;
-			}
-			Blowfish_decipher(reinterpret_cast<uint32_t *>(pOutput), reinterpret_cast<uint32_t *>(pOutput + 4));
-			pInput += 8;
-			pOutput += 8;
+			return itr->second;
 		}
 	}
-	return true;
+
+	// Built outside the lock so different keys can be set up in parallel
+	boost::shared_ptr<BlowfishPIMPL> schedule(new BlowfishPIMPL);
+	if(key_size == sizeof(bf_version_key) && memcmp(key_ptr, bf_version_key, sizeof(bf_version_key)) == 0)
+	{
+		memcpy(schedule->PArray, bf_version_P, sizeof(schedule->PArray));
+		memcpy(schedule->SBoxes, bf_version_S, sizeof(schedule->SBoxes));
+	}
+	else
+	{
+		uint8_t key_copy[MAXKEYBYTES];
+		memcpy(key_copy, key_ptr, key_size);
+		schedule->Initialize(key_copy, key_size);
+	}
+
+	// Another thread may have built the same key meanwhile; keep the first one
+	boost::mutex::scoped_lock lock(cache.lock);
+	return cache.schedules.insert(std::make_pair(key, BlowfishSchedule(schedule))).first->second;
+}
+
+bool Blowfish::Initialize(const void * key_ptr, uint8_t key_size)
+{
+	m_schedule = GetSchedule(key_ptr, key_size);
+	return m_schedule.get() != 0;
+}
+
+bool Blowfish::Initialize(const BlowfishSchedule & schedule)
+{
+	m_schedule = schedule;
+	return m_schedule.get() != 0;
+}
+
+BlowfishSchedule Blowfish::GetSchedule() const
+{
+	return m_schedule;
+}
+
+uint64_t Blowfish::GetOutputLength(uint64_t input_size) const
+{
+	uint64_t lVal = input_size % 8;
+	if(lVal != 0)
+	{
+		return input_size + 8 - lVal;
+	}
+	return input_size;
+}
+
+bool Blowfish::Encode(const void * const input_ptr, uint64_t input_size, void * output_ptr, uint64_t output_size) const
+{
+	if(!m_schedule)
+	{
+		return false;
+	}
+	return m_schedule->Encode(input_ptr, input_size, output_ptr, output_size);
+}
+
+bool Blowfish::Decode(const void * const input_ptr, uint64_t input_size, void * output_ptr, uint64_t output_size) const
+{
+	if(!m_schedule)
+	{
+		return false;
+	}
+	return m_schedule->Decode(input_ptr, input_size, output_ptr, output_size);
+}
+
+void Blowfish::EncodeBlocks(const void * input_ptr, void * output_ptr, uint64_t count) const
+{
+	if(m_schedule)
+	{
+		m_schedule->EncodeBlocks(reinterpret_cast<const uint8_t *>(input_ptr), reinterpret_cast<uint8_t *>(output_ptr), count);
+	}
+}
+
+void Blowfish::DecodeBlocks(const void * input_ptr, void * output_ptr, uint64_t count) const
+{
+	if(m_schedule)
+	{
+		m_schedule->DecodeBlocks(reinterpret_cast<const uint8_t *>(input_ptr), reinterpret_cast<uint8_t *>(output_ptr), count);
+	}
 }
 
 //-----------------------------------------------------------------------------
 
-Blowfish::Blowfish()
+BlowfishStreamEncoder::BlowfishStreamEncoder(const Blowfish & blowfish, void * output, uint64_t output_size) : m_blowfish(blowfish)
 {
+	m_pending_size = 0;
+	m_output = reinterpret_cast<uint8_t *>(output);
+	m_output_size = output_size;
+	m_file = 0;
+	m_written = 0;
+	m_failed = !output || !m_blowfish.GetSchedule();
 }
 
-Blowfish::~Blowfish()
+BlowfishStreamEncoder::BlowfishStreamEncoder(const Blowfish & blowfish, FILE * file) : m_blowfish(blowfish)
 {
+	m_pending_size = 0;
+	m_output = 0;
+	m_output_size = 0;
+	m_file = file;
+	m_written = 0;
+	m_failed = !file || !m_blowfish.GetSchedule();
 }
 
-bool Blowfish::Initialize(void * key_ptr, uint8_t key_size)
+// Encodes 'count' whole blocks from 'input' to the destination.
+bool BlowfishStreamEncoder::Emit(const uint8_t * input, uint64_t count)
 {
-	return m_BlowfishPIMPL.Initialize(key_ptr, key_size);
+	if(m_output)
+	{
+		if(m_written + count * 8 > m_output_size)
+		{
+			m_failed = true;
+			return false;
+		}
+		m_blowfish.EncodeBlocks(input, m_output + m_written, count);
+		m_written += count * 8;
+		return true;
+	}
+
+	// Files need a staging area; keep it large enough for few, big writes
+	uint8_t buffer[16 * 1024];
+	while(count)
+	{
+		uint64_t blocks = count < sizeof(buffer) / 8 ? count : sizeof(buffer) / 8;
+		m_blowfish.EncodeBlocks(input, buffer, blocks);
+		if(fwrite(buffer, 8, (size_t)blocks, m_file) != blocks)
+		{
+			m_failed = true;
+			return false;
+		}
+		m_written += blocks * 8;
+		input += blocks * 8;
+		count -= blocks;
+	}
+	return true;
+}
+
+bool BlowfishStreamEncoder::Write(const void * data, uint64_t size)
+{
+	const uint8_t * input = reinterpret_cast<const uint8_t *>(data);
+
+	if(m_failed || (!input && size))
+	{
+		m_failed = true;
+		return false;
+	}
+
+	// Top up a partial block left by the previous write first
+	if(m_pending_size)
+	{
+		uint32_t take = 8 - m_pending_size;
+		if(take > size)
+		{
+			take = (uint32_t)size;
+		}
+		memcpy(m_pending + m_pending_size, input, take);
+		m_pending_size += take;
+		input += take;
+		size -= take;
+
+		if(m_pending_size < 8)
+		{
+			return true;
+		}
+		if(!Emit(m_pending, 1))
+		{
+			return false;
+		}
+		m_pending_size = 0;
+	}
+
+	if(size >= 8 && !Emit(input, size / 8))
+	{
+		return false;
+	}
+
+	m_pending_size = (uint32_t)(size % 8);
+	memcpy(m_pending, input + (size - m_pending_size), m_pending_size);
+
+	return true;
 }
 
-uint64_t Blowfish::GetOutputLength(uint64_t input_size)
+bool BlowfishStreamEncoder::Write(const BlowfishFragment * fragments, size_t count)
 {
-	return m_BlowfishPIMPL.GetOutputLength(input_size);
+	for(size_t x = 0; x < count; ++x)
+	{
+		if(!Write(fragments[x].data, fragments[x].size))
+		{
+			return false;
+		}
+	}
+	return !m_failed;
 }
 
-bool Blowfish::Encode(const void * const input_ptr, uint64_t input_size, void * output_ptr, uint64_t output_size)
+bool BlowfishStreamEncoder::Finish()
 {
-	return m_BlowfishPIMPL.Encode(input_ptr, input_size, output_ptr, output_size);
+	if(m_failed)
+	{
+		return false;
+	}
+
+	if(m_pending_size)
+	{
+		memset(m_pending + m_pending_size, 0, 8 - m_pending_size);
+		m_pending_size = 0;
+		if(!Emit(m_pending, 1))
+		{
+			return false;
+		}
+	}
+
+	if(m_file && fflush(m_file) != 0)
+	{
+		m_failed = true;
+		return false;
+	}
+
+	return true;
 }
 
-bool Blowfish::Decode(const void * const input_ptr, uint64_t input_size, void * output_ptr, uint64_t output_size)
+uint64_t BlowfishStreamEncoder::GetWritten() const
 {
-	return m_BlowfishPIMPL.Decode(input_ptr, input_size, output_ptr, output_size);
+	return m_written;
 }
 
 //-----------------------------------------------------------------------------
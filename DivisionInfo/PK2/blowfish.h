@@ -23,51 +23,145 @@
 //-----------------------------------------------------------------------------
 
 #include <stdint.h>
+#include <stdio.h>
+#include <boost/shared_ptr.hpp>
 
 //-----------------------------------------------------------------------------
 
-// Rather than using a real PIMPL, I've changed this version to use the stack
-// instead so there is no extra overhead from heap allocations for each
-// Blowfish object. However, this can still be changed if desired by
-// moving this definition back into std_blowfish.cpp and forward declaring
-// the type.
+// The key schedule (P-array and S-boxes, 4168 bytes). Once Initialize has run it
+// is never modified again, so one schedule is shared by every Blowfish object
+// using the same key, across threads. See Blowfish::GetSchedule.
 struct BlowfishPIMPL
 {
 	uint32_t PArray[18];
 	uint32_t SBoxes[4][256];
 
-	void Blowfish_encipher(uint32_t *xl, uint32_t *xr);
-	void Blowfish_decipher(uint32_t *xl, uint32_t *xr);
+	void Blowfish_encipher(uint32_t *xl, uint32_t *xr) const;
+	void Blowfish_decipher(uint32_t *xl, uint32_t *xr) const;
+
+	// Process four independent 8 byte blocks (left/right word pairs) in lock-step.
+	void Blowfish_encipher4(uint32_t * blocks) const;
+	void Blowfish_decipher4(uint32_t * blocks) const;
+
+	// ECB over 'count' whole 8 byte blocks, eight at a time with AVX2 when available
+	// and measured faster, four at a time otherwise. Input and output may be the
+	// same buffer.
+	void EncodeBlocks(const uint8_t * input, uint8_t * output, uint64_t count) const;
+	void DecodeBlocks(const uint8_t * input, uint8_t * output, uint64_t count) const;
 	bool Initialize(void * key_ptr, uint8_t key_size);
-	uint64_t GetOutputLength(uint64_t input_size);
-	bool Encode(void const * const input_ptr, uint64_t input_size, void * output_ptr, uint64_t output_size);
-	bool Decode(const void * const input_ptr, uint64_t input_size, void * output_ptr, uint64_t output_size);
+	uint64_t GetOutputLength(uint64_t input_size) const;
+	bool Encode(void const * const input_ptr, uint64_t input_size, void * output_ptr, uint64_t output_size) const;
+	bool Decode(const void * const input_ptr, uint64_t input_size, void * output_ptr, uint64_t output_size) const;
 };
 
+typedef boost::shared_ptr<const BlowfishPIMPL> BlowfishSchedule;
+
 //-----------------------------------------------------------------------------
 
+// AVX2 kernels from blowfish_avx2.cpp. They process 'count' rounded down to a
+// multiple of 8 blocks and must only be called when blowfish_avx2_supported()
+// is true. BlowfishPIMPL::EncodeBlocks/DecodeBlocks pick them automatically, but
+// only if blowfish_avx2_faster() measures them beating the 4-way scalar path.
+bool blowfish_avx2_supported();
+bool blowfish_avx2_faster(const BlowfishPIMPL & bf);
+void blowfish_avx2_encode(const BlowfishPIMPL & bf, const uint8_t * input, uint8_t * output, uint64_t count);
+void blowfish_avx2_decode(const BlowfishPIMPL & bf, const uint8_t * input, uint8_t * output, uint64_t count);
+
+//-----------------------------------------------------------------------------
+
+// Blowfish objects only reference a shared schedule, so they are cheap to create
+// and copy. An object that was never initialized fails every Encode/Decode.
 class Blowfish
 {
 private:
-	BlowfishPIMPL m_BlowfishPIMPL;
+	BlowfishSchedule m_schedule;
 
 public:
 	Blowfish();
 	~Blowfish();
 
+	// Returns the schedule for this key from a process wide cache, building it on
+	// first use. The SV.T key ("SILKROADVERSION", 8) comes from a precomputed
+	// table. Returns an empty pointer if the key is too long (56 bytes max) or too
+	// short (0) or key_ptr is null. Safe to call from several threads.
+	static BlowfishSchedule GetSchedule(const void * key_ptr, uint8_t key_size);
+
 	// Sets up the blowfish object with this specific key. If the key is too
 	// long (56 bytes max) or too short (0) or key_ptr is null, then false is returned.
-	bool Initialize(void * key_ptr, uint8_t key_size);
+	bool Initialize(const void * key_ptr, uint8_t key_size);
+
+	// Sets up the blowfish object with a schedule from GetSchedule.
+	bool Initialize(const BlowfishSchedule & schedule);
+
+	// Returns the schedule in use, empty if not initialized.
+	BlowfishSchedule GetSchedule() const;
 
 	// Returns the output length based on the size. This can be used to 
 	// determine how many bytes of output space is needed for data that
 	// is about to be encoded or decoded.
-	uint64_t GetOutputLength(uint64_t input_size);
+	uint64_t GetOutputLength(uint64_t input_size) const;
 
 	// Encodes/Decodes the data. Returns false on an error (such as invalid 
 	// sizes, or invalid parameters) and true on success.
-	bool Encode(const void * const input_ptr, uint64_t input_size, void * output_ptr, uint64_t output_size);
-	bool Decode(const void * const input_ptr, uint64_t input_size, void * output_ptr, uint64_t output_size);
+	bool Encode(const void * const input_ptr, uint64_t input_size, void * output_ptr, uint64_t output_size) const;
+	bool Decode(const void * const input_ptr, uint64_t input_size, void * output_ptr, uint64_t output_size) const;
+
+	// Encodes/Decodes 'count' whole 8 byte blocks with no padding. Uses the AVX2
+	// kernel when the CPU has it and it measured faster on first use, and four
+	// scalar blocks at a time otherwise. Meant
+	// for bulk ECB data such as PK2 directory blocks. Input and output may be the
+	// same buffer.
+	void EncodeBlocks(const void * input_ptr, void * output_ptr, uint64_t count) const;
+	void DecodeBlocks(const void * input_ptr, void * output_ptr, uint64_t count) const;
+};
+
+//-----------------------------------------------------------------------------
+
+// One piece of input for BlowfishStreamEncoder, like an iovec.
+struct BlowfishFragment
+{
+	const void * data;
+	uint64_t size;
+};
+
+// Encodes any number of input fragments as one continuous ECB stream, straight
+// into a buffer or a FILE. Whole blocks go from the input to the output with no
+// copies; only a partial block (at most 7 bytes) is carried between writes, and
+// Finish pads it with zeros the same way Blowfish::Encode does.
+class BlowfishStreamEncoder
+{
+private:
+	Blowfish m_blowfish;
+	uint8_t m_pending[8];
+	uint32_t m_pending_size;
+	uint8_t * m_output;
+	uint64_t m_output_size;
+	FILE * m_file;
+	uint64_t m_written;
+	bool m_failed;
+
+	bool Emit(const uint8_t * input, uint64_t count);
+
+	BlowfishStreamEncoder & operator = (const BlowfishStreamEncoder & rhs);
+	BlowfishStreamEncoder(const BlowfishStreamEncoder & rhs);
+
+public:
+	// Writes into 'output', failing once more than 'output_size' bytes would be needed.
+	BlowfishStreamEncoder(const Blowfish & blowfish, void * output, uint64_t output_size);
+
+	// Writes at the current position of 'file'.
+	BlowfishStreamEncoder(const Blowfish & blowfish, FILE * file);
+
+	// Adds data to the stream. Returns false if the output is full or the file
+	// could not be written; every later call then fails as well.
+	bool Write(const void * data, uint64_t size);
+	bool Write(const BlowfishFragment * fragments, size_t count);
+
+	// Pads and writes the last partial block, if any. Returns false on an error.
+	bool Finish();
+
+	// Returns how many encoded bytes have been written so far.
+	uint64_t GetWritten() const;
 };
 
 //-----------------------------------------------------------------------------
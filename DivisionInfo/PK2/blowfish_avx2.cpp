@@ -0,0 +1,229 @@
+//-----------------------------------------------------------------------------
+/*
+	AVX2 Blowfish ECB kernel
+
+	Runs eight blocks per register: one ymm holds the left words of eight
+	blocks and another the right words, and the S-box lookups are done with
+	gathers. Only compiled in when the compiler can emit AVX2 for a single
+	function; the CPU is checked at runtime before any of it is called.
+*/
+//-----------------------------------------------------------------------------
+
+#include "blowfish.h"
+#include <string.h>
+
+#if defined(_MSC_VER) && _MSC_VER >= 1700 && (defined(_M_IX86) || defined(_M_X64))
+	#define BLOWFISH_AVX2 1
+	#define BLOWFISH_AVX2_TARGET
+	#include <intrin.h>
+	#include <immintrin.h>
+#elif defined(__GNUC__) && (__GNUC__ > 4 || (__GNUC__ == 4 && __GNUC_MINOR__ >= 9)) && (defined(__i386__) || defined(__x86_64__))
+	#define BLOWFISH_AVX2 1
+	#define BLOWFISH_AVX2_TARGET __attribute__((target("avx2")))
+	#include <cpuid.h>
+	#include <immintrin.h>
+	#include <x86intrin.h>
+#endif
+
+//-----------------------------------------------------------------------------
+
+#ifdef BLOWFISH_AVX2
+
+bool blowfish_avx2_supported()
+{
+	uint32_t regs[4] = {0};
+
+#ifdef _MSC_VER
+	int info[4];
+	__cpuid(info, 0);
+	if(info[0] < 7)
+	{
+		return false;
+	}
+	__cpuid(info, 1);
+	regs[2] = (uint32_t)info[2];
+#else
+	if(__get_cpuid_max(0, 0) < 7)
+	{
+		return false;
+	}
+	__cpuid(1, regs[0], regs[1], regs[2], regs[3]);
+#endif
+
+	// The OS has to save the ymm registers on context switches (OSXSAVE + AVX)
+	if((regs[2] & (1 << 27)) == 0 || (regs[2] & (1 << 28)) == 0)
+	{
+		return false;
+	}
+
+	uint64_t xcr0 = 0;
+#ifdef _MSC_VER
+	xcr0 = _xgetbv(0);
+#else
+	uint32_t xcr0_lo = 0, xcr0_hi = 0;
+	__asm__ __volatile__("xgetbv" : "=a"(xcr0_lo), "=d"(xcr0_hi) : "c"(0));
+	xcr0 = ((uint64_t)xcr0_hi << 32) | xcr0_lo;
+#endif
+	if((xcr0 & 6) != 6)
+	{
+		return false;
+	}
+
+#ifdef _MSC_VER
+	__cpuidex(info, 7, 0);
+	regs[1] = (uint32_t)info[1];
+#else
+	__cpuid_count(7, 0, regs[0], regs[1], regs[2], regs[3]);
+#endif
+
+	return (regs[1] & (1 << 5)) != 0;
+}
+
+//-----------------------------------------------------------------------------
+
+#define AVX2_F(x)		_mm256_add_epi32(_mm256_xor_si256(_mm256_add_epi32( \
+							_mm256_i32gather_epi32(s0, _mm256_srli_epi32(x, 24), 4), \
+							_mm256_i32gather_epi32(s1, _mm256_and_si256(_mm256_srli_epi32(x, 16), mask), 4)), \
+							_mm256_i32gather_epi32(s2, _mm256_and_si256(_mm256_srli_epi32(x, 8), mask), 4)), \
+							_mm256_i32gather_epi32(s3, _mm256_and_si256(x, mask), 4))
+#define AVX2_ROUND(a,b,n)	(a = _mm256_xor_si256(a, _mm256_xor_si256(AVX2_F(b), _mm256_set1_epi32((int)bf.PArray[n]))))
+
+//-----------------------------------------------------------------------------
+
+// Splits eight interleaved blocks into a register of left words and one of right words.
+BLOWFISH_AVX2_TARGET static inline void avx2_load(const uint8_t * input, __m256i & left, __m256i & right)
+{
+	const __m256i split = _mm256_setr_epi32(0, 2, 4, 6, 1, 3, 5, 7);
+	__m256i a = _mm256_permutevar8x32_epi32(_mm256_loadu_si256(reinterpret_cast<const __m256i *>(input)), split);
+	__m256i b = _mm256_permutevar8x32_epi32(_mm256_loadu_si256(reinterpret_cast<const __m256i *>(input + 32)), split);
+	left = _mm256_permute2x128_si256(a, b, 0x20);
+	right = _mm256_permute2x128_si256(a, b, 0x31);
+}
+
+BLOWFISH_AVX2_TARGET static inline void avx2_store(uint8_t * output, __m256i left, __m256i right)
+{
+	const __m256i merge = _mm256_setr_epi32(0, 4, 1, 5, 2, 6, 3, 7);
+	__m256i a = _mm256_permute2x128_si256(left, right, 0x20);
+	__m256i b = _mm256_permute2x128_si256(left, right, 0x31);
+	_mm256_storeu_si256(reinterpret_cast<__m256i *>(output), _mm256_permutevar8x32_epi32(a, merge));
+	_mm256_storeu_si256(reinterpret_cast<__m256i *>(output + 32), _mm256_permutevar8x32_epi32(b, merge));
+}
+
+//-----------------------------------------------------------------------------
+
+BLOWFISH_AVX2_TARGET void blowfish_avx2_encode(const BlowfishPIMPL & bf, const uint8_t * input, uint8_t * output, uint64_t count)
+{
+	const int * s0 = reinterpret_cast<const int *>(bf.SBoxes[0]);
+	const int * s1 = reinterpret_cast<const int *>(bf.SBoxes[1]);
+	const int * s2 = reinterpret_cast<const int *>(bf.SBoxes[2]);
+	const int * s3 = reinterpret_cast<const int *>(bf.SBoxes[3]);
+	const __m256i mask = _mm256_set1_epi32(0xFF);
+
+	for(uint64_t x = 0; x + 8 <= count; x += 8)
+	{
+		__m256i Xl, Xr;
+		avx2_load(input + x * 8, Xl, Xr);
+
+		Xl = _mm256_xor_si256(Xl, _mm256_set1_epi32((int)bf.PArray[0]));
+		AVX2_ROUND(Xr, Xl, 1);  AVX2_ROUND(Xl, Xr, 2);
+		AVX2_ROUND(Xr, Xl, 3);  AVX2_ROUND(Xl, Xr, 4);
+		AVX2_ROUND(Xr, Xl, 5);  AVX2_ROUND(Xl, Xr, 6);
+		AVX2_ROUND(Xr, Xl, 7);  AVX2_ROUND(Xl, Xr, 8);
+		AVX2_ROUND(Xr, Xl, 9);  AVX2_ROUND(Xl, Xr, 10);
+		AVX2_ROUND(Xr, Xl, 11); AVX2_ROUND(Xl, Xr, 12);
+		AVX2_ROUND(Xr, Xl, 13); AVX2_ROUND(Xl, Xr, 14);
+		AVX2_ROUND(Xr, Xl, 15); AVX2_ROUND(Xl, Xr, 16);
+		Xr = _mm256_xor_si256(Xr, _mm256_set1_epi32((int)bf.PArray[17]));
+
+		avx2_store(output + x * 8, Xr, Xl);
+	}
+}
+
+BLOWFISH_AVX2_TARGET void blowfish_avx2_decode(const BlowfishPIMPL & bf, const uint8_t * input, uint8_t * output, uint64_t count)
+{
+	const int * s0 = reinterpret_cast<const int *>(bf.SBoxes[0]);
+	const int * s1 = reinterpret_cast<const int *>(bf.SBoxes[1]);
+	const int * s2 = reinterpret_cast<const int *>(bf.SBoxes[2]);
+	const int * s3 = reinterpret_cast<const int *>(bf.SBoxes[3]);
+	const __m256i mask = _mm256_set1_epi32(0xFF);
+
+	for(uint64_t x = 0; x + 8 <= count; x += 8)
+	{
+		__m256i Xl, Xr;
+		avx2_load(input + x * 8, Xl, Xr);
+
+		Xl = _mm256_xor_si256(Xl, _mm256_set1_epi32((int)bf.PArray[17]));
+		AVX2_ROUND(Xr, Xl, 16); AVX2_ROUND(Xl, Xr, 15);
+		AVX2_ROUND(Xr, Xl, 14); AVX2_ROUND(Xl, Xr, 13);
+		AVX2_ROUND(Xr, Xl, 12); AVX2_ROUND(Xl, Xr, 11);
+		AVX2_ROUND(Xr, Xl, 10); AVX2_ROUND(Xl, Xr, 9);
+		AVX2_ROUND(Xr, Xl, 8);  AVX2_ROUND(Xl, Xr, 7);
+		AVX2_ROUND(Xr, Xl, 6);  AVX2_ROUND(Xl, Xr, 5);
+		AVX2_ROUND(Xr, Xl, 4);  AVX2_ROUND(Xl, Xr, 3);
+		AVX2_ROUND(Xr, Xl, 2);  AVX2_ROUND(Xl, Xr, 1);
+		Xr = _mm256_xor_si256(Xr, _mm256_set1_epi32((int)bf.PArray[0]));
+
+		avx2_store(output + x * 8, Xr, Xl);
+	}
+}
+
+//-----------------------------------------------------------------------------
+
+// Gathers are not faster than scalar loads on every core that has them, so the
+// two are raced on a few PK2 directory blocks' worth of data. Each side keeps
+// its best of several runs, and AVX2 has to win by 5% to be picked.
+bool blowfish_avx2_faster(const BlowfishPIMPL & bf)
+{
+	const uint64_t count = 4 * 2560 / 8;
+	uint8_t buffer[count * 8];
+	memset(buffer, 0, sizeof(buffer));
+	uint64_t best_scalar = ~(uint64_t)0;
+	uint64_t best_avx2 = ~(uint64_t)0;
+
+	for(int run = 0; run < 5; ++run)
+	{
+		uint64_t start = __rdtsc();
+		for(uint64_t x = 0; x < count; x += 4)
+		{
+			uint32_t blocks[8];
+			memcpy(blocks, buffer + x * 8, 32);
+			bf.Blowfish_decipher4(blocks);
+			memcpy(buffer + x * 8, blocks, 32);
+		}
+		uint64_t ticks = __rdtsc() - start;
+		best_scalar = ticks < best_scalar ? ticks : best_scalar;
+
+		start = __rdtsc();
+		blowfish_avx2_decode(bf, buffer, buffer, count);
+		ticks = __rdtsc() - start;
+		best_avx2 = ticks < best_avx2 ? ticks : best_avx2;
+	}
+
+	return best_avx2 * 20 < best_scalar * 19;
+}
+
+//-----------------------------------------------------------------------------
+
+#else
+
+bool blowfish_avx2_supported()
+{
+	return false;
+}
+
+bool blowfish_avx2_faster(const BlowfishPIMPL &)
+{
+	return false;
+}
+
+void blowfish_avx2_encode(const BlowfishPIMPL &, const uint8_t *, uint8_t *, uint64_t)
+{
+}
+
+void blowfish_avx2_decode(const BlowfishPIMPL &, const uint8_t *, uint8_t *, uint64_t)
+{
+}
+
+#endif
+
+//-----------------------------------------------------------------------------
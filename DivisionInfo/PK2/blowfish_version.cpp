@@ -0,0 +1,168 @@
+//-----------------------------------------------------------------------------
+/*
+	Precomputed Blowfish schedule for the SV.T key
+
+	SV.T is always encrypted with Initialize("SILKROADVERSION", 8), i.e. the
+	key bytes "SILKROAD". These tables are the P-array and S-boxes that key
+	schedule produces, generated once with BlowfishPIMPL::Initialize, so the
+	521 block encryptions never have to run. Blowfish::GetSchedule returns
+	them for that key.
+*/
+//-----------------------------------------------------------------------------
+
+#include <stdint.h>
+
+//-----------------------------------------------------------------------------
+
+extern const char bf_version_key[8] = { 'S', 'I', 'L', 'K', 'R', 'O', 'A', 'D' };
+
+extern const uint32_t bf_version_P[18] =
+{
+	0x77c08184, 0xfe704006, 0x773ce83f, 0x097aa3c4,
+	0x28932611, 0xa6bca212, 0x545cdb0e, 0x7ef543db,
+	0x8e3d2bb4, 0xd87918d3, 0x52a16f43, 0x57f863cd,
+	0x59b75aa2, 0x33565c22, 0xdd92cfa2, 0x4e2616ea,
+	0xc694e738, 0x82d68481,
+};
+
+extern const uint32_t bf_version_S[4][256] =
+{
+	{
+		0x6f88c787, 0x616113e9, 0x37605737, 0xc21b71e4, 0x94b9ea88, 0x8796dade, 0x3709070d, 0x6b9080b9,
+		0xc7f370a7, 0x6c083feb, 0xf04022af, 0xeae94fb6, 0x008d3d7d, 0xfef70b1d, 0x53673d26, 0x04c7cd0f,
+		0x75a68554, 0xb94b42e6, 0xdcd6691d, 0xdcde9930, 0x30b7253b, 0xd23eccb9, 0x7f11de72, 0xe36495da,
+		0xbb5cdd0b, 0xfd07df5c, 0x30bf1bd6, 0x571dd056, 0xf130f9cf, 0x56ab20e1, 0x64d5be30, 0xc8d8911c,
+		0x434fbc9f, 0x71c0ffb1, 0xccad12db, 0xb68aebbb, 0xd0ef6d39, 0xe9035067, 0x6ea32bd8, 0x4e33ce4c,
+		0xee653304, 0xbb52fe63, 0x3b4cddcf, 0x9b899f04, 0x5ab6580c, 0x941a94d5, 0x0c4fbf12, 0x8a8bcb50,
+		0x1fe15299, 0x19bbe094, 0xc091a6df, 0xc9df3d09, 0xe08a6d0f, 0x225dff5f, 0x351b7ee8, 0x34f0f1d8,
+		0x9abf895e, 0xd6600453, 0x6100d30f, 0xdcc8ac46, 0xf612da4d, 0xb9653d7f, 0x49465ac4, 0x20b38341,
+		0x52a2fa60, 0xedeb0c0b, 0x3075b382, 0xc9acb36c, 0x521dbca7, 0xe607309a, 0xad45a3a4, 0xd629e378,
+		0xa4f42282, 0xf5072349, 0x820c5fcd, 0x0c5267bf, 0x940633c4, 0x2ea59978, 0xa4a3834b, 0xd7a9140d,
+		0xfd13b3ce, 0x65be25cf, 0x81598262, 0x2af979ce, 0x715ec49d, 0x8ff9116e, 0x21b5ef85, 0x868274e1,
+		0x529c251c, 0xf8df4f76, 0x36a39e49, 0x3317a188, 0x14468106, 0xbb8fdcd3, 0x67ea3cda, 0x3a0b5829,
+		0x0c02ac57, 0x5a170c6f, 0x3b98637e, 0x70075a24, 0xb9bad94a, 0xc6a2350f, 0x9f48e944, 0x10ec21ec,
+		0xa21e9395, 0x714d83a6, 0x8f23687e, 0xabb87383, 0x687b2052, 0x0cffcbd5, 0x889be84f, 0xbcd1aecf,
+		0xd33400fe, 0x3f338ef8, 0x7e0be4ef, 0x207bffbd, 0xc101ee34, 0x790e15db, 0x91b215c6, 0x4a5a9e26,
+		0x487c91c8, 0x4c1fd479, 0xd0d1d819, 0x32edb706, 0x73916f3e, 0x1f92369b, 0x321fea40, 0xa3b69c3c,
+		0x58f9bfbc, 0x417960c0, 0x864974f7, 0x81cc0736, 0xa96fb178, 0xcd1a2741, 0x47d9343e, 0x34703e73,
+		0xb049e167, 0xb022663f, 0x1924b61d, 0x44493494, 0x557fb4d3, 0x8f6b84c8, 0x84aab069, 0xf7833869,
+		0x33f86fa7, 0xfbf5433f, 0x0cae7ced, 0xb0b5470c, 0x1ab93d83, 0x1bfe62d0, 0xea21595f, 0x73b70b6b,
+		0xfc9d1189, 0x19547710, 0xa6228c4f, 0x57d37628, 0xb62db697, 0x687a167e, 0x76399d63, 0x5bf12c23,
+		0x317e6943, 0x33306920, 0xd6b3944e, 0x425222a1, 0xeda6c61f, 0x37d99577, 0x9fe5e7ab, 0x3a50ec83,
+		0xb6d0cb1c, 0xb1b6572f, 0xc33fc44f, 0xbf7e3050, 0xc6f2f3e4, 0xe1a172a9, 0x4e1e6e73, 0x85532f8f,
+		0xac3516cb, 0xf486a2f2, 0xeadb736f, 0xe7f445e6, 0x1a408394, 0x9d7b3761, 0x4b47fa73, 0x2672adcd,
+		0x2c1928f1, 0xdb0fc7f6, 0xee41f94b, 0x3774980b, 0xfa2703db, 0x6d3f8247, 0x6ab7dcfd, 0xd2b7b62d,
+		0x9f6a154b, 0x78653e71, 0x19abf23d, 0x2f5c218b, 0x32b56a68, 0x783c9bbe, 0x80d7c0d0, 0xf6aee5c2,
+		0xfcb16d1b, 0xa2f0f05d, 0x0c1971b0, 0x1530b9f6, 0xbf76c9b6, 0x2f5b3aa2, 0x4dd28a43, 0x94512b90,
+		0xdca1a280, 0x09cf2333, 0x542a3db8, 0xfb2b6aba, 0x90ec4448, 0x699ae935, 0x6cf9dca4, 0x263fd58a,
+		0x35db3292, 0x6d50559d, 0x7ca46322, 0xf1df94e4, 0xe5ae0cf2, 0xb6dd9685, 0x705b300c, 0xe3d39336,
+		0x369e5bb2, 0xe33afec6, 0x06619cdf, 0x9b6df2dc, 0xe11e5962, 0xd616cc50, 0xac8d8555, 0x1c7e3888,
+		0xf3b0e1b1, 0xf558cfd2, 0x0239b05f, 0x3a81e059, 0xf9cc28e1, 0x80130ac9, 0xdebceb30, 0x0735d3c7,
+		0xbe53c31e, 0x45b3f12b, 0x2f3057df, 0x634737cf, 0x916731c4, 0xc88abdca, 0x46ee4809, 0x5e2cd884,
+		0x46f70ecb, 0xf3def827, 0xec69b9ee, 0xe1cc03ec, 0x252dc40e, 0xb9f2d66b, 0xdffd9d19, 0xcd25fb14,
+	},
+	{
+		0x90f70535, 0xafcb7422, 0x4c32c5b9, 0xd4d09bec, 0x7c0fe53c, 0x3ab03919, 0x47cd1040, 0xf088bb6f,
+		0x2a01be1a, 0x3138bed9, 0x8f9e229b, 0xb5302fe7, 0x5edad73f, 0xb6636c36, 0x5e0fd6f0, 0x417a4f42,
+		0xb5652d6c, 0xfa6ffa9d, 0xc5a08465, 0x15f63dfb, 0xa68e0123, 0xb2365bb8, 0x0f1d42a4, 0x7c2a57a0,
+		0xd53e7dec, 0x43a70b8c, 0xad0d9d2a, 0x1ad10c6d, 0x98b9e62e, 0x8230f662, 0xcc61db1d, 0x1478c17f,
+		0x0d43e846, 0x47cc6e08, 0xa4ee74f4, 0x27fe7306, 0xd798e5bc, 0xe13fabc9, 0xdf10a43b, 0x7b624307,
+		0xc1e8ca53, 0x22042be9, 0xacaa6528, 0x840e0712, 0x5a49ea7e, 0x9a578216, 0xd0716579, 0xdd1d0441,
+		0x2435c197, 0x52959fc4, 0x2df6edb3, 0xce6b18e0, 0xc107a47f, 0x414889d8, 0x06a3ad79, 0x2875eae9,
+		0x80ca44d1, 0x20e2c67e, 0x462839c1, 0x66b48fc3, 0x7182e602, 0xb2ad4f76, 0x221e36b7, 0x9bac3ae8,
+		0x3c196ca1, 0x1a1991e3, 0x3292c7d6, 0xd08f901f, 0x6d9edbd5, 0x10a63a09, 0x104ab2cc, 0xfd6c3cb4,
+		0xf7cfb0c9, 0x58d5c8dc, 0x5be3e563, 0x8b978fd4, 0x86489384, 0x7fab4985, 0xcf4aacb9, 0xc3abda9a,
+		0xebd2def8, 0xe9ed5229, 0x57ed69bb, 0xf8e04c41, 0x79703794, 0x7b37ddbd, 0x5c4fcc5a, 0x4ace694f,
+		0x0223c801, 0xe771b115, 0x92068c13, 0x8d5b5970, 0x2066d0db, 0xe818db30, 0xedfaa1c3, 0x5416b5fe,
+		0xddcabbf9, 0x4474d463, 0x5c3da652, 0x9553b48c, 0x898545ae, 0x21f8099a, 0xa131353c, 0x5819f446,
+		0x1652ce0b, 0xbb59a4e9, 0xe67703d0, 0xdaee5604, 0x9b1146a4, 0x59789406, 0x7e83851f, 0x2ad2f304,
+		0x2022739c, 0xd278b1a8, 0xb68741bb, 0x67e64333, 0x5e384791, 0xb3c397d4, 0xe2eb6442, 0xc463144b,
+		0x4f045d03, 0x178c276b, 0x10162939, 0xebb0f004, 0x5a0dc212, 0x39db22af, 0x5f21960c, 0x95045e9d,
+		0x4ffbc50f, 0x32f6d102, 0xbee83682, 0xc9a9b100, 0x49c54bb2, 0xbf6ef544, 0x455515d3, 0xa7fae9b3,
+		0xb14f1729, 0xd323c830, 0x43c21432, 0x833e3083, 0x746e3e16, 0x446c9b4c, 0x587992dc, 0xd8379aad,
+		0x70d582a7, 0x943f5c73, 0xcadfa000, 0x4a3bb594, 0xb96c7b14, 0x013314c5, 0x76556d1d, 0x70f61731,
+		0x94c873ac, 0x6471bb18, 0xf44c0c52, 0x1a18f16f, 0x5c8042d9, 0xb169f6ae, 0xd397ccc4, 0xa13e0853,
+		0xcc5fbdc2, 0xfdc3f5c8, 0x9a5a32da, 0xca586acc, 0x4472d104, 0x182aca50, 0x806dd61b, 0xbbb5d0b8,
+		0x97006a98, 0x2d8e0a41, 0x9fcca8cd, 0x986e7c50, 0x8bff0872, 0x6983148c, 0x3c667238, 0x1ccfc520,
+		0x9f73775c, 0xf5c11807, 0x7c50361a, 0x1a0e2b33, 0xf2437c0e, 0x5eae6162, 0x556f86d1, 0x69399547,
+		0xb98df03c, 0xe5d4d3fa, 0x20601c86, 0x64125061, 0x0e66df80, 0x8ab04e6b, 0xf211e869, 0x987e8968,
+		0x6bd0cfdb, 0x967823e7, 0xadc7e433, 0x9507610f, 0x026d7a6e, 0xb5e51a58, 0x9a98dba7, 0x601a1527,
+		0x7d883359, 0xaa5bfc35, 0x9ff24fdb, 0xe36535d5, 0xfd30e3ab, 0xa235bedb, 0xf600251f, 0xc518c511,
+		0x4bceceed, 0xf1d3c9ec, 0xa7237239, 0x66dbae6c, 0xbdb1fc81, 0xe2c7817a, 0xe425c5d6, 0x25a04b2f,
+		0xf4c62d86, 0xdda10910, 0xc14751ec, 0x3534b900, 0xfff5bb7d, 0x899cc812, 0xafdfd363, 0x26457b76,
+		0xfee1dfd4, 0x70b083a7, 0xf08e165d, 0x7ab78907, 0xa2e4865e, 0x247dd3d3, 0x2e0b8c85, 0x47166711,
+		0x06d2c02e, 0xf4b42b31, 0x931688c3, 0x2c70e71b, 0x0f0c25bf, 0x0887e6fd, 0x43d44b0a, 0x8c14bb61,
+		0xadece075, 0xb146b427, 0x64b6d5ee, 0xd652ac9f, 0xef822620, 0x230f355e, 0xaba1b675, 0x43a73977,
+		0x7ef86b9f, 0x9b711be4, 0x54d1ab57, 0x5b56c20b, 0xf43b8c0d, 0xe4f4e6dc, 0x72087064, 0x7f6c73ea,
+	},
+	{
+		0x46b330a3, 0x3c04e975, 0x8e918c2c, 0x923a2722, 0x0392ca6d, 0x1a1463fb, 0xacee751c, 0xadb07c3b,
+		0xf14decf0, 0x8eb7dcf3, 0x7e0a44d2, 0x6f21d958, 0x2de34db4, 0x88c1be5c, 0x8943e88d, 0x1f4634e4,
+		0x572796e8, 0xa8d8a738, 0xf230637c, 0xc1f9d858, 0x4e1c8b36, 0xe999aa17, 0x836c68c9, 0x937157f8,
+		0x52f2baa7, 0x84d49381, 0xef7b7151, 0x5729f1b0, 0xbe2b1ee9, 0x7e666b59, 0xb358af34, 0x552e9713,
+		0xb46877ac, 0xdfb53132, 0x40e08ffe, 0x673b8fa4, 0x7f335be6, 0xe3a95769, 0xf3c1c886, 0x42beac90,
+		0xc98645e8, 0x3c4608c8, 0x19cfdb27, 0x40841a67, 0x81d4d6b3, 0xaa518d62, 0xe1b6971c, 0xece8befc,
+		0x5f37c5ca, 0x8a03b646, 0x3710e62b, 0xed8e52b0, 0x32841fcc, 0x041585c5, 0x202400f9, 0x0b69b797,
+		0x76982022, 0x3095c7d8, 0x42d1280a, 0x5bcccb31, 0x256c7436, 0xbe5b93b3, 0xc854d634, 0xb13b8e20,
+		0x61c19cc3, 0x50094e2a, 0xd138e8e0, 0x7f322db3, 0xcee075f5, 0x4a56e4a3, 0x9aa8e24e, 0xe3f0d144,
+		0xfa221490, 0x82c06425, 0xc27b7e6e, 0xb83f8485, 0xfa771aab, 0xfe71c7ee, 0x4cc56328, 0x37495536,
+		0x4fd84b0e, 0xefeafdbf, 0xa6a78b45, 0x12ddcad3, 0x6f2b7247, 0xe3d08963, 0x7805297f, 0x3d9de49f,
+		0x57425851, 0x1cfe7642, 0x66ed7f92, 0x8b5fac13, 0xa7b121d5, 0x6b63a462, 0x59305fa3, 0x6dae4975,
+		0x0a5b1cfd, 0xd38b4924, 0x26bbce56, 0xadf3a229, 0x4fa24d97, 0xab9f88eb, 0xe35cddc9, 0xe589ee8a,
+		0xc0dbb907, 0x71673a6b, 0x23756383, 0xc19e8a65, 0x15cbad29, 0x3bd1fa09, 0x30559b7a, 0xbd94e185,
+		0xfd3c0aca, 0xc19c328c, 0x5d842367, 0xa4389867, 0x378b07c7, 0x88bb2a9b, 0x48c1bccf, 0x8c3574c6,
+		0xdbab0ebf, 0xe2356cff, 0xa6cdfcef, 0x7a939458, 0x3e433949, 0xcc3eb174, 0x5b5b0dfb, 0x431057ee,
+		0xd37ae000, 0x1e4a39bd, 0x40021d19, 0x040fbef1, 0x7ec0c751, 0xccd9cedb, 0x6a8a5419, 0xa8a6c9db,
+		0x31b967c9, 0xd21ad29c, 0x3ece56cb, 0xd49181c8, 0x965aed19, 0x0fa6f0e0, 0x36b85e81, 0xde920e73,
+		0xbabfe772, 0xc9205354, 0x8ed48f49, 0xd11e2b9f, 0x91ad65f6, 0xd3eb5184, 0x9e9258a1, 0xe6f6cd4b,
+		0x05a82467, 0x22abf255, 0xdb8d6df3, 0x6e2f6c2f, 0xe0379beb, 0x9d314f4f, 0x6cfe4498, 0xd65f3dd1,
+		0x86e04f77, 0xc3bc9c3f, 0x5c8f71f6, 0x849923e2, 0xffc87d07, 0x0b997a2c, 0x5488c630, 0x29544a26,
+		0x728fc81d, 0x8a0aafe9, 0x5bba79ca, 0x30cc15a7, 0x9e64f289, 0x4a5f176b, 0x3d0d9c20, 0x69c346a7,
+		0xcd9fcc95, 0xe49e2ba4, 0xef82e646, 0x2326ff96, 0x967dc9f2, 0xf71b669a, 0x54b12290, 0xde897ae0,
+		0x42413934, 0x5c0ecad6, 0x07ee226f, 0x6ab99ceb, 0xf4378787, 0x89294bf3, 0x8cb1966f, 0x87f05465,
+		0x9fa82ea4, 0x878f49c5, 0xd3edae47, 0x9887d9a1, 0x4f71f660, 0x4496fbde, 0xe253711e, 0x6dfaaf4b,
+		0xe40fbe0d, 0xf059ce04, 0x4ae6b13d, 0x65bfda20, 0x9f515d57, 0x079b5e7d, 0xfe09c581, 0x75892c31,
+		0xae8f0594, 0x04b2a1c3, 0x09c42f8e, 0xd6778590, 0xdac3c6a3, 0xb21a23ef, 0x015d8ca2, 0x97273efb,
+		0x8ea8bf06, 0x190935d5, 0xaca575a8, 0xc7c73a9c, 0xbb6bb836, 0xd51ecc39, 0x9afea92b, 0xcdfbf88c,
+		0x34425fb9, 0x20766063, 0x9af50957, 0x3e0a8e61, 0x036e12d3, 0xf076b609, 0x0c8cd2ad, 0x87853682,
+		0xf40bb204, 0xaa863d5f, 0x397e63f5, 0x7da61bbb, 0xae7d1ff1, 0xb58ae1ae, 0xd58a02b4, 0x26fa82cb,
+		0xe10fd1ff, 0x002cb8da, 0x1369e19b, 0x94909bc3, 0x79e9dc24, 0xd0e78e7f, 0x8a3c485c, 0x0b49c9ab,
+		0xdb337642, 0xd1f5f70d, 0xd1bd73e4, 0x3a71cbfb, 0xec13acc5, 0x58beaf8c, 0x0ae44091, 0x97c01a25,
+	},
+	{
+		0xa7043748, 0xb890d29e, 0x02d4a85d, 0x585ef41b, 0xbecb8c72, 0xa60b9e35, 0xcc0b7137, 0x66884d65,
+		0xf5abd5c8, 0xa67f3f09, 0x4fe559f3, 0x526f8327, 0xf4503c8a, 0xbdadb8de, 0x5122f724, 0x98ef2f9c,
+		0x3bcbcd46, 0xb55005ba, 0x2b2b5a57, 0x1a482889, 0x3464e53b, 0x7b7b91b9, 0x215d6a1c, 0xfc899964,
+		0x24ea0f8e, 0xc30119f1, 0xe34127a9, 0x421e981c, 0x77033a1f, 0xa7641ea8, 0xe61f80fd, 0xb95c4ad1,
+		0xd96c5957, 0x724f5e74, 0xc3e07f39, 0xcc5d4368, 0x1dc54019, 0xc9c7400e, 0xb33f7c9f, 0x343e9474,
+		0xb67f2220, 0x75631a1e, 0x3fb225b8, 0x3b885eb2, 0xe7b97aec, 0x3840e775, 0x6e5cf99e, 0x989e8879,
+		0x8af31fc0, 0x515b9340, 0xd76a008a, 0x20a9fa06, 0x4c06878a, 0x539dc058, 0xd59d8c85, 0xa6e845b8,
+		0x2e4b183a, 0x37c5a657, 0xd7aa2cf4, 0xee93bd02, 0x83ca6d8e, 0x0749c7d0, 0x56981594, 0x203a2c5e,
+		0xce686a9a, 0x40caaf73, 0x864d78be, 0xa60e29d3, 0xd27523ee, 0x827bb691, 0xc14c21ca, 0x738d23df,
+		0xc0f946c3, 0xf26befda, 0x1f4460f5, 0x5778142d, 0xdfe6be88, 0x1d02b1cd, 0x90864a97, 0x86131763,
+		0x7e5e6236, 0x4f3d160b, 0x581c5e8b, 0x32dee2cf, 0x4fbee2b8, 0x01b56d0c, 0xf91d189a, 0x1dd3451c,
+		0x3c32732f, 0x2ce9a70f, 0xb14ab0ba, 0xe60f9e88, 0x85a4d883, 0x410e72af, 0x4f9d1332, 0x59ed9693,
+		0xc45bbd9b, 0x1e1116d1, 0xffcae627, 0x7407ea4f, 0x2d8e5bd6, 0x89ee1fe4, 0x816ec80f, 0x9673f127,
+		0x56c6fdac, 0x01ac61c4, 0x9bc784b7, 0x05d0c4b9, 0xe405b429, 0x316a7eb8, 0x98ed5a3b, 0x0c7e5c10,
+		0x1b24607d, 0x4861e054, 0x8e43e3fc, 0x45e086fb, 0xaaa518eb, 0x73ca8ffb, 0x66df4648, 0xbc6f3a35,
+		0x978db85e, 0xf4dcb025, 0xf0aa84e4, 0xa0fe3d8a, 0x981d3700, 0xa28ee577, 0xf6894562, 0xe6baaadd,
+		0x7f4afe75, 0xa3bb8349, 0x87ab1c22, 0x63ec6494, 0xcbde9a60, 0x26823227, 0x35130fb8, 0xd959e2c8,
+		0x67790961, 0xdc8fba26, 0xb0d90473, 0x32ba8a59, 0x2e2016da, 0x7cfb62de, 0x40c8f395, 0x9e6ab5cc,
+		0xc14799c2, 0xb424bd38, 0x0857e588, 0xf4afbc0b, 0x71c71e88, 0x8154e3cd, 0x1d238aed, 0x9554b5e0,
+		0x36958d1b, 0x2ce322b7, 0x33b4b008, 0x52dd95ac, 0x5428931a, 0x63f5ac9a, 0xd78a297a, 0xbad64aa9,
+		0x1d163d00, 0xb9b88edf, 0xb772b7cc, 0x399f4d4c, 0xf9db34b0, 0x8f51604e, 0x65d627c2, 0xde95807f,
+		0x429300fa, 0x12d8b71c, 0x959b6372, 0xb7cc573c, 0x662d1103, 0xf7c05e1f, 0xae29bb6c, 0x190759dc,
+		0x8de00be9, 0x6b606987, 0x0b2c83d4, 0x4df7d1cc, 0xd25438f3, 0x0b1392cb, 0x78f4b5b0, 0x401955f6,
+		0x6b15fbb3, 0x89efb68d, 0x897685ee, 0x9dc2f150, 0x8ee13162, 0xcd487edf, 0x772ad999, 0xcf932d8d,
+		0x68417231, 0x791087b4, 0x8bd2c620, 0x6876ad96, 0xb2ee814b, 0x21e1606f, 0x400206d7, 0x3ed03c0a,
+		0xa450e4e8, 0x318547b0, 0x241b7a88, 0x6a72f3c7, 0x4b739230, 0xefe6ab57, 0xcbcf7d0c, 0x09a77fae,
+		0x58c3ab7e, 0xda50555c, 0x7b564391, 0x0277b205, 0x51a37482, 0xaddd771d, 0x592c5edf, 0xe8208aa0,
+		0xaa44793e, 0xad664aea, 0x2f91c4a8, 0xddfb0fb5, 0x8de7460f, 0xef54e0d7, 0xc4bd07b4, 0xed5febd3,
+		0x90e59757, 0x4e242014, 0x3f4d41a1, 0xec9c2508, 0xe50292a7, 0x591e8259, 0x5025d1b6, 0xedd3b1b3,
+		0x71df1271, 0x1f20fd8e, 0xbdd237c3, 0xa3da79ac, 0x070e0f7d, 0x73317bf9, 0x949915fd, 0xd9dd5148,
+		0x27b8c2a3, 0x524ab9b9, 0x09a38f23, 0x1d8535e6, 0x06c38f33, 0xabbff0ee, 0xccaa0a69, 0xce33b095,
+		0x77bd36bc, 0xda13eaf3, 0x2fadc156, 0x1a09dc49, 0xdbeadd0b, 0x8887a573, 0x3c3ef89d, 0xccb6f7b4,
+	}
+};
+
+//-----------------------------------------------------------------------------
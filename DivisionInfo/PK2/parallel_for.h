@@ -0,0 +1,112 @@
+#pragma once
+
+#ifndef PARALLEL_FOR_H_
+#define PARALLEL_FOR_H_
+
+//-----------------------------------------------------------------------------
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <boost/bind.hpp>
+#include <boost/thread/thread.hpp>
+#include <boost/thread/mutex.hpp>
+
+//-----------------------------------------------------------------------------
+
+// Hands out [0, count) in chunks of 'grain' indices to a group of threads.
+// The calling thread takes part in the work as well.
+template <typename Func>
+class ParallelFor
+{
+private:
+	Func & m_func;
+	size_t m_count;
+	size_t m_grain;
+	size_t m_next;
+	boost::mutex m;
+
+	ParallelFor & operator = (const ParallelFor & rhs);
+	ParallelFor(const ParallelFor & rhs);
+
+	void Worker()
+	{
+		while(true)
+		{
+			size_t begin = 0;
+			size_t end = 0;
+
+			{
+				boost::mutex::scoped_lock lock(m);
+				if(m_next >= m_count)
+				{
+					return;
+				}
+				begin = m_next;
+				end = (m_count - m_next > m_grain) ? m_next + m_grain : m_count;
+				m_next = end;
+			}
+
+			for(size_t x = begin; x < end; ++x)
+			{
+				m_func(x);
+			}
+		}
+	}
+
+public:
+	ParallelFor(Func & func, size_t count, size_t grain) : m_func(func), m_count(count), m_grain(grain ? grain : 1), m_next(0)
+	{
+	}
+
+	void Run(uint32_t threads)
+	{
+		boost::thread_group workers;
+		for(uint32_t x = 1; x < threads; ++x)
+		{
+			workers.create_thread(boost::bind(&ParallelFor::Worker, this));
+		}
+		Worker();
+		workers.join_all();
+	}
+};
+
+//-----------------------------------------------------------------------------
+
+// Returns the number of threads to use when the caller passes 0.
+inline uint32_t parallel_thread_count(uint32_t threads = 0)
+{
+	if(threads == 0)
+	{
+		threads = boost::thread::hardware_concurrency();
+	}
+	return threads ? threads : 1;
+}
+
+// Calls func(index) for every index in [0, count) using 'threads' threads
+// (0 means one per core). Returns once every call has finished.
+template <typename Func>
+void parallel_for(size_t count, Func & func, uint32_t threads = 0, size_t grain = 1)
+{
+	threads = parallel_thread_count(threads);
+	if(threads > count)
+	{
+		threads = (uint32_t)count;
+	}
+
+	if(threads <= 1)
+	{
+		for(size_t x = 0; x < count; ++x)
+		{
+			func(x);
+		}
+		return;
+	}
+
+	ParallelFor<Func> work(func, count, grain);
+	work.Run(threads);
+}
+
+//-----------------------------------------------------------------------------
+
+#endif
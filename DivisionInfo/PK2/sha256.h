@@ -0,0 +1,49 @@
+//-----------------------------------------------------------------------------
+/*
+	Portable SHA-256 (FIPS 180-4)
+
+	Small self contained implementation so content hashes can be produced
+	without pulling in a crypto library. Only stdint types are used.
+*/
+//-----------------------------------------------------------------------------
+
+#pragma once
+
+#ifndef SHA256_H_
+#define SHA256_H_
+
+//-----------------------------------------------------------------------------
+
+#include <stdint.h>
+
+//-----------------------------------------------------------------------------
+
+class SHA256
+{
+private:
+	uint32_t m_state[8];
+	uint64_t m_length;
+	uint8_t m_buffer[64];
+	uint32_t m_buffer_size;
+
+	void Transform(const uint8_t * block);
+
+public:
+	SHA256();
+
+	// Starts a new hash.
+	void Reset();
+
+	// Adds data to the hash. Can be called any number of times.
+	void Update(const void * data, uint64_t size);
+
+	// Finishes the hash and writes the 32 byte digest. Call Reset before reusing.
+	void Final(uint8_t digest[32]);
+
+	// Hashes a single buffer.
+	static void Hash(const void * data, uint64_t size, uint8_t digest[32]);
+};
+
+//-----------------------------------------------------------------------------
+
+#endif
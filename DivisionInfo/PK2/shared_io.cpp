@@ -1,20 +1,41 @@
 #include "shared_io.h"
 #include <stdlib.h>
+#include <string.h>
 
 #ifdef _WIN32
 	#include <windows.h>
+	#include <io.h>
 #else
 	#include <dirent.h>
+	#include <fcntl.h>
+	#include <unistd.h>
+	#include <sys/stat.h>
 #endif
 
 //-----------------------------------------------------------------------------
 
+FILE * file_open(const char * filename, const char * mode)
+{
+#ifdef _WIN32
+	FILE * file = 0;
+	if(fopen_s(&file, filename, mode) != 0)
+	{
+		return 0;
+	}
+	return file;
+#else
+	return fopen(filename, mode);
+#endif
+}
+
+//-----------------------------------------------------------------------------
+
 int file_seek(FILE * file, int64_t offset, int orgin)
 {
 #ifdef _WIN32
 	return _fseeki64(file, offset, orgin);
 #else
-	return fseek(file, offset, orgin);
+	return fseeko(file, (off_t)offset, orgin);
 #endif
 }
 
@@ -25,7 +46,7 @@ int64_t file_tell(FILE * file)
 #ifdef _WIN32
 	return _ftelli64(file);
 #else
-	return ftell(file);
+	return (int64_t)ftello(file);
 #endif
 }
 
@@ -34,7 +55,7 @@ int64_t file_tell(FILE * file)
 int file_remove(const char * filename)
 {
 #ifdef _WIN32
-	return DeleteFileA(filename);
+	return DeleteFileA(filename) ? 0 : -1;
 #else
 	return remove(filename);
 #endif
@@ -42,11 +63,107 @@ int file_remove(const char * filename)
 
 //-----------------------------------------------------------------------------
 
+int file_sync(FILE * file)
+{
+	if(fflush(file) != 0)
+	{
+		return -1;
+	}
+#ifdef _WIN32
+	return _commit(_fileno(file));
+#else
+	return fsync(fileno(file));
+#endif
+}
+
+//-----------------------------------------------------------------------------
+
+int file_rename(const char * from, const char * to)
+{
+#ifdef _WIN32
+	return MoveFileExA(from, to, MOVEFILE_REPLACE_EXISTING | MOVEFILE_WRITE_THROUGH) ? 0 : -1;
+#else
+	return rename(from, to);
+#endif
+}
+
+//-----------------------------------------------------------------------------
+
+bool file_same(const char * a, const char * b)
+{
+#ifdef _WIN32
+	HANDLE handles[2];
+	BY_HANDLE_FILE_INFORMATION info[2];
+	const char * names[2] = { a, b };
+	bool same = true;
+
+	for(int x = 0; x < 2; ++x)
+	{
+		// No access is needed to read the file index, and nothing is locked
+		handles[x] = CreateFileA(names[x], 0, FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE, 0, OPEN_EXISTING, FILE_FLAG_BACKUP_SEMANTICS, 0);
+		if(handles[x] == INVALID_HANDLE_VALUE || !GetFileInformationByHandle(handles[x], &info[x]))
+		{
+			same = false;
+		}
+	}
+
+	same = same && info[0].dwVolumeSerialNumber == info[1].dwVolumeSerialNumber && info[0].nFileIndexHigh == info[1].nFileIndexHigh && info[0].nFileIndexLow == info[1].nFileIndexLow;
+
+	for(int x = 0; x < 2; ++x)
+	{
+		if(handles[x] != INVALID_HANDLE_VALUE)
+		{
+			CloseHandle(handles[x]);
+		}
+	}
+	return same;
+#else
+	struct stat sa;
+	struct stat sb;
+	if(stat(a, &sa) != 0 || stat(b, &sb) != 0)
+	{
+		return false;
+	}
+	return sa.st_dev == sb.st_dev && sa.st_ino == sb.st_ino;
+#endif
+}
+
+//-----------------------------------------------------------------------------
+
+int file_sync_dir(const char * filename)
+{
+#ifdef _WIN32
+	(void)filename;
+	return 0;
+#else
+	std::string folder = filename;
+	size_t slash = folder.find_last_of('/');
+	if(slash == std::string::npos)
+	{
+		folder = ".";
+	}
+	else
+	{
+		folder.erase(slash ? slash : 1);
+	}
+
+	int fd = open(folder.c_str(), O_RDONLY);
+	if(fd < 0)
+	{
+		return -1;
+	}
+	int result = fsync(fd);
+	close(fd);
+	return result;
+#endif
+}
+
+//-----------------------------------------------------------------------------
+
 std::vector<uint8_t> file_tovector(const char * filename)
 {
 	std::vector<uint8_t> contents;
-	FILE * infile = 0;
-	fopen_s(&infile, filename, "rb");
+	FILE * infile = file_open(filename, "rb");
 	if(infile == 0)
 	{
 		return contents;
@@ -54,16 +171,161 @@ std::vector<uint8_t> file_tovector(const char * filename)
 	file_seek(infile, 0, SEEK_END);
 	int64_t size = file_tell(infile);
 	file_seek(infile, 0, SEEK_SET);
-	contents.resize(size);
+	if(size <= 0)
+	{
+		fclose(infile);
+		return contents;
+	}
+	contents.resize((size_t)size);
 	size_t read_count = 0;
 	int64_t index = 0;
-	while(size && (read_count = fread(&contents[index], 1, size > 0x7FFFFFF ? 0x7FFFFFF : size, infile)))
+	while(size && (read_count = fread(&contents[(size_t)index], 1, (size_t)(size > 0x7FFFFFF ? 0x7FFFFFF : size), infile)))
 	{
 		index += read_count;
 		size -= read_count;
 	}
 	fclose(infile);
+	// A file that shrank while being read only returns what was there
+	contents.resize((size_t)index);
 	return contents;
 }
 
 //-----------------------------------------------------------------------------
+
+//-----------------------------------------------------------------------------
+
+#ifdef _WIN32
+
+static uint64_t filetime_touint64(const FILETIME & time)
+{
+	return ((uint64_t)time.dwHighDateTime << 32) | time.dwLowDateTime;
+}
+
+#else
+
+// Unix seconds to 100ns ticks since 1601
+static uint64_t unixtime_towindows(time_t time)
+{
+	return (uint64_t)time * 10000000 + 116444736000000000ULL;
+}
+
+static bool stat_toentry(const char * path, dir_entry & entry)
+{
+	struct stat info;
+	if(stat(path, &info) != 0)
+	{
+		return false;
+	}
+	entry.folder = S_ISDIR(info.st_mode);
+	entry.size = entry.folder ? 0 : (uint64_t)info.st_size;
+	entry.create_time = unixtime_towindows(info.st_ctime);
+	entry.modify_time = unixtime_towindows(info.st_mtime);
+	entry.access_time = unixtime_towindows(info.st_atime);
+	return true;
+}
+
+#endif
+
+//-----------------------------------------------------------------------------
+
+bool dir_list(const char * path, std::vector<dir_entry> & entries)
+{
+	entries.clear();
+
+#ifdef _WIN32
+	std::string pattern = std::string(path) + "\\*";
+	WIN32_FIND_DATAA data;
+	HANDLE find = FindFirstFileA(pattern.c_str(), &data);
+	if(find == INVALID_HANDLE_VALUE)
+	{
+		return false;
+	}
+	do
+	{
+		if(strcmp(data.cFileName, ".") == 0 || strcmp(data.cFileName, "..") == 0)
+		{
+			continue;
+		}
+		// Linked folders and junctions can point back at an ancestor
+		if((data.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY) && (data.dwFileAttributes & FILE_ATTRIBUTE_REPARSE_POINT))
+		{
+			continue;
+		}
+		dir_entry entry;
+		entry.name = data.cFileName;
+		entry.folder = (data.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY) != 0;
+		entry.size = entry.folder ? 0 : (((uint64_t)data.nFileSizeHigh << 32) | data.nFileSizeLow);
+		entry.create_time = filetime_touint64(data.ftCreationTime);
+		entry.modify_time = filetime_touint64(data.ftLastWriteTime);
+		entry.access_time = filetime_touint64(data.ftLastAccessTime);
+		entries.push_back(entry);
+	} while(FindNextFileA(find, &data));
+	FindClose(find);
+#else
+	DIR * dir = opendir(path);
+	if(dir == 0)
+	{
+		return false;
+	}
+	std::string base = std::string(path) + "/";
+	struct dirent * item = 0;
+	while((item = readdir(dir)) != 0)
+	{
+		if(strcmp(item->d_name, ".") == 0 || strcmp(item->d_name, "..") == 0)
+		{
+			continue;
+		}
+		dir_entry entry;
+		entry.name = item->d_name;
+		std::string full = base + entry.name;
+		if(!stat_toentry(full.c_str(), entry))
+		{
+			continue; // vanished or a dangling link
+		}
+		// Linked folders can point back at an ancestor
+		struct stat link;
+		if(entry.folder && lstat(full.c_str(), &link) == 0 && S_ISLNK(link.st_mode))
+		{
+			continue;
+		}
+		entries.push_back(entry);
+	}
+	closedir(dir);
+#endif
+
+	return true;
+}
+
+//-----------------------------------------------------------------------------
+
+bool dir_stat(const char * path, dir_entry & entry)
+{
+	const char * name = strrchr(path, '/');
+#ifdef _WIN32
+	const char * name2 = strrchr(path, '\\');
+	if(name2 > name)
+	{
+		name = name2;
+	}
+
+	WIN32_FILE_ATTRIBUTE_DATA data;
+	if(!GetFileAttributesExA(path, GetFileExInfoStandard, &data))
+	{
+		return false;
+	}
+	entry.folder = (data.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY) != 0;
+	entry.size = entry.folder ? 0 : (((uint64_t)data.nFileSizeHigh << 32) | data.nFileSizeLow);
+	entry.create_time = filetime_touint64(data.ftCreationTime);
+	entry.modify_time = filetime_touint64(data.ftLastWriteTime);
+	entry.access_time = filetime_touint64(data.ftLastAccessTime);
+#else
+	if(!stat_toentry(path, entry))
+	{
+		return false;
+	}
+#endif
+	entry.name = name ? name + 1 : path;
+	return true;
+}
+
+//-----------------------------------------------------------------------------
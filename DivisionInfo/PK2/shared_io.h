@@ -6,18 +6,60 @@
 //-----------------------------------------------------------------------------
 
 #include <stdint.h>
+#include <stdio.h>
 #include <vector>
+#include <string>
 
 //-----------------------------------------------------------------------------
 
+// Opens a file like fopen on every platform. Returns 0 on failure.
+FILE * file_open(const char * filename, const char * mode);
+
 int file_seek(FILE * file, int64_t offset, int orgin);
 
 int64_t file_tell(FILE * file);
 
+// Deletes a file. Returns 0 on success on every platform.
 int file_remove(const char * filename);
 
+// Flushes the stream and asks the OS to write it to disk. Returns 0 on success.
+int file_sync(FILE * file);
+
+// Renames 'from' to 'to', replacing 'to' if it exists. Returns 0 on success.
+int file_rename(const char * from, const char * to);
+
+// Returns true if both paths name the same existing file, however they are
+// spelled and through any hard link.
+bool file_same(const char * a, const char * b);
+
+// Makes creating, renaming or removing 'filename' durable by syncing the folder
+// that holds it. NTFS journals its metadata, so this does nothing on Windows.
+// Returns 0 on success.
+int file_sync_dir(const char * filename);
+
 std::vector<uint8_t> file_tovector(const char * filename);
 
+// One item of a directory listing. Times are in the Windows format PK2 entries
+// use (100ns ticks since 1601) on every platform.
+struct dir_entry
+{
+	std::string name;
+	bool folder;
+	uint64_t size;
+	uint64_t create_time;
+	uint64_t modify_time;
+	uint64_t access_time;
+};
+
+// Lists the files and folders directly inside 'path', without "." and "..".
+// Folders reached through a symbolic link or junction are left out, so walking
+// the result level by level always ends. Linked files are listed as their
+// target. Returns false if the folder cannot be read.
+bool dir_list(const char * path, std::vector<dir_entry> & entries);
+
+// Fills 'entry' with the information of a single file or folder.
+bool dir_stat(const char * path, dir_entry & entry);
+
 //-----------------------------------------------------------------------------
 
 #endif
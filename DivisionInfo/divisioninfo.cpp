@@ -108,18 +108,9 @@ void DivisionInfo::Open()
 			path = folders[0];
 			ui.SilkroadPath->setText(path);
 			
-			bool open = false;
-			for(size_t x = 0; x < keys.size(); ++x)
-			{
-				pk2reader.SetDecryptionKey((char*)keys[x].c_str(), keys[x].size());
-
-				//Attempt to open the PK2 file
-				if(pk2reader.Open(std::string(path.toAscii().data()) + "/Media.pk2"))
-				{
-					open = true;
-					break;
-				}
-			}
+			//Attempt to open the PK2 file, all keys are tried at once
+			int key_index = -1;
+			bool open = pk2reader.Open(std::string(path.toAscii().data()) + "/Media.pk2", keys, key_index);
 
 			if(open)
 			{
@@ -192,23 +183,11 @@ void DivisionInfo::Save()
 	{
 		bool error = false;
 
-		if(!pk2writer.Initialize(std::string(path.toAscii().data()) + "/GFXFileManager.dll"))
-		{
-			QMessageBox::critical(this, "Error", "Failed to initialize GFXFileManager.dll");
-			return;
-		}
-
-		/*char * keys[2] =
-		{
-			"169841",						//iSRO/SilkroadR/MySRO/vSRO
-			"\x32\x30\x30\x39\xC4\xEA"		//ZSZC/SWSRO
-		};*/
-
 		bool open = false;
 		for(size_t x = 0; x < keys.size(); ++x)
 		{
-			//Attempt to open the PK2 file
-			if(pk2writer.Open(std::string(path.toAscii().data()) + "/Media.pk2", (void*)keys[x].c_str(), 6))
+			//Attempt to open the PK2 file, the writer checks each key against the header
+			if(pk2writer.Open(std::string(path.toAscii().data()) + "/Media.pk2", keys[x].data(), (uint8_t)keys[x].size()))
 			{
 				open = true;
 				break;
@@ -217,17 +196,19 @@ void DivisionInfo::Save()
 
 		if(!open)
 		{
-			QMessageBox::critical(this, "Error", pk2writer.GetError());
-			pk2writer.Deinitialize();
+			QMessageBox::critical(this, "Error", pk2writer.GetError().c_str());
 			return;
 		}
 
+		//All three files go in together or not at all
+		pk2writer.BeginTransaction();
+
 		//Save Silkroad version
 		StreamUtility version = CreateSVT();
 		if(version.GetStreamSize())
 		{
 			//Import the file
-			if(!pk2writer.ImportFile("SV.T", (void*)version.GetStreamPtr(), version.GetStreamSize()))
+			if(!pk2writer.ImportFile("SV.T", version.GetStreamPtr(), version.GetStreamSize()))
 			{
 				QMessageBox::critical(this, "Error", "There was a problem saving the version file (Media.pk2/SV.T)");
 				error = true;
@@ -239,7 +220,7 @@ void DivisionInfo::Save()
 		if(division.GetStreamSize())
 		{
 			//Import the file
-			if(!pk2writer.ImportFile("DIVISIONINFO.TXT", (void*)division.GetStreamPtr(), division.GetStreamSize()))
+			if(!pk2writer.ImportFile("DIVISIONINFO.TXT", division.GetStreamPtr(), division.GetStreamSize()))
 			{
 				QMessageBox::critical(this, "Error", "There was a problem saving the division info (Media.pk2/DIVISIONINFO.TXT)");
 				error = true;
@@ -250,16 +231,30 @@ void DivisionInfo::Save()
 		if(gateport.GetStreamSize())
 		{
 			//Import the file
-			if(!pk2writer.ImportFile("GATEPORT.TXT", (void*)gateport.GetStreamPtr(), gateport.GetStreamSize()))
+			if(!pk2writer.ImportFile("GATEPORT.TXT", gateport.GetStreamPtr(), gateport.GetStreamSize()))
 			{
 				QMessageBox::critical(this, "Error", "There was a problem saving the division info (Media.pk2/GATEPORT.TXT)");
 				error = true;
 			}
 		}
 
+		//Write everything that was staged with a single directory update
+		if(error)
+		{
+			pk2writer.Rollback();
+		}
+		else if(!pk2writer.Commit())
+		{
+			QMessageBox::critical(this, "Error", pk2writer.GetError().c_str());
+			error = true;
+		}
+
 		//PK2 writer cleanup
-		pk2writer.Close();
-		pk2writer.Deinitialize();
+		if(!pk2writer.Close() && !error)
+		{
+			QMessageBox::critical(this, "Error", pk2writer.GetError().c_str());
+			error = true;
+		}
 
 		if(!error)
 			QMessageBox::information(this, "Success", "The PK2 modifications have been saved!");
@@ -574,14 +569,18 @@ StreamUtility DivisionInfo::CreateSVT()
 		return w;
 	}
 
-	version.resize(8);
+	//Only the first 4 characters are stored, padded to one Blowfish block
+	uint8_t encoded[8] = {0};
+	uint64_t length = version.size() < 4 ? version.size() : 4;
 
 	Blowfish bf;
 	bf.Initialize("SILKROADVERSION", 8);
-	bf.Encode(&version[0], 4, &version[0], 8);
+	BlowfishStreamEncoder encoder(bf, encoded, sizeof(encoded));
+	encoder.Write(version.c_str(), length);
+	encoder.Finish();
 
 	w.Write<uint32_t>(8);				//Blowfish output size
-	w.Write<char>(&version[0], 8);		//Version
+	w.Write<uint8_t>(encoded, 8);		//Version
 	
 	//Calculate how much padding should be appended
 	uint16_t size = w.GetStreamSize();
@@ -0,0 +1,455 @@
+//-----------------------------------------------------------------------------
+/*
+	pk2mount - read-only FUSE mount of a PK2 archive
+
+	Exposes a PK2 archive as a directory tree so standard tools can read it
+	without extracting anything. Attributes and directory listings come from
+	an index built once at mount time, and file reads are answered straight
+	out of PK2Reader's mapping, so no data is copied in user space.
+
+	Usage:
+		pk2mount [--key=169841] Media.pk2 <mountpoint> [FUSE options]
+
+	Building (Linux, libfuse 3):
+		g++ -O2 -I../DivisionInfo pk2mount.cpp ../DivisionInfo/PK2/PK2Reader.cpp
+			../DivisionInfo/PK2/blowfish.cpp ../DivisionInfo/PK2/blowfish_avx2.cpp
+			../DivisionInfo/PK2/blowfish_version.cpp `pkg-config fuse3 --cflags --libs`
+			-lboost_iostreams -lboost_thread -lboost_system -lpthread -o pk2mount
+*/
+//-----------------------------------------------------------------------------
+
+#define FUSE_USE_VERSION 31
+
+#include <fuse_lowlevel.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <sys/statvfs.h>
+#include <map>
+#include <string>
+#include <vector>
+
+#include "PK2/PK2Reader.h"
+
+//-----------------------------------------------------------------------------
+
+// One node per PK2 entry. The inode number is the node's position in the
+// table; the root is FUSE_ROOT_ID (1) and slot 0 is unused.
+struct PK2Node
+{
+	PK2Entry entry;
+	fuse_ino_t parent;
+	std::map<std::string, fuse_ino_t> children; // lower case name -> inode
+};
+
+PK2Reader reader;
+std::vector<PK2Node> nodes;
+
+// Attributes never change while mounted
+const double attr_timeout = 86400.0;
+
+//-----------------------------------------------------------------------------
+
+// Converts a Windows FILETIME (100ns intervals since 1601) to a time_t
+time_t FileTimeToUnix(uint64_t filetime)
+{
+	if(filetime < 116444736000000000ULL)
+	{
+		return 0;
+	}
+	return (time_t)((filetime - 116444736000000000ULL) / 10000000ULL);
+}
+
+//-----------------------------------------------------------------------------
+
+void FillStat(fuse_ino_t ino, struct stat & st)
+{
+	const PK2Entry & e = nodes[ino].entry;
+
+	memset(&st, 0, sizeof(st));
+	st.st_ino = ino;
+
+	if(e.type == 1)
+	{
+		st.st_mode = S_IFDIR | 0555;
+		st.st_nlink = 2;
+	}
+	else
+	{
+		st.st_mode = S_IFREG | 0444;
+		st.st_nlink = 1;
+		st.st_size = e.size;
+		st.st_blocks = (e.size + 511) / 512;
+	}
+
+	st.st_atime = FileTimeToUnix(e.accessTime);
+	st.st_mtime = FileTimeToUnix(e.modifyTime);
+	st.st_ctime = FileTimeToUnix(e.createTime);
+}
+
+//-----------------------------------------------------------------------------
+
+// Builds the inode table from the reader's index. The index is sorted by path,
+// so a folder is always added before anything inside it.
+bool BuildNodes()
+{
+	std::map<std::string, PK2Entry> index;
+	if(!reader.BuildIndex(index))
+	{
+		return false;
+	}
+
+	nodes.resize(FUSE_ROOT_ID + 1);
+	memset(&nodes[FUSE_ROOT_ID].entry, 0, sizeof(PK2Entry));
+	nodes[FUSE_ROOT_ID].entry.type = 1;
+	nodes[FUSE_ROOT_ID].parent = FUSE_ROOT_ID;
+
+	std::map<std::string, fuse_ino_t> folders;
+	folders[""] = FUSE_ROOT_ID;
+
+	for(std::map<std::string, PK2Entry>::iterator itr = index.begin(); itr != index.end(); ++itr)
+	{
+		const std::string & path = itr->first;
+
+		size_t slash = path.find_last_of('\\');
+		std::string parent_path = (slash == std::string::npos) ? std::string() : path.substr(0, slash);
+		std::string name = (slash == std::string::npos) ? path : path.substr(slash + 1);
+
+		std::map<std::string, fuse_ino_t>::iterator parent = folders.find(parent_path);
+		if(parent == folders.end())
+		{
+			continue;
+		}
+
+		fuse_ino_t ino = nodes.size();
+		nodes.push_back(PK2Node());
+		nodes[ino].entry = itr->second;
+		nodes[ino].parent = parent->second;
+		nodes[parent->second].children[name] = ino;
+
+		if(itr->second.type == 1)
+		{
+			folders[path] = ino;
+		}
+	}
+
+	return true;
+}
+
+//-----------------------------------------------------------------------------
+
+bool ValidInode(fuse_ino_t ino)
+{
+	return ino >= FUSE_ROOT_ID && ino < nodes.size();
+}
+
+//-----------------------------------------------------------------------------
+
+void pk2_lookup(fuse_req_t req, fuse_ino_t parent, const char * name)
+{
+	if(!ValidInode(parent) || nodes[parent].entry.type != 1)
+	{
+		fuse_reply_err(req, ENOTDIR);
+		return;
+	}
+
+	std::string key = name;
+	for(size_t x = 0; x < key.size(); ++x)
+	{
+		key[x] = (char)tolower((unsigned char)key[x]);
+	}
+
+	std::map<std::string, fuse_ino_t>::iterator itr = nodes[parent].children.find(key);
+	if(itr == nodes[parent].children.end())
+	{
+		fuse_reply_err(req, ENOENT);
+		return;
+	}
+
+	struct fuse_entry_param e;
+	memset(&e, 0, sizeof(e));
+	e.ino = itr->second;
+	e.attr_timeout = attr_timeout;
+	e.entry_timeout = attr_timeout;
+	FillStat(itr->second, e.attr);
+
+	fuse_reply_entry(req, &e);
+}
+
+//-----------------------------------------------------------------------------
+
+void pk2_getattr(fuse_req_t req, fuse_ino_t ino, struct fuse_file_info *)
+{
+	if(!ValidInode(ino))
+	{
+		fuse_reply_err(req, ENOENT);
+		return;
+	}
+
+	struct stat st;
+	FillStat(ino, st);
+	fuse_reply_attr(req, &st, attr_timeout);
+}
+
+//-----------------------------------------------------------------------------
+
+void pk2_readdir(fuse_req_t req, fuse_ino_t ino, size_t size, off_t off, struct fuse_file_info *)
+{
+	if(!ValidInode(ino) || nodes[ino].entry.type != 1)
+	{
+		fuse_reply_err(req, ENOTDIR);
+		return;
+	}
+
+	PK2Node & node = nodes[ino];
+	std::vector<char> buffer(size);
+	size_t used = 0;
+
+	// Offsets 0 and 1 are "." and "..", children start at 2
+	off_t index = 0;
+	std::map<std::string, fuse_ino_t>::iterator itr = node.children.begin();
+
+	while(true)
+	{
+		const char * name = 0;
+		fuse_ino_t child = 0;
+
+		if(index == 0)
+		{
+			name = ".";
+			child = ino;
+		}
+		else if(index == 1)
+		{
+			name = "..";
+			child = node.parent;
+		}
+		else if(itr != node.children.end())
+		{
+			name = nodes[itr->second].entry.name;
+			child = itr->second;
+			++itr;
+		}
+		else
+		{
+			break;
+		}
+
+		++index;
+		if(index <= off)
+		{
+			continue;
+		}
+
+		struct stat st;
+		memset(&st, 0, sizeof(st));
+		st.st_ino = child;
+		st.st_mode = (nodes[child].entry.type == 1) ? S_IFDIR : S_IFREG;
+
+		size_t needed = fuse_add_direntry(req, &buffer[0] + used, size - used, name, &st, index);
+		if(needed > size - used)
+		{
+			break;
+		}
+		used += needed;
+	}
+
+	fuse_reply_buf(req, used ? &buffer[0] : 0, used);
+}
+
+//-----------------------------------------------------------------------------
+
+void pk2_open(fuse_req_t req, fuse_ino_t ino, struct fuse_file_info * fi)
+{
+	if(!ValidInode(ino))
+	{
+		fuse_reply_err(req, ENOENT);
+		return;
+	}
+
+	if(nodes[ino].entry.type == 1)
+	{
+		fuse_reply_err(req, EISDIR);
+		return;
+	}
+
+	if((fi->flags & O_ACCMODE) != O_RDONLY)
+	{
+		fuse_reply_err(req, EROFS);
+		return;
+	}
+
+	// The archive is read-only, so the kernel may keep pages across opens
+	fi->keep_cache = 1;
+	fuse_reply_open(req, fi);
+}
+
+//-----------------------------------------------------------------------------
+
+void pk2_read(fuse_req_t req, fuse_ino_t ino, size_t size, off_t off, struct fuse_file_info *)
+{
+	if(!ValidInode(ino) || nodes[ino].entry.type != 2)
+	{
+		fuse_reply_err(req, EINVAL);
+		return;
+	}
+
+	PK2Entry & e = nodes[ino].entry;
+
+	if(off < 0 || (uint64_t)off >= e.size)
+	{
+		fuse_reply_buf(req, 0, 0);
+		return;
+	}
+
+	if(size > (uint64_t)(e.size - off))
+	{
+		size = (size_t)(e.size - off);
+	}
+
+	// Replies straight from the mapping, no intermediate buffer. A damaged entry
+	// or a truncated archive fails this one read, not the whole mount.
+	const char * data = reader.Extract(e);
+	if(data == 0)
+	{
+		fuse_reply_err(req, EIO);
+		return;
+	}
+	fuse_reply_buf(req, data + off, size);
+}
+
+//-----------------------------------------------------------------------------
+
+void pk2_statfs(fuse_req_t req, fuse_ino_t)
+{
+	struct statvfs st;
+	memset(&st, 0, sizeof(st));
+	st.f_bsize = 4096;
+	st.f_frsize = 4096;
+	st.f_files = nodes.size() - FUSE_ROOT_ID;
+	st.f_namemax = sizeof(((PK2Entry *)0)->name) - 1;
+	st.f_flag = ST_RDONLY;
+	fuse_reply_statfs(req, &st);
+}
+
+//-----------------------------------------------------------------------------
+
+struct PK2MountOptions
+{
+	char * archive;
+	char * key;
+};
+
+const struct fuse_opt option_spec[] =
+{
+	{ "--key=%s", offsetof(PK2MountOptions, key), 1 },
+	FUSE_OPT_END
+};
+
+// The first non-option argument is the archive, everything else goes to FUSE
+int OptionProc(void * data, const char * arg, int key, struct fuse_args *)
+{
+	PK2MountOptions * options = reinterpret_cast<PK2MountOptions *>(data);
+	if(key == FUSE_OPT_KEY_NONOPT && options->archive == 0)
+	{
+		options->archive = strdup(arg);
+		return 0;
+	}
+	return 1;
+}
+
+//-----------------------------------------------------------------------------
+
+int main(int argc, char * argv[])
+{
+	struct fuse_args args = FUSE_ARGS_INIT(argc, argv);
+
+	PK2MountOptions options;
+	memset(&options, 0, sizeof(options));
+	if(fuse_opt_parse(&args, &options, option_spec, OptionProc) == -1)
+	{
+		return 1;
+	}
+
+	struct fuse_cmdline_opts opts;
+	if(fuse_parse_cmdline(&args, &opts) != 0)
+	{
+		return 1;
+	}
+
+	if(opts.show_help || options.archive == 0 || opts.mountpoint == 0)
+	{
+		printf("usage: %s [--key=KEY] <archive.pk2> <mountpoint> [options]\n\n", argv[0]);
+		fuse_cmdline_help();
+		fuse_lowlevel_help();
+		return opts.show_help ? 0 : 1;
+	}
+
+	if(options.key)
+	{
+		reader.SetDecryptionKey(options.key, (uint8_t)strlen(options.key));
+	}
+
+	// Lookups jump around the directory blocks, reads are usually whole files
+	reader.SetAccessMode(Access_Random);
+
+	if(!reader.Open(options.archive, Open_PrefetchDirectory))
+	{
+		fprintf(stderr, "%s\n", reader.GetError().c_str());
+		return 1;
+	}
+
+	if(!BuildNodes())
+	{
+		fprintf(stderr, "Could not index \"%s\": %s\n", options.archive, reader.GetError().c_str());
+		return 1;
+	}
+
+	struct fuse_lowlevel_ops ops;
+	memset(&ops, 0, sizeof(ops));
+	ops.lookup = pk2_lookup;
+	ops.getattr = pk2_getattr;
+	ops.readdir = pk2_readdir;
+	ops.open = pk2_open;
+	ops.read = pk2_read;
+	ops.statfs = pk2_statfs;
+
+	int ret = 1;
+	struct fuse_session * se = fuse_session_new(&args, &ops, sizeof(ops), 0);
+	if(se)
+	{
+		if(fuse_set_signal_handlers(se) == 0)
+		{
+			if(fuse_session_mount(se, opts.mountpoint) == 0)
+			{
+				fuse_daemonize(opts.foreground);
+
+				if(opts.singlethread)
+				{
+					ret = fuse_session_loop(se);
+				}
+				else
+				{
+					ret = fuse_session_loop_mt(se, opts.clone_fd);
+				}
+
+				fuse_session_unmount(se);
+			}
+			fuse_remove_signal_handlers(se);
+		}
+		fuse_session_destroy(se);
+	}
+
+	free(opts.mountpoint);
+	free(options.archive);
+	free(options.key);
+	fuse_opt_free_args(&args);
+
+	return ret ? 1 : 0;
+}
+
+//-----------------------------------------------------------------------------